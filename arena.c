@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// ===========================[ Constants ]===========================
+#define ARENA_BLOCK 4096
+#define ARENA_ALIGN 16
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Initializes an empty arena. Blocks are allocated on first use.
+ *
+ * @param arena Arena to initialize
+ */
+void initArena(tarena * arena) {
+    arena->head = NULL;
+    arena->current = NULL;
+}
+
+/**
+ * Releases every allocation at once, keeping the blocks for reuse
+ *
+ * @param arena Arena to reset
+ */
+void resetArena(tarena * arena) {
+    tarenablock * block;
+
+    for (block = arena->head; block != NULL; block = block->next) block->used = 0;
+
+    arena->current = arena->head;
+}
+
+/**
+ * Resets an arena and frees the blocks past the first ones that fit in
+ * keep bytes, so one huge allocation does not stay pinned for good
+ *
+ * @param arena Arena to trim
+ * @param keep Bytes of blocks to keep for reuse
+ */
+void trimArena(tarena * arena, size_t keep) {
+    tarenablock * block, * next, ** link = &arena->head;
+    size_t kept = 0;
+
+    for (block = arena->head; block != NULL && kept + block->size <= keep; block = block->next) {
+        kept += block->size;
+        link = &block->next;
+    }
+
+    // The blocks past the budget are released
+    *link = NULL;
+
+    for (; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+
+    resetArena(arena);
+}
+
+/**
+ * Frees every block of an arena
+ *
+ * @param arena Arena to free
+ */
+void freeArena(tarena * arena) {
+    tarenablock * block, * next;
+
+    for (block = arena->head; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+
+    initArena(arena);
+}
+
+/**
+ * Allocates memory from an arena
+ *
+ * @param arena Arena to allocate from
+ * @param size Number of bytes
+ * @return Aligned memory valid until the arena is reset
+ */
+void * arenaAlloc(tarena * arena, size_t size) {
+    tarenablock * block, * last = NULL;
+    size_t blockSize;
+    void * ptr;
+
+    size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+
+    // Use the first block (from the current one) with enough room
+    for (block = arena->current; block != NULL; block = block->next) {
+        if (block->size - block->used >= size) break;
+        last = block;
+    }
+
+    if (block == NULL) {
+        blockSize = ARENA_BLOCK;
+
+        if (last != NULL && last->size * 2 > blockSize) blockSize = last->size * 2;
+        if (size > blockSize) blockSize = size;
+
+        block = (tarenablock *) checkedRealloc(NULL, sizeof(tarenablock) + blockSize);
+
+        block->next = NULL;
+        block->size = blockSize;
+        block->used = 0;
+
+        // Blocks are searched from current to the tail, so last is the tail
+        if (last != NULL) last->next = block;
+        else arena->head = block;
+    }
+
+    arena->current = block;
+
+    ptr = block->data + block->used;
+    block->used += size;
+
+    return ptr;
+}
+
+/**
+ * Copies a string into an arena
+ *
+ * @param arena Arena to allocate from
+ * @param str String to copy
+ * @return Copy valid until the arena is reset
+ */
+char * arenaStrdup(tarena * arena, const char * str) {
+    size_t len = strlen(str) + 1;
+    char * copy = (char *) arenaAlloc(arena, len);
+
+    memcpy(copy, str, len);
+    return copy;
+}
+
+/**
+ * Returns the memory held by an arena
+ *
+ * @param arena Arena to measure
+ * @return Total size of its blocks in bytes
+ */
+size_t arenaSize(tarena * arena) {
+    tarenablock * block;
+    size_t size = 0;
+
+    for (block = arena->head; block != NULL; block = block->next) size += block->size;
+
+    return size;
+}
+
+/**
+ * Reallocates memory, exiting if it fails
+ *
+ * @param ptr Pointer to reallocate (NULL to allocate)
+ * @param size New size
+ * @return Reallocated pointer
+ */
+void * checkedRealloc(void * ptr, size_t size) {
+    ptr = realloc(ptr, size);
+
+    // Check for malloc errors
+    if (ptr == NULL && size > 0) {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return ptr;
+}
@@ -0,0 +1,46 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Block of arena memory
+ *
+ * @param next: Next block of the arena
+ * @param size: Usable size of the block
+ * @param used: Bytes already handed out
+ * @param data: Block memory
+ */
+typedef struct tarenablock {
+    struct tarenablock * next;
+    size_t size;
+    size_t used;
+    char data[];
+} tarenablock;
+
+/**
+ * Arena allocator. Memory is handed out from blocks that are only
+ * released all at once, so pointers stay valid until the arena is reset.
+ *
+ * @param head: First block
+ * @param current: Block allocations are taken from
+ */
+typedef struct {
+    tarenablock * head;
+    tarenablock * current;
+} tarena;
+
+// ===========================[ Prototypes ]==========================
+
+void initArena(tarena * arena);
+void resetArena(tarena * arena);
+void trimArena(tarena * arena, size_t keep);
+void freeArena(tarena * arena);
+void * arenaAlloc(tarena * arena, size_t size);
+char * arenaStrdup(tarena * arena, const char * str);
+size_t arenaSize(tarena * arena);
+void * checkedRealloc(void * ptr, size_t size);
+
+#endif
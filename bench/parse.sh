@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# Parse benchmark: checks the in-tree parser against bin/libparser.a using
+# the test.c driver as oracle, then measures the parse rate of both.
+# Usage: bench/parse.sh [iterations]
+
+# Define the directories
+ROOT_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_DIR="$ROOT_DIR/build/bench"
+CORPUS="$ROOT_DIR/bench/parse_corpus.txt"
+
+mkdir -p "$BUILD_DIR"
+
+# Rename the original tokenize so both parsers can be linked together
+objcopy --redefine-sym tokenize=libTokenize "$ROOT_DIR/bin/libparser.a" "$BUILD_DIR/libparser_ref.a" || exit 2
+
+# [Oracle] =====================================================>>
+
+gcc -w "$ROOT_DIR/test.c" "$ROOT_DIR/bin/libparser.a" -o "$BUILD_DIR/test_lib" -static || exit 2
+gcc -w "$ROOT_DIR/test.c" "$ROOT_DIR/parser.c" "$ROOT_DIR/arena.c" -o "$BUILD_DIR/test_arena" || exit 2
+
+"$BUILD_DIR/test_lib" < "$CORPUS" > "$BUILD_DIR/test_lib.out" 2>&1
+"$BUILD_DIR/test_arena" < "$CORPUS" > "$BUILD_DIR/test_arena.out" 2>&1
+
+if ! diff "$BUILD_DIR/test_lib.out" "$BUILD_DIR/test_arena.out" > /dev/null
+then
+    echo "Error: The in-tree parser output differs from bin/libparser.a." >&2
+    diff "$BUILD_DIR/test_lib.out" "$BUILD_DIR/test_arena.out" >&2
+    exit 1
+fi
+
+# [Benchmark] ==================================================>>
+
+gcc -O2 -Wall -Werror "$ROOT_DIR/bench/parse_bench.c" "$ROOT_DIR/parser.c" "$ROOT_DIR/arena.c" \
+    "$BUILD_DIR/libparser_ref.a" -o "$BUILD_DIR/parse_bench" -static || exit 2
+
+"$BUILD_DIR/parse_bench" "$CORPUS" $1
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../parser.h"
+
+// ===========================[ Constants ]===========================
+#define MAX_LINES 4096
+#define LINE_SIZE 1024
+
+// ===========================[ Prototypes ]==========================
+extern tline * libTokenize(char * str);
+double elapsed(struct timespec * start);
+
+// ==============================[ Main ]=============================
+
+/**
+ * Parse throughput benchmark. Parses every line of a corpus with the
+ * original bin/libparser.a (tokenize renamed to libTokenize) and with the
+ * in-tree arena parser, and prints the lines per second as JSON.
+ *
+ * Usage: parse_bench corpus [iterations]
+ */
+int main(int argc, char * argv[]) {
+    static char lines[MAX_LINES][LINE_SIZE];
+    char buffer[LINE_SIZE];
+    struct timespec start;
+    double libTime, arenaTime, bareTime;
+    tarena arena;
+    FILE * corpus;
+    int i, j, n = 0, iterations = 2000;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s corpus [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc > 2) iterations = atoi(argv[2]);
+
+    corpus = fopen(argv[1], "r");
+
+    if (corpus == NULL) {
+        fprintf(stderr, "Error: %s not found\n", argv[1]);
+        return 1;
+    }
+
+    while (n < MAX_LINES && fgets(lines[n], LINE_SIZE, corpus) != NULL) n++;
+    fclose(corpus);
+
+    // Syntax errors are part of the corpus, their messages are not measured
+    freopen("/dev/null", "w", stderr);
+
+    // Original parser (it modifies its input, so each line is copied)
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < n; j++) {
+            memcpy(buffer, lines[j], LINE_SIZE);
+            libTokenize(buffer);
+        }
+    }
+
+    libTime = elapsed(&start);
+
+    // Arena parser resolving commands through PATH, like tokenize
+    initArena(&arena);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < n; j++) {
+            resetArena(&arena);
+            parseLine(&arena, lines[j], searchCommand);
+        }
+    }
+
+    arenaTime = elapsed(&start);
+
+    // Arena parser without command resolution (tokenizing only)
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < n; j++) {
+            resetArena(&arena);
+            parseLine(&arena, lines[j], NULL);
+        }
+    }
+
+    bareTime = elapsed(&start);
+    freeArena(&arena);
+
+    fprintf(stdout, "{\"benchmark\": \"parse\", \"lines\": %d, \"iterations\": %d, ", n, iterations);
+    fprintf(stdout, "\"libparser_lines_per_sec\": %.0f, ", n * (double) iterations / libTime);
+    fprintf(stdout, "\"arena_lines_per_sec\": %.0f, ", n * (double) iterations / arenaTime);
+    fprintf(stdout, "\"arena_tokenize_only_lines_per_sec\": %.0f}\n", n * (double) iterations / bareTime);
+
+    return 0;
+}
+
+/**
+ * Returns the seconds elapsed since start
+ *
+ * @param start Start time (CLOCK_MONOTONIC)
+ * @return Elapsed seconds
+ */
+double elapsed(struct timespec * start) {
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
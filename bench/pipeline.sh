@@ -0,0 +1,61 @@
+#!/bin/bash
+
+# Pipeline benchmark: measures the throughput of a multi-stage pipeline run
+# by the shell with the default pipes and with the set pipesize and
+# pipeline-affinity options. Prints one JSON object per configuration.
+# Usage: bench/pipeline.sh [megabytes] [runs]
+
+# Define the directories
+ROOT_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_DIR="$ROOT_DIR/build/bench"
+SHELL_BIN="$ROOT_DIR/main"
+
+MEGABYTES=${1:-1024}
+RUNS=${2:-3}
+BYTES=$((MEGABYTES * 1024 * 1024))
+
+if [ ! -x "$SHELL_BIN" ]
+then
+    echo "Error: $SHELL_BIN not found, run ./compile.sh first." >&2
+    exit 2
+fi
+
+mkdir -p "$BUILD_DIR"
+
+# External stages, so every byte crosses each pipe through read and write
+PIPELINE="head -c $BYTES /dev/zero | /bin/cat | tr \\000 a | /bin/cat | wc -c"
+CONFIGS=(
+    "pipesize=default pipeline-affinity=none"
+    "pipesize=1M pipeline-affinity=none"
+    "pipesize=1M pipeline-affinity=compact"
+    "pipesize=1M pipeline-affinity=spread"
+)
+
+for CONFIG in "${CONFIGS[@]}"
+do
+    echo "set $CONFIG -- $PIPELINE" > "$BUILD_DIR/pipeline.msh"
+    BEST=0
+
+    # Keep the fastest run
+    for ((RUN = 0; RUN < RUNS; RUN++))
+    do
+        START=$(date +%s%N)
+        OUTPUT=$("$SHELL_BIN" "$BUILD_DIR/pipeline.msh")
+        END=$(date +%s%N)
+
+        if [ "$OUTPUT" != "$BYTES" ]
+        then
+            echo "Error: The pipeline produced $OUTPUT bytes instead of $BYTES." >&2
+            exit 1
+        fi
+
+        ELAPSED=$((END - START))
+        if [ $BEST -eq 0 ] || [ $ELAPSED -lt $BEST ]; then BEST=$ELAPSED; fi
+    done
+
+    PIPESIZE=$(echo "$CONFIG" | sed 's/pipesize=\([^ ]*\).*/\1/')
+    AFFINITY=$(echo "$CONFIG" | sed 's/.*pipeline-affinity=//')
+    MBS=$(awk "BEGIN { printf \"%.1f\", $MEGABYTES / ($BEST / 1e9) }")
+
+    echo "{\"benchmark\": \"pipeline\", \"stages\": 5, \"megabytes\": $MEGABYTES, \"pipesize\": \"$PIPESIZE\", \"affinity\": \"$AFFINITY\", \"mb_per_sec\": $MBS}"
+done
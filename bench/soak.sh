@@ -0,0 +1,100 @@
+#!/bin/bash
+
+# Soak test: feeds the shell a long stream of lines (builtins, variables,
+# here-strings, wildcards, history-like repeats, foreground, background
+# and &capture jobs) and samples its resident set size. Fails if the RSS
+# grows by more than the bound once the shell has warmed up.
+# Usage: bench/soak.sh [lines] [bound in KiB]
+
+# Define the directories
+ROOT_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_DIR="$ROOT_DIR/build/bench"
+SHELL_BIN="$ROOT_DIR/main"
+
+LINES=${1:-1000000}
+BOUND=${2:-1024}
+# Fraction of the samples taken while the shell warms up
+WARMUP=0.1
+
+if [ ! -x "$SHELL_BIN" ]
+then
+    echo "Error: $SHELL_BIN not found, run ./compile.sh first." >&2
+    exit 2
+fi
+
+mkdir -p "$BUILD_DIR/soak"
+cd "$BUILD_DIR/soak" || exit 2
+mkdir -p d
+
+# Every line a long session runs into, an external command every 100 lines
+generate() {
+    awk -v lines="$LINES" 'BEGIN {
+        for (i = 0; i < lines; i++) {
+            if (i % 1000 == 0) print "/bin/echo " i " &capture"
+            else if (i % 500 == 0) print "/bin/true &"
+            else if (i % 100 == 0) print "/bin/echo " i " | /bin/cat > /dev/null"
+            else if (i % 1000 == 1) print "jobs -o 1 > /dev/null"
+            else if (i % 10 == 2) print "V" (i % 50) "=value" i
+            else if (i % 10 == 3) print "export W=" i
+            else if (i % 10 == 4) print "cd ."
+            else if (i % 10 == 5) print "set pipesize=64K -- umask 022"
+            else if (i % 10 == 6) print "unset V" (i % 50)
+            else if (i % 10 == 7) print "jobs > /dev/null"
+            else if (i % 10 == 8) print "cd [d]"
+            else if (i % 10 == 9) print "cd .."
+            else if (i % 20 == 0) print "umask <<<0022"
+            else print "hash > /dev/null"
+        }
+    }'
+}
+
+SAMPLES="$BUILD_DIR/soak/rss.txt"
+: > "$SAMPLES"
+
+# Lines are only kept in the history when typed, but never the user's
+export HISTFILE="$BUILD_DIR/soak/history"
+rm -f "$HISTFILE" "$HISTFILE.idx"
+
+# The shell reads the stream from a fifo so its pid can be sampled
+rm -f input.fifo
+mkfifo input.fifo
+
+"$SHELL_BIN" < input.fifo > /dev/null 2> errors.txt &
+SHELL_PID=$!
+
+START=$(date +%s%N)
+generate > input.fifo &
+GENERATOR=$!
+
+# Sample the RSS (KiB) with the number of lines already written
+while kill -0 $SHELL_PID 2> /dev/null
+do
+    RSS=$(awk '/^VmRSS/ { print $2 }' /proc/$SHELL_PID/status 2> /dev/null)
+    [ -n "$RSS" ] && echo "$RSS" >> "$SAMPLES"
+    sleep 0.1
+done
+
+wait $GENERATOR
+wait $SHELL_PID
+END=$(date +%s%N)
+
+# Growth between the end of the warmup and the peak
+read -r FIRST PEAK COUNT < <(awk -v warm="$WARMUP" '
+    { rss[NR] = $1 }
+    END {
+        start = int(NR * warm) + 1
+        peak = 0
+        for (i = start; i <= NR; i++) if (rss[i] > peak) peak = rss[i]
+        print rss[start], peak, NR
+    }' "$SAMPLES")
+
+GROWTH=$((PEAK - FIRST))
+SECONDS_TAKEN=$(awk "BEGIN { printf \"%.1f\", ($END - $START) / 1e9 }")
+
+echo "{\"benchmark\": \"soak\", \"lines\": $LINES, \"seconds\": $SECONDS_TAKEN, \"samples\": $COUNT, \"rss_kib\": $FIRST, \"peak_kib\": $PEAK, \"growth_kib\": $GROWTH, \"bound_kib\": $BOUND}"
+
+if [ "$GROWTH" -gt "$BOUND" ]
+then
+    echo "Error: The RSS grew by $GROWTH KiB after the warmup (bound $BOUND KiB)." >&2
+    exit 1
+fi
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+// ===========================[ Constants ]===========================
+#define DEFAULT_RUNS 200
+#define PROMPT_END "$> "
+#define PROMPT_TIMEOUT_MS 5000
+
+// ===========================[ Prototypes ]==========================
+void startupBenchmark(char * mode, char * shell, int runs);
+long long runTrue(char * shell);
+long long runPrompt(char * shell);
+int dropCaches();
+long long now();
+int compareTimes(const void * a, const void * b);
+
+// ========================[ Global Variables ]=======================
+extern char ** environ;
+
+// ==============================[ Main ]=============================
+
+/**
+ * Startup benchmark: time for "shell -c true" and time to the first prompt
+ * on a terminal. The cold run comes first, after dropping the page cache
+ * when allowed (caches_dropped tells whether it was), then the warm runs.
+ * Prints one JSON object per mode.
+ *
+ * Usage: startup shell [runs]
+ */
+int main(int argc, char * argv[]) {
+    char history[] = "/tmp/msh-startup-XXXXXX", index[sizeof(history) + 4];
+    int runs = DEFAULT_RUNS, fd;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s shell [runs]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc > 2) runs = atoi(argv[2]);
+
+    // The first prompt must not touch the user's history, it gets a file of
+    // its own that is removed with its index at the end
+    fd = mkstemp(history);
+
+    if (fd == -1) {
+        fprintf(stderr, "Error: mkstemp failed\n");
+        return 1;
+    }
+
+    close(fd);
+    snprintf(index, sizeof(index), "%s.idx", history);
+    setenv("HISTFILE", history, 1);
+
+    startupBenchmark("c_true", argv[1], runs);
+    startupBenchmark("first_prompt", argv[1], runs);
+
+    unlink(history);
+    unlink(index);
+
+    return 0;
+}
+
+/**
+ * Measures one startup mode and prints the cold time and the warm median
+ * and 95th percentile
+ *
+ * @param mode "c_true" or "first_prompt"
+ * @param shell Shell to start
+ * @param runs Number of warm runs
+ */
+void startupBenchmark(char * mode, char * shell, int runs) {
+    long long (*run)(char *) = strcmp(mode, "c_true") == 0 ? runTrue : runPrompt;
+    long long cold, * times;
+    int dropped, i;
+
+    times = (long long *) malloc(sizeof(long long) * runs);
+
+    if (times == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(1);
+    }
+
+    dropped = dropCaches();
+    cold = run(shell);
+
+    for (i = 0; i < runs; i++) times[i] = run(shell);
+    qsort(times, runs, sizeof(long long), compareTimes);
+
+    fprintf(stdout, "{\"benchmark\": \"startup\", \"mode\": \"%s\", \"runs\": %d, \"caches_dropped\": %d, ", mode, runs, dropped);
+    fprintf(stdout, "\"cold_usec\": %.1f, \"warm_usec_median\": %.1f, ", cold / 1e3, times[runs / 2] / 1e3);
+    fprintf(stdout, "\"warm_usec_p95\": %.1f}\n", times[runs * 95 / 100] / 1e3);
+
+    free(times);
+}
+
+/**
+ * Runs "shell -c true" until it exits
+ *
+ * @param shell Shell to start
+ * @return Nanoseconds from spawn to exit
+ */
+long long runTrue(char * shell) {
+    char * argv[] = {shell, "-c", "true", NULL};
+    long long start = now();
+    pid_t pid;
+
+    if (posix_spawn(&pid, shell, NULL, NULL, argv, environ) != 0) {
+        fprintf(stderr, "Error: %s could not be started\n", shell);
+        exit(1);
+    }
+
+    waitpid(pid, NULL, 0);
+
+    return now() - start;
+}
+
+/**
+ * Starts the shell on a new terminal and waits for its first prompt
+ *
+ * @param shell Shell to start
+ * @return Nanoseconds from fork to the end of the first prompt
+ */
+long long runPrompt(char * shell) {
+    char buffer[4096], * argv[] = {shell, NULL};
+    size_t used = 0;
+    long long start, end = 0;
+    struct pollfd poller;
+    ssize_t n;
+    int master, slave;
+    pid_t pid;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+    if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1) {
+        fprintf(stderr, "Error: no pseudo-terminal\n");
+        exit(1);
+    }
+
+    start = now();
+    pid = fork();
+
+    if (pid == 0) {
+        // The terminal becomes the controlling terminal of the shell
+        setsid();
+        slave = open(ptsname(master), O_RDWR);
+
+        dup2(slave, STDIN_FILENO);
+        dup2(slave, STDOUT_FILENO);
+        dup2(slave, STDERR_FILENO);
+        if (slave > STDERR_FILENO) close(slave);
+
+        execv(shell, argv);
+        _exit(127);
+    }
+
+    poller.fd = master;
+    poller.events = POLLIN;
+
+    while (end == 0 && poll(&poller, 1, PROMPT_TIMEOUT_MS) > 0) {
+        n = read(master, buffer + used, sizeof(buffer) - used - 1);
+        if (n <= 0) break;
+
+        used += n;
+        buffer[used] = '\0';
+
+        if (strstr(buffer, PROMPT_END) != NULL) end = now();
+        if (used == sizeof(buffer) - 1) used = 0;
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    close(master);
+
+    if (end == 0) {
+        fprintf(stderr, "Error: no prompt from %s\n", shell);
+        exit(1);
+    }
+
+    return end - start;
+}
+
+/**
+ * Drops the page cache so the next start reads the binary from disk
+ *
+ * @return 1 if the cache was dropped, 0 if not allowed
+ */
+int dropCaches() {
+    int fd;
+
+    sync();
+    fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd == -1) return 0;
+
+    if (write(fd, "3", 1) != 1) {
+        close(fd);
+        return 0;
+    }
+
+    close(fd);
+    return 1;
+}
+
+/**
+ * Reads the monotonic clock
+ *
+ * @return Nanoseconds
+ */
+long long now() {
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+/**
+ * Compares two times for qsort
+ *
+ * @param a First time
+ * @param b Second time
+ * @return Negative, zero or positive
+ */
+int compareTimes(const void * a, const void * b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+
+    return (x > y) - (x < y);
+}
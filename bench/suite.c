@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "../parser.h"
+#include "../jobs.h"
+#include "../complete.h"
+#include "../variables.h"
+
+// ===========================[ Constants ]===========================
+#define MAX_LINES 4096
+#define LINE_SIZE 1024
+
+// ===========================[ Prototypes ]==========================
+void tokenizeBenchmark(char * path, int iterations);
+void jobsBenchmark(int njobs, int operations);
+void completeBenchmark(int nexecutables, int completions);
+void expandBenchmark(int nvariables, int expansions);
+double elapsed(struct timespec * start);
+
+// ==============================[ Main ]=============================
+
+/**
+ * In-process part of the benchmark suite: parser rate, job store
+ * operations, command completion and variable expansion. Prints one JSON object per benchmark, bench/suite.sh
+ * collects them with the ones measured through the shell.
+ *
+ * Usage: suite corpus [iterations] [jobs] [operations]
+ */
+int main(int argc, char * argv[]) {
+    int iterations = 2000, njobs = 1000, operations = 1000000;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s corpus [iterations] [jobs] [operations]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc > 2) iterations = atoi(argv[2]);
+    if (argc > 3) njobs = atoi(argv[3]);
+    if (argc > 4) operations = atoi(argv[4]);
+
+    tokenizeBenchmark(argv[1], iterations);
+    jobsBenchmark(njobs, operations);
+    completeBenchmark(10000, 10000);
+    expandBenchmark(1000, 1000000);
+
+    return 0;
+}
+
+/**
+ * Measures the lines per second of the parser without command resolution
+ *
+ * @param path Corpus of lines
+ * @param iterations Times the corpus is parsed
+ */
+void tokenizeBenchmark(char * path, int iterations) {
+    static char lines[MAX_LINES][LINE_SIZE];
+    struct timespec start;
+    double time;
+    tarena arena;
+    FILE * corpus;
+    int i, j, n = 0;
+
+    corpus = fopen(path, "r");
+
+    if (corpus == NULL) {
+        fprintf(stderr, "Error: %s not found\n", path);
+        exit(1);
+    }
+
+    while (n < MAX_LINES && fgets(lines[n], LINE_SIZE, corpus) != NULL) n++;
+    fclose(corpus);
+
+    // Syntax errors are part of the corpus, their messages are not measured
+    freopen("/dev/null", "w", stderr);
+
+    initArena(&arena);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < n; j++) {
+            resetArena(&arena);
+            parseLine(&arena, lines[j], NULL);
+        }
+    }
+
+    time = elapsed(&start);
+    freeArena(&arena);
+
+    fprintf(stdout, "{\"benchmark\": \"tokenize\", \"lines\": %d, \"iterations\": %d, ", n, iterations);
+    fprintf(stdout, "\"lines_per_sec\": %.0f}\n", n * (double) iterations / time);
+}
+
+/**
+ * Measures the job store with njobs live jobs: every operation looks a
+ * job up by pid and by id, reaps it and replaces it with a new one, which
+ * is what a busy shell does for each finished background job.
+ *
+ * @param njobs Number of live jobs
+ * @param operations Number of replaced jobs
+ */
+void jobsBenchmark(int njobs, int operations) {
+    char * argv[] = {"sleep", "1", NULL};
+    struct timespec start;
+    tcommand command;
+    tline line;
+    tjobstore store;
+    tjob * job;
+    pid_t * pids;
+    pid_t nextPid = 1000;
+    double time;
+    int i, slot, stage;
+
+    command.filename = "/bin/sleep";
+    command.argc = 2;
+    command.argv = argv;
+
+    memset(&line, 0, sizeof(line));
+    line.ncommands = 1;
+    line.commands = &command;
+    line.background = 1;
+
+    pids = (pid_t *) malloc(sizeof(pid_t) * njobs);
+
+    if (pids == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(1);
+    }
+
+    initJobStore(&store);
+
+    for (i = 0; i < njobs; i++) {
+        job = addJob(&store, &line, "sleep 1 &\n");
+        pids[i] = nextPid++;
+        registerPid(&store, job, 0, pids[i]);
+    }
+
+    srand(42);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < operations; i++) {
+        slot = rand() % njobs;
+
+        job = findJobByPid(&store, pids[slot], &stage);
+        if (job == NULL || findJobById(&store, job->id) != job) {
+            fprintf(stderr, "Error: job %d not found\n", pids[slot]);
+            exit(1);
+        }
+
+        releasePid(&store, pids[slot], &stage);
+        removeJob(&store, job);
+
+        job = addJob(&store, &line, "sleep 1 &\n");
+        pids[slot] = nextPid++;
+        registerPid(&store, job, 0, pids[slot]);
+    }
+
+    time = elapsed(&start);
+
+    freeJobStore(&store);
+    free(pids);
+
+    fprintf(stdout, "{\"benchmark\": \"jobs\", \"jobs\": %d, \"operations\": %d, ", njobs, operations);
+    fprintf(stdout, "\"ops_per_sec\": %.0f}\n", operations / time);
+}
+
+/**
+ * Measures command completion over a PATH directory with nexecutables
+ * commands: the time to build the index in the background and the time
+ * of each completion once it is built (mtime check included).
+ *
+ * @param nexecutables Number of executables in PATH
+ * @param completions Number of completions
+ */
+void completeBenchmark(int nexecutables, int completions) {
+    char dir[] = "/tmp/msh-complete-XXXXXX", path[64], line[32];
+    struct timespec start;
+    tcompletion completion;
+    double buildTime, time;
+    int i, fd, matches = 0;
+
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "Error: mkdtemp failed\n");
+        exit(1);
+    }
+
+    for (i = 0; i < nexecutables; i++) {
+        snprintf(path, sizeof(path), "%s/cmd%05d", dir, i);
+        fd = open(path, O_WRONLY | O_CREAT, 0755);
+        if (fd != -1) close(fd);
+    }
+
+    setenv("PATH", dir, 1);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    startCommandIndex();
+    waitCommandIndex();
+    buildTime = elapsed(&start);
+
+    srand(42);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Prefixes matching ten commands each
+    for (i = 0; i < completions; i++) {
+        snprintf(line, sizeof(line), "cmd%04d", rand() % (nexecutables / 10));
+        findCompletions(line, strlen(line), &completion);
+        matches += completion.count;
+        freeCompletions(&completion);
+    }
+
+    time = elapsed(&start);
+
+    for (i = 0; i < nexecutables; i++) {
+        snprintf(path, sizeof(path), "%s/cmd%05d", dir, i);
+        unlink(path);
+    }
+
+    rmdir(dir);
+
+    fprintf(stdout, "{\"benchmark\": \"complete\", \"executables\": %d, \"completions\": %d, ", nexecutables, completions);
+    fprintf(stdout, "\"index_msec\": %.1f, \"usec_per_completion\": %.1f, ", buildTime * 1000, time / completions * 1e6);
+    fprintf(stdout, "\"matches\": %d}\n", matches);
+}
+
+/**
+ * Measures the expansion of words with three references each, the arena
+ * being reset every line of 16 words like the shell does
+ *
+ * @param nvariables Number of variables in the store
+ * @param expansions Number of words expanded
+ */
+void expandBenchmark(int nvariables, int expansions) {
+    char name[32], value[32], word[64];
+    struct timespec start;
+    size_t length = 0;
+    tarena arena;
+    double time;
+    int i;
+
+    initVariables();
+    initArena(&arena);
+
+    for (i = 0; i < nvariables; i++) {
+        snprintf(name, sizeof(name), "VAR%d", i);
+        snprintf(value, sizeof(value), "value%d", i);
+        setVariable(name, value, i % 2);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < expansions; i++) {
+        if (i % 16 == 0) resetArena(&arena);
+
+        snprintf(word, sizeof(word), "$VAR%d/${VAR%d}.$?", i % nvariables, (i * 7) % nvariables);
+        length += strlen(expandWord(&arena, word, i & 0xff, 0));
+    }
+
+    time = elapsed(&start);
+
+    fprintf(stdout, "{\"benchmark\": \"expand\", \"variables\": %d, \"expansions\": %d, ", nvariables, expansions);
+    fprintf(stdout, "\"nsec_per_expansion\": %.1f, \"arena_bytes\": %zu, \"bytes\": %zu}\n", time / expansions * 1e9, arenaSize(&arena), length);
+
+    freeArena(&arena);
+}
+
+/**
+ * Returns the seconds elapsed since start
+ *
+ * @param start Start time (CLOCK_MONOTONIC)
+ * @return Elapsed seconds
+ */
+double elapsed(struct timespec * start) {
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -0,0 +1,103 @@
+#!/bin/bash
+
+# Benchmark suite for the shell hot paths. Runs the shell on generated
+# scripts (line-to-exec latency, pipeline throughput, reaping of a burst
+# of background jobs), bench/suite.c for the parser, the job store,
+# command completion and variable expansion and bench/startup.c for the
+# startup time, then prints every result in one JSON document, also saved to
+# build/bench/suite.json.
+# Usage: bench/suite.sh [engine]
+
+# Define the directories
+ROOT_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_DIR="$ROOT_DIR/build/bench"
+SHELL_BIN="$ROOT_DIR/main"
+CORPUS="$ROOT_DIR/bench/parse_corpus.txt"
+
+ENGINE=${1:-posix_spawn}
+LINES=1000
+PIPELINE_MB=512
+BURST=500
+
+if [ ! -x "$SHELL_BIN" ]
+then
+    echo "Error: $SHELL_BIN not found, run ./compile.sh first." >&2
+    exit 2
+fi
+
+mkdir -p "$BUILD_DIR"
+
+# Nanoseconds taken by the shell to run a script
+run() {
+    local START END
+
+    START=$(date +%s%N)
+    "$SHELL_BIN" "$1" > /dev/null || return 1
+    END=$(date +%s%N)
+
+    echo $((END - START))
+}
+
+# [Line to exec] ===============================================>>
+
+# External command, so every line is parsed, spawned and reaped
+: > "$BUILD_DIR/empty.msh"
+for ((I = 0; I < LINES; I++)); do echo "/bin/true"; done > "$BUILD_DIR/lines.msh"
+
+BASE=$(run "$BUILD_DIR/empty.msh")
+TOTAL=$(run "$BUILD_DIR/lines.msh")
+LATENCY=$(awk "BEGIN { printf \"%.1f\", ($TOTAL - $BASE) / $LINES / 1000 }")
+
+RESULTS="{\"benchmark\": \"line_to_exec\", \"lines\": $LINES, \"usec_per_line\": $LATENCY}"
+
+# [Pipeline] ===================================================>>
+
+BYTES=$((PIPELINE_MB * 1024 * 1024))
+echo "head -c $BYTES /dev/zero | /bin/cat | /bin/cat | wc -c" > "$BUILD_DIR/pipeline.msh"
+
+TOTAL=$(run "$BUILD_DIR/pipeline.msh")
+MBS=$(awk "BEGIN { printf \"%.1f\", $PIPELINE_MB / ($TOTAL / 1e9) }")
+
+RESULTS="$RESULTS, {\"benchmark\": \"pipeline\", \"stages\": 4, \"megabytes\": $PIPELINE_MB, \"mb_per_sec\": $MBS}"
+
+# [Reaping burst] ==============================================>>
+
+# Every job exits at once, the shell reaps the burst while waiting
+{
+    for ((I = 0; I < BURST; I++)); do echo "/bin/true &"; done
+    echo "wait"
+} > "$BUILD_DIR/burst.msh"
+
+TOTAL=$(run "$BUILD_DIR/burst.msh")
+MSEC=$(awk "BEGIN { printf \"%.1f\", $TOTAL / 1e6 }")
+RATE=$(awk "BEGIN { printf \"%.0f\", $BURST / ($TOTAL / 1e9) }")
+
+RESULTS="$RESULTS, {\"benchmark\": \"reap_burst\", \"jobs\": $BURST, \"msec\": $MSEC, \"jobs_per_sec\": $RATE}"
+
+# [Parser and job store] =======================================>>
+
+gcc -O2 -Wall -Werror -pthread "$ROOT_DIR/bench/suite.c" "$ROOT_DIR/parser.c" "$ROOT_DIR/arena.c" \
+    "$ROOT_DIR/jobs.c" "$ROOT_DIR/complete.c" "$ROOT_DIR/builtins.c" "$ROOT_DIR/relay.c" \
+    "$ROOT_DIR/variables.c" -o "$BUILD_DIR/suite" || exit 2
+
+while read -r RESULT
+do
+    RESULTS="$RESULTS, $RESULT"
+done < <("$BUILD_DIR/suite" "$CORPUS")
+
+# [Startup] ====================================================>>
+
+# Time for -c true and to the first prompt on a terminal, cold and warm
+gcc -O2 -Wall -Werror "$ROOT_DIR/bench/startup.c" -o "$BUILD_DIR/startup" || exit 2
+
+while read -r RESULT
+do
+    RESULTS="$RESULTS, $RESULT"
+done < <("$BUILD_DIR/startup" "$SHELL_BIN")
+
+# [Report] =====================================================>>
+
+COMMIT=$(git -C "$ROOT_DIR" rev-parse --short HEAD 2> /dev/null)
+
+echo "{\"suite\": \"minishell\", \"commit\": \"$COMMIT\", \"engine\": \"$ENGINE\", \"results\": [$RESULTS]}" \
+    | tee "$BUILD_DIR/suite.json"
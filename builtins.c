@@ -0,0 +1,569 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "builtins.h"
+#include "relay.h"
+
+// ===========================[ Constants ]===========================
+#define OUTPUT_SIZE 4096
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Buffered output over a file descriptor
+ *
+ * @param fd: File descriptor to write to
+ * @param length: Bytes buffered
+ * @param buffer: Pending bytes
+ */
+typedef struct {
+    int fd;
+    size_t length;
+    char buffer[OUTPUT_SIZE];
+} toutput;
+
+// ===========================[ Prototypes ]==========================
+static int compareBuiltins(const void * a, const void * b);
+static void outputWrite(toutput * output, const char * data, size_t length);
+static int outputFlush(toutput * output);
+static char * printfEscape(toutput * output, char * format);
+static char * printfConversion(toutput * output, char * format, char * arg);
+static int testUnary(char * op, char * arg);
+static int testBinary(char * left, char * op, char * right, int * result);
+static int testExpression(int argc, char ** argv);
+
+// ========================[ Global Variables ]=======================
+static tbuiltin * builtins = NULL;
+static int nbuiltins = 0;
+
+// ===========================[ Registry ]===========================
+
+/**
+ * Registers a builtin, replacing any builtin with the same name. The
+ * registry is kept sorted so lookups are a binary search.
+ *
+ * @param name Name of the builtin
+ * @param function Function that executes it
+ * @param flags BUILTIN_PIPELINE if it can run as a pipeline stage,
+ *              BUILTIN_STREAM if it copies a stream that may never end
+ */
+void registerBuiltin(char * name, tbuiltinfn function, int flags) {
+    tbuiltin * builtin = findBuiltin(name);
+
+    if (builtin != NULL) {
+        builtin->function = function;
+        builtin->flags = flags;
+        return;
+    }
+
+    builtins = (tbuiltin *) realloc(builtins, sizeof(tbuiltin) * (nbuiltins + 1));
+
+    // Check for malloc errors
+    if (builtins == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    builtins[nbuiltins].name = name;
+    builtins[nbuiltins].function = function;
+    builtins[nbuiltins].flags = flags;
+    nbuiltins++;
+
+    qsort(builtins, nbuiltins, sizeof(tbuiltin), compareBuiltins);
+}
+
+/**
+ * Registers the in-process implementations of common utilities
+ */
+void registerUtilityBuiltins() {
+    registerBuiltin("echo", echoBuiltin, BUILTIN_PIPELINE);
+    registerBuiltin("true", trueBuiltin, BUILTIN_PIPELINE);
+    registerBuiltin("false", falseBuiltin, BUILTIN_PIPELINE);
+    registerBuiltin("printf", printfBuiltin, BUILTIN_PIPELINE);
+    registerBuiltin("cat", catBuiltin, BUILTIN_PIPELINE | BUILTIN_STREAM);
+    registerBuiltin("tee", teeBuiltin, BUILTIN_PIPELINE | BUILTIN_STREAM);
+    registerBuiltin("test", testBuiltin, BUILTIN_PIPELINE);
+    registerBuiltin("[", testBuiltin, BUILTIN_PIPELINE);
+}
+
+/**
+ * Finds a builtin by name
+ *
+ * @param name Name of the builtin
+ * @return The builtin, NULL if there is no builtin with that name
+ */
+tbuiltin * findBuiltin(char * name) {
+    tbuiltin key;
+
+    if (nbuiltins == 0) return NULL;
+
+    key.name = name;
+    return (tbuiltin *) bsearch(&key, builtins, nbuiltins, sizeof(tbuiltin), compareBuiltins);
+}
+
+/**
+ * Lists the registered builtins
+ *
+ * @param count Output for the number of builtins
+ * @return Builtins sorted by name
+ */
+tbuiltin * listBuiltins(int * count) {
+    *count = nbuiltins;
+    return builtins;
+}
+
+// ===========================[ Utilities ]===========================
+
+/**
+ * echo [-n] [args...]: writes its arguments separated by spaces
+ *
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return Exit status
+ */
+int echoBuiltin(tcommand * command, tline * line, int fds[3]) {
+    toutput output;
+    int i = 1, newline = 1;
+
+    output.fd = fds[1];
+    output.length = 0;
+
+    if (command->argc > 1 && strcmp(command->argv[1], "-n") == 0) {
+        newline = 0;
+        i++;
+    }
+
+    for (; i < command->argc; i++) {
+        outputWrite(&output, command->argv[i], strlen(command->argv[i]));
+        if (i < command->argc - 1) outputWrite(&output, " ", 1);
+    }
+
+    if (newline) outputWrite(&output, "\n", 1);
+
+    return outputFlush(&output);
+}
+
+/**
+ * true: does nothing successfully
+ *
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return 0
+ */
+int trueBuiltin(tcommand * command, tline * line, int fds[3]) {
+    return 0;
+}
+
+/**
+ * false: does nothing unsuccessfully
+ *
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return 1
+ */
+int falseBuiltin(tcommand * command, tline * line, int fds[3]) {
+    return 1;
+}
+
+/**
+ * printf format [args...]: formats its arguments. Supports the %s, %c,
+ * %d, %i, %u, %o, %x, %X and %% conversions (with flags, width and
+ * precision) and the usual backslash escapes. The format is reused while
+ * arguments remain.
+ *
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return Exit status
+ */
+int printfBuiltin(tcommand * command, tline * line, int fds[3]) {
+    toutput output;
+    char * format;
+    int arg = 2, consumed;
+
+    if (command->argc < 2) {
+        dprintf(fds[2], "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    output.fd = fds[1];
+    output.length = 0;
+
+    do {
+        consumed = arg;
+        format = command->argv[1];
+
+        while (*format != '\0') {
+            if (*format == '\\') {
+                format = printfEscape(&output, format + 1);
+            } else if (*format == '%' && format[1] == '%') {
+                outputWrite(&output, "%", 1);
+                format += 2;
+            } else if (*format == '%') {
+                format = printfConversion(&output, format, arg < command->argc ? command->argv[arg] : NULL);
+                arg++;
+            } else {
+                outputWrite(&output, format++, 1);
+            }
+        }
+    } while (arg < command->argc && arg > consumed);
+
+    return outputFlush(&output);
+}
+
+/**
+ * cat [files...]: copies its files (or the standard input) to the output
+ * with copy_file_range, sendfile or splice when the descriptors allow it
+ *
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return Exit status
+ */
+int catBuiltin(tcommand * command, tline * line, int fds[3]) {
+    int i, fd, status = 0;
+
+    for (i = 1; i < command->argc || i == 1; i++) {
+        // Read the standard input without files or with "-"
+        if (i >= command->argc || strcmp(command->argv[i], "-") == 0) {
+            fd = fds[0];
+        } else {
+            fd = open(command->argv[i], O_RDONLY | O_CLOEXEC);
+
+            if (fd == -1) {
+                dprintf(fds[2], "cat: %s: %s\n", command->argv[i], strerror(errno));
+                status = 1;
+                continue;
+            }
+        }
+
+        // Move the bytes inside the kernel when possible
+        if (relayFd(fd, fds[1]) == -1) {
+            dprintf(fds[2], "cat: %s\n", strerror(errno));
+            status = 1;
+        }
+
+        if (fd != fds[0]) close(fd);
+    }
+
+    return status;
+}
+
+/**
+ * tee [-a] [files...]: copies the standard input to the output and to
+ * every file. Pipe input is duplicated with tee and splice.
+ *
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return Exit status
+ */
+int teeBuiltin(tcommand * command, tline * line, int fds[3]) {
+    int * outs;
+    int i = 1, nouts = 1, status = 0;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    if (command->argc > 1 && strcmp(command->argv[1], "-a") == 0) {
+        flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+        i++;
+    }
+
+    outs = (int *) malloc(sizeof(int) * command->argc);
+
+    // Check for malloc errors
+    if (outs == NULL) {
+        dprintf(fds[2], "Error: malloc failed\n");
+        return 1;
+    }
+
+    outs[0] = fds[1];
+
+    for (; i < command->argc; i++) {
+        outs[nouts] = open(command->argv[i], flags, 0666);
+
+        if (outs[nouts] == -1) {
+            dprintf(fds[2], "tee: %s: %s\n", command->argv[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+
+        nouts++;
+    }
+
+    if (relayTee(fds[0], outs, nouts) == -1) {
+        dprintf(fds[2], "tee: %s\n", strerror(errno));
+        status = 1;
+    }
+
+    for (i = 1; i < nouts; i++) close(outs[i]);
+    free(outs);
+
+    return status;
+}
+
+/**
+ * test expression / [ expression ]: evaluates file and string tests
+ * (-e -f -d -r -w -x -s -z -n), comparisons (= != -eq -ne -lt -le -gt
+ * -ge) and negation with !
+ *
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return 0 if the expression is true, 1 if false, 2 on errors
+ */
+int testBuiltin(tcommand * command, tline * line, int fds[3]) {
+    int argc = command->argc - 1;
+    int result;
+
+    // [ needs a closing ]
+    if (strcmp(command->argv[0], "[") == 0) {
+        if (argc == 0 || strcmp(command->argv[argc], "]") != 0) {
+            dprintf(fds[2], "[: missing ]\n");
+            return 2;
+        }
+
+        argc--;
+    }
+
+    result = testExpression(argc, command->argv + 1);
+
+    if (result == 2) dprintf(fds[2], "%s: invalid expression\n", command->argv[0]);
+
+    return result;
+}
+
+// =============================[ Helpers ]==============================
+
+/**
+ * Compares two builtins by name
+ *
+ * @param a First builtin
+ * @param b Second builtin
+ * @return strcmp of their names
+ */
+static int compareBuiltins(const void * a, const void * b) {
+    return strcmp(((tbuiltin *) a)->name, ((tbuiltin *) b)->name);
+}
+
+/**
+ * Appends bytes to a buffered output, flushing it when full
+ *
+ * @param output Output to write to
+ * @param data Bytes to write
+ * @param length Number of bytes
+ */
+static void outputWrite(toutput * output, const char * data, size_t length) {
+    if (output->length + length > OUTPUT_SIZE) {
+        outputFlush(output);
+
+        if (length > OUTPUT_SIZE) {
+            writeAll(output->fd, data, length);
+            return;
+        }
+    }
+
+    memcpy(output->buffer + output->length, data, length);
+    output->length += length;
+}
+
+/**
+ * Writes the buffered bytes of an output
+ *
+ * @param output Output to flush
+ * @return 0 if successful, 1 if the write failed
+ */
+static int outputFlush(toutput * output) {
+    int res = writeAll(output->fd, output->buffer, output->length);
+
+    output->length = 0;
+    return res == -1 ? 1 : 0;
+}
+
+/**
+ * Writes a printf escape sequence
+ *
+ * @param output Output to write to
+ * @param format Format right after the backslash
+ * @return Format after the escape sequence
+ */
+static char * printfEscape(toutput * output, char * format) {
+    char c;
+    int i, value;
+
+    switch (*format) {
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case 'r': c = '\r'; break;
+        case 'a': c = '\a'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'v': c = '\v'; break;
+        case '\\': c = '\\'; break;
+        case '\0': outputWrite(output, "\\", 1); return format;
+        default:
+            // Octal escapes (\0NNN or \NNN)
+            if (*format >= '0' && *format <= '7') {
+                value = 0;
+                if (*format == '0') format++;
+
+                for (i = 0; i < 3 && *format >= '0' && *format <= '7'; i++) value = value * 8 + (*format++ - '0');
+
+                c = (char) value;
+                outputWrite(output, &c, 1);
+                return format;
+            }
+
+            outputWrite(output, "\\", 1);
+            c = *format;
+    }
+
+    outputWrite(output, &c, 1);
+    return format + 1;
+}
+
+/**
+ * Writes a printf conversion
+ *
+ * @param output Output to write to
+ * @param format Format at the '%'
+ * @param arg Argument of the conversion (NULL if missing)
+ * @return Format after the conversion
+ */
+static char * printfConversion(toutput * output, char * format, char * arg) {
+    char spec[32], buffer[512];
+    char * end;
+    size_t len;
+    int n = -1;
+
+    // Copy flags, width and precision
+    end = format + 1 + strspn(format + 1, "-+ #0123456789.");
+    len = end - format;
+
+    if (*end == '\0' || len + 3 > sizeof(spec)) {
+        outputWrite(output, format, strlen(format));
+        return format + strlen(format);
+    }
+
+    memcpy(spec, format, len);
+
+    switch (*end) {
+        case 's':
+            spec[len] = 's'; spec[len + 1] = '\0';
+            n = snprintf(buffer, sizeof(buffer), spec, arg != NULL ? arg : "");
+            break;
+        case 'c':
+            spec[len] = 'c'; spec[len + 1] = '\0';
+            n = snprintf(buffer, sizeof(buffer), spec, arg != NULL ? arg[0] : '\0');
+            break;
+        case 'd': case 'i':
+            spec[len] = 'l'; spec[len + 1] = 'l'; spec[len + 2] = 'd'; spec[len + 3] = '\0';
+            n = snprintf(buffer, sizeof(buffer), spec, arg != NULL ? strtoll(arg, NULL, 0) : 0LL);
+            break;
+        case 'u': case 'o': case 'x': case 'X':
+            spec[len] = 'l'; spec[len + 1] = 'l'; spec[len + 2] = *end; spec[len + 3] = '\0';
+            n = snprintf(buffer, sizeof(buffer), spec, arg != NULL ? strtoull(arg, NULL, 0) : 0ULL);
+            break;
+        default:
+            outputWrite(output, format, len + 1);
+            return end + 1;
+    }
+
+    // Long %s conversions are written directly
+    if (n >= (int) sizeof(buffer) && *end == 's') outputWrite(output, arg, strlen(arg));
+    else if (n > 0) outputWrite(output, buffer, n < (int) sizeof(buffer) ? (size_t) n : sizeof(buffer) - 1);
+
+    return end + 1;
+}
+
+/**
+ * Evaluates a unary test
+ *
+ * @param op Operator (-e, -f, -d, -r, -w, -x, -s, -z, -n)
+ * @param arg Operand
+ * @return 0 if true, 1 if false, 2 if the operator is unknown
+ */
+static int testUnary(char * op, char * arg) {
+    struct stat st;
+
+    if (strcmp(op, "-z") == 0) return arg[0] == '\0' ? 0 : 1;
+    if (strcmp(op, "-n") == 0) return arg[0] != '\0' ? 0 : 1;
+    if (strcmp(op, "-r") == 0) return access(arg, R_OK) == 0 ? 0 : 1;
+    if (strcmp(op, "-w") == 0) return access(arg, W_OK) == 0 ? 0 : 1;
+    if (strcmp(op, "-x") == 0) return access(arg, X_OK) == 0 ? 0 : 1;
+
+    if (strcmp(op, "-e") != 0 && strcmp(op, "-f") != 0 && strcmp(op, "-d") != 0 && strcmp(op, "-s") != 0) return 2;
+    if (stat(arg, &st) == -1) return 1;
+
+    if (strcmp(op, "-f") == 0) return S_ISREG(st.st_mode) ? 0 : 1;
+    if (strcmp(op, "-d") == 0) return S_ISDIR(st.st_mode) ? 0 : 1;
+    if (strcmp(op, "-s") == 0) return st.st_size > 0 ? 0 : 1;
+
+    return 0;
+}
+
+/**
+ * Evaluates a binary test
+ *
+ * @param left Left operand
+ * @param op Operator (=, !=, -eq, -ne, -lt, -le, -gt, -ge)
+ * @param right Right operand
+ * @param result Output, 0 if true and 1 if false
+ * @return 0 if the operator is known, -1 otherwise
+ */
+static int testBinary(char * left, char * op, char * right, int * result) {
+    long long a, b;
+
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) *result = strcmp(left, right) == 0 ? 0 : 1;
+    else if (strcmp(op, "!=") == 0) *result = strcmp(left, right) != 0 ? 0 : 1;
+    else if (op[0] == '-') {
+        a = strtoll(left, NULL, 10);
+        b = strtoll(right, NULL, 10);
+
+        if (strcmp(op, "-eq") == 0) *result = a == b ? 0 : 1;
+        else if (strcmp(op, "-ne") == 0) *result = a != b ? 0 : 1;
+        else if (strcmp(op, "-lt") == 0) *result = a < b ? 0 : 1;
+        else if (strcmp(op, "-le") == 0) *result = a <= b ? 0 : 1;
+        else if (strcmp(op, "-gt") == 0) *result = a > b ? 0 : 1;
+        else if (strcmp(op, "-ge") == 0) *result = a >= b ? 0 : 1;
+        else return -1;
+    } else return -1;
+
+    return 0;
+}
+
+/**
+ * Evaluates a test expression by its number of arguments (POSIX rules)
+ *
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return 0 if true, 1 if false, 2 on errors
+ */
+static int testExpression(int argc, char ** argv) {
+    int result;
+
+    if (argc == 0) return 1;
+    if (argc == 1) return argv[0][0] != '\0' ? 0 : 1;
+
+    if (argc == 2) {
+        if (strcmp(argv[0], "!") == 0) return argv[1][0] == '\0' ? 0 : 1;
+        return testUnary(argv[0], argv[1]);
+    }
+
+    if (argc == 3 && testBinary(argv[0], argv[1], argv[2], &result) == 0) return result;
+
+    // Negation of the rest of the expression
+    if (strcmp(argv[0], "!") == 0 && argc <= 4) {
+        result = testExpression(argc - 1, argv + 1);
+        return result == 2 ? 2 : !result;
+    }
+
+    return 2;
+}
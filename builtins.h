@@ -0,0 +1,56 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "parser.h"
+
+// ===========================[ Constants ]===========================
+
+// Builtin flags
+#define BUILTIN_PIPELINE 1
+#define BUILTIN_STREAM 2
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Builtin function
+ *
+ * @param command: Command to execute (argv[0] is the builtin name)
+ * @param line: Parsed line the command belongs to
+ * @param fds: Standard input, output and error of the command
+ * @return Exit status
+ */
+typedef int (*tbuiltinfn)(tcommand * command, tline * line, int fds[3]);
+
+/**
+ * Builtin registry entry
+ *
+ * @param name: Name of the builtin
+ * @param function: Function that executes it
+ * @param flags: BUILTIN_PIPELINE if it can run as a pipeline stage or in
+ *               the background (it only uses fds, not the shell state),
+ *               BUILTIN_STREAM if it copies a stream and may never end
+ *               (it runs as a job where it must be interruptible)
+ */
+typedef struct {
+    char * name;
+    tbuiltinfn function;
+    int flags;
+} tbuiltin;
+
+// ===========================[ Prototypes ]==========================
+
+void registerBuiltin(char * name, tbuiltinfn function, int flags);
+void registerUtilityBuiltins();
+tbuiltin * findBuiltin(char * name);
+tbuiltin * listBuiltins(int * count);
+
+// Utilities
+int echoBuiltin(tcommand * command, tline * line, int fds[3]);
+int trueBuiltin(tcommand * command, tline * line, int fds[3]);
+int falseBuiltin(tcommand * command, tline * line, int fds[3]);
+int printfBuiltin(tcommand * command, tline * line, int fds[3]);
+int catBuiltin(tcommand * command, tline * line, int fds[3]);
+int teeBuiltin(tcommand * command, tline * line, int fds[3]);
+int testBuiltin(tcommand * command, tline * line, int fds[3]);
+
+#endif
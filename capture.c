@@ -0,0 +1,278 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+
+#include "capture.h"
+#include "events.h"
+#include "relay.h"
+
+// ===========================[ Prototypes ]==========================
+static void captureHandler(int fd, uint32_t events, void * data);
+static int drainCapture(tcapture * capture);
+static void closeCapture(tcapture * capture);
+static void printTail(tcapture * capture, int fd, int lines);
+static char ringByte(tcapture * capture, size_t index);
+static void dropCapture(tjobstore * store, tcapture * capture);
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Connects the output and errors of a job to a new capture. The write end
+ * of the pipe is left in the job's captureFd until it is launched.
+ *
+ * @param store Store of the job
+ * @param job Job to capture (not launched yet)
+ * @param size Size of the ring
+ * @return 0 if successful, -1 if the pipe could not be created
+ */
+int openCapture(tjobstore * store, tjob * job, size_t size) {
+    tcapture * capture, ** last;
+    int fds[2];
+
+    if (pipe2(fds, O_CLOEXEC) == -1) return -1;
+
+    // The shell never blocks on a job's output
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    capture = (tcapture *) checkedRealloc(NULL, sizeof(tcapture));
+    capture->jobId = job->id;
+    capture->command = strdup(job->command);
+    capture->data = (char *) checkedRealloc(NULL, size);
+    capture->size = size;
+    capture->written = 0;
+    capture->fd = fds[0];
+    capture->finished = 0;
+    capture->exitStatus = 0;
+    capture->next = NULL;
+
+    if (capture->command == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Keep the captures in job order
+    for (last = &store->captures; *last != NULL; last = &(*last)->next);
+    *last = capture;
+
+    watchFd(fds[0], EPOLLIN, captureHandler, capture);
+
+    job->capture = capture;
+    job->captureFd = fds[1];
+
+    return 0;
+}
+
+/**
+ * Records the exit status of a captured job once it has terminated. Its
+ * output stays available until it is shown; past MAX_FINISHED_CAPTURES the
+ * oldest finished capture is dropped.
+ *
+ * @param store Store of the job
+ * @param job Job whose processes have all terminated
+ */
+void finishCapture(tjobstore * store, tjob * job) {
+    tcapture * capture = job->capture, * oldest = NULL, * current;
+    int finished = 0;
+
+    if (capture == NULL) return;
+
+    capture->finished = 1;
+    capture->exitStatus = job->exitStatus;
+    job->capture = NULL;
+
+    for (current = store->captures; current != NULL; current = current->next) {
+        if (current->finished == 0) continue;
+        if (oldest == NULL) oldest = current;
+        finished++;
+    }
+
+    if (finished > MAX_FINISHED_CAPTURES) dropCapture(store, oldest);
+}
+
+/**
+ * Prints the last lines of the captured jobs. Finished jobs are shown once
+ * and then forgotten, like the Done report of a job.
+ *
+ * @param store Store of the jobs
+ * @param fd File descriptor to write to
+ * @param lines Number of lines to show of every job
+ * @param jobId Job to show (0 for every captured job)
+ * @return 0 if something was shown, -1 if there is no such capture
+ */
+int printCaptures(tjobstore * store, int fd, int lines, int jobId) {
+    tcapture * capture, * next;
+    int shown = 0;
+
+    for (capture = store->captures; capture != NULL; capture = next) {
+        next = capture->next;
+
+        if (jobId != 0 && capture->jobId != jobId) continue;
+
+        // Take what the event loop has not read yet
+        if (capture->fd != -1) drainCapture(capture);
+
+        if (capture->finished) dprintf(fd, "[%d]  Done (%d)\t\t %s", capture->jobId, capture->exitStatus, capture->command);
+        else dprintf(fd, "[%d]  Running\t\t %s", capture->jobId, capture->command);
+
+        printTail(capture, fd, lines);
+        shown++;
+
+        if (capture->finished) dropCapture(store, capture);
+    }
+
+    return shown > 0 ? 0 : -1;
+}
+
+/**
+ * Closes and frees every capture of a store
+ *
+ * @param store Store to clean
+ */
+void freeCaptures(tjobstore * store) {
+    while (store->captures != NULL) dropCapture(store, store->captures);
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Drains a job's output when the event loop sees it ready
+ *
+ * @param fd Read end of the pipe
+ * @param events Ready events
+ * @param data Capture
+ */
+static void captureHandler(int fd, uint32_t events, void * data) {
+    tcapture * capture = (tcapture *) data;
+
+    if (drainCapture(capture) == 0) closeCapture(capture);
+}
+
+/**
+ * Reads everything available into the ring. The reads go straight to the
+ * free end of the ring (and around to its start), no bytes are copied.
+ *
+ * @param capture Capture to fill
+ * @return 1 if the pipe is still open, 0 at end of file
+ */
+static int drainCapture(tcapture * capture) {
+    struct iovec iov[2];
+    size_t start;
+    ssize_t n;
+
+    while (1) {
+        start = capture->written % capture->size;
+
+        iov[0].iov_base = capture->data + start;
+        iov[0].iov_len = capture->size - start;
+        iov[1].iov_base = capture->data;
+        iov[1].iov_len = start;
+
+        n = readv(capture->fd, iov, start > 0 ? 2 : 1);
+
+        if (n > 0) {
+            capture->written += n;
+            continue;
+        }
+
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && errno == EAGAIN) return 1;
+
+        return 0;
+    }
+}
+
+/**
+ * Stops watching the output of a capture once every writer closed it
+ *
+ * @param capture Capture to close
+ */
+static void closeCapture(tcapture * capture) {
+    unwatchFd(capture->fd);
+    close(capture->fd);
+    capture->fd = -1;
+}
+
+/**
+ * Writes the last lines held in the ring. When the ring has wrapped, the
+ * oldest line may have been cut and is skipped.
+ *
+ * @param capture Capture to print
+ * @param fd File descriptor to write to
+ * @param lines Number of lines
+ */
+static void printTail(tcapture * capture, int fd, int lines) {
+    size_t held = capture->written < capture->size ? capture->written : capture->size;
+    size_t base = capture->written - held, begin = 0, i, offset;
+    int found = 0;
+
+    if (held == 0) return;
+
+    // Walk back from the end, the final newline does not start a line
+    for (i = held - 1; i > 0; i--) {
+        if (ringByte(capture, i - 1) == '\n' && ++found == lines) {
+            begin = i;
+            break;
+        }
+    }
+
+    if (found < lines && capture->written > capture->size) {
+        for (i = 0; i < held && ringByte(capture, i) != '\n'; i++);
+        begin = i < held ? i + 1 : 0;
+    }
+
+    // At most two pieces: up to the end of the ring and from its start
+    offset = (base + begin) % capture->size;
+
+    if (offset + (held - begin) <= capture->size) {
+        writeAll(fd, capture->data + offset, held - begin);
+    } else {
+        writeAll(fd, capture->data + offset, capture->size - offset);
+        writeAll(fd, capture->data, held - begin - (capture->size - offset));
+    }
+
+    if (ringByte(capture, held - 1) != '\n') writeAll(fd, "\n", 1);
+}
+
+/**
+ * Gets a byte of the ring by its position among the held bytes
+ *
+ * @param capture Capture
+ * @param index Position (0 is the oldest byte held)
+ * @return The byte
+ */
+static char ringByte(tcapture * capture, size_t index) {
+    size_t held = capture->written < capture->size ? capture->written : capture->size;
+
+    return capture->data[(capture->written - held + index) % capture->size];
+}
+
+/**
+ * Unlinks a capture from its store and frees it
+ *
+ * @param store Store of the capture
+ * @param capture Capture to drop
+ */
+static void dropCapture(tjobstore * store, tcapture * capture) {
+    tcapture ** link;
+    tjob * job;
+
+    for (link = &store->captures; *link != capture; link = &(*link)->next);
+    *link = capture->next;
+
+    // A running job keeps writing to a pipe nobody reads, detach it
+    for (job = store->head; job != NULL; job = job->next) {
+        if (job->capture == capture) job->capture = NULL;
+    }
+
+    if (capture->fd != -1) closeCapture(capture);
+
+    free(capture->command);
+    free(capture->data);
+    free(capture);
+}
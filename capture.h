@@ -0,0 +1,52 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+
+#include "jobs.h"
+
+// ===========================[ Constants ]===========================
+
+// Ring size when the capturesize option is not set
+#define DEFAULT_CAPTURE_SIZE (64 * 1024)
+
+// Finished captures kept until they are shown (older ones are dropped)
+#define MAX_FINISHED_CAPTURES 32
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Output of a background job started with &capture. The job writes to a
+ * pipe that the event loop drains into a ring of fixed size, so only the
+ * newest bytes are kept.
+ *
+ * @param jobId: Id of the job
+ * @param command: Command string
+ * @param data: Ring buffer
+ * @param size: Size of the ring
+ * @param written: Bytes received so far (the ring holds the last size ones)
+ * @param fd: Read end of the pipe (-1 once the job's output is closed)
+ * @param finished: 1 once every process of the job has terminated
+ * @param exitStatus: Exit status of the job
+ * @param next: Next capture, in job order
+ */
+typedef struct tcapture {
+    int jobId;
+    char * command;
+    char * data;
+    size_t size;
+    size_t written;
+    int fd;
+    int finished;
+    int exitStatus;
+    struct tcapture * next;
+} tcapture;
+
+// ===========================[ Prototypes ]==========================
+
+int openCapture(tjobstore * store, tjob * job, size_t size);
+void finishCapture(tjobstore * store, tjob * job);
+int printCaptures(tjobstore * store, int fd, int lines, int jobId);
+void freeCaptures(tjobstore * store);
+
+#endif
@@ -2,58 +2,63 @@
 
 # Define the build and output directories
 BUILD_DIR=./build
-BINARY_DIR=./bin
 OUTPUT_DIR=./
 
+# Define the source files
+SOURCES="main.c parser.c arena.c pathcache.c jobs.c events.c input.c builtins.c relay.c options.c trace.c history.c complete.c editor.c prompt.c server.c variables.c wildcard.c memo.c capture.c resources.c"
+
 # Define the usage message
-USE="Usage: $0 [OPTION]\nOptions:\n  -h, --help\tDisplay this help message.\n  -d, --debug\tEnable debug mode."
+USE="Usage: $0 [OPTION]...\nOptions:\n  -h, --help\tDisplay this help message.\n  -d, --debug\tEnable debug mode.\n  -f, --fork\tSpawn commands with fork + exec instead of posix_spawn.\n  -b, --bench\tRun the benchmark suite after compiling."
 
-# Define the debug mode
-DEBUG=0
+# Define the compilation flags
+FLAGS=""
+BENCH=0
+ENGINE="posix_spawn"
 
 # Arguments Control
-if [ $# -eq 1 ]
-then
-    if [[ $1 = "-h" ]] || [[ $1 = "--help" ]]
+for ARG in "$@"
+do
+    if [[ $ARG = "-h" ]] || [[ $ARG = "--help" ]]
     then
         echo -e $USE
         exit 0
-    elif [[ $1 = "-d" ]] || [[ $1 = "--debug" ]]
+    elif [[ $ARG = "-d" ]] || [[ $ARG = "--debug" ]]
     then
-        DEBUG=1
+        FLAGS="$FLAGS -D DEBUG"
         echo "Debug mode enabled."
+    elif [[ $ARG = "-f" ]] || [[ $ARG = "--fork" ]]
+    then
+        FLAGS="$FLAGS -D USE_FORK"
+        ENGINE="fork"
+        echo "Fork spawn engine enabled."
+    elif [[ $ARG = "-b" ]] || [[ $ARG = "--bench" ]]
+    then
+        BENCH=1
     else
         echo "Error: Invalid argument.\n"
         echo -e $USE
         exit 1
     fi
-elif [ $# -gt 1 ]
-then
-    echo "Error: Unexpected number of arguments."
-    echo -e $USE
-    exit 1
-fi
+done
 
 # Create the build directory if it doesn't exist and delete its contents
 mkdir -p "$BUILD_DIR"
-rm -f "$BUILD_DIR"/*
+rm -rf "$BUILD_DIR"/*
 
 # [Program Compilation] ========================================>>
 
-if [[ $DEBUG -eq 1 ]]
-then
-    gcc -c -Wall -Werror main.c -o "$BUILD_DIR/main.o" -D DEBUG
-else
-    gcc -c -Wall -Werror main.c -o "$BUILD_DIR/main.o"
-fi
+for SOURCE in $SOURCES
+do
+    gcc -c -Wall -Werror -pthread "$SOURCE" -o "$BUILD_DIR/${SOURCE%.c}.o" $FLAGS
 
-if [ $? -ne 0 ]
-then
-    echo "Error: The program failed to compile."
-    exit 2
-fi
+    if [ $? -ne 0 ]
+    then
+        echo "Error: The program failed to compile."
+        exit 2
+    fi
+done
 
-gcc "$BUILD_DIR/main.o" "$BINARY_DIR/libparser.a" -o "$OUTPUT_DIR/main" -static
+gcc "$BUILD_DIR"/*.o -o "$OUTPUT_DIR/main" -static -pthread
 
 if [ $? -ne 0 ]
 then
@@ -62,4 +67,11 @@ then
 fi
 
 # [Success Message] ============================================>>
-echo "The program was compiled successfully."
\ No newline at end of file
+echo "The program was compiled successfully."
+
+# [Benchmark] ==================================================>>
+
+if [ $BENCH -eq 1 ]
+then
+    ./bench/suite.sh "$ENGINE" || exit 3
+fi
\ No newline at end of file
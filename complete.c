@@ -0,0 +1,410 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "complete.h"
+#include "builtins.h"
+#include "arena.h"
+
+// ===========================[ Constants ]===========================
+#define WORD_BREAKS " \t|&<>"
+
+// ===========================[ Prototypes ]==========================
+static int indexStale();
+static void * buildIndex(void * data);
+static void scanDirectory(tpathdir * dir);
+static void matchCommands(char * prefix, tcompletion * completion);
+static void matchFiles(char * word, tcompletion * completion);
+static void addMatch(tcompletion * completion, char * dir, char * name, char * suffix);
+static int compareNames(const void * a, const void * b);
+
+// ========================[ Global Variables ]=======================
+
+// Index of PATH executables, built by a background thread. The thread only
+// touches dirs while building is set, the shell reads it only while not.
+static pthread_mutex_t indexLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t indexReady = PTHREAD_COND_INITIALIZER;
+static tpathdir * dirs = NULL;
+static size_t ndirs = 0;
+static char ** commands = NULL;
+static size_t ncommands = 0;
+static char * indexedPath = NULL;
+static int building = 0, built = 0;
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Starts (re)building the index of PATH executables in the background if
+ * PATH or the modification time of one of its directories changed. Only
+ * the changed directories are read again.
+ */
+void startCommandIndex() {
+    pthread_attr_t attr;
+    pthread_t thread;
+    char * path;
+
+    pthread_mutex_lock(&indexLock);
+
+    if (building == 0 && indexStale()) {
+        path = strdup(getenv("PATH") != NULL ? getenv("PATH") : "");
+
+        // Check for malloc errors
+        if (path == NULL) {
+            fprintf(stderr, "Error: malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        building = pthread_create(&thread, &attr, buildIndex, path) == 0;
+        if (building == 0) free(path);
+
+        pthread_attr_destroy(&attr);
+    }
+
+    pthread_mutex_unlock(&indexLock);
+}
+
+/**
+ * Waits until the index being built is ready
+ */
+void waitCommandIndex() {
+    pthread_mutex_lock(&indexLock);
+    while (building == 1) pthread_cond_wait(&indexReady, &indexLock);
+    pthread_mutex_unlock(&indexLock);
+}
+
+/**
+ * Finds the completions of the word before the cursor: builtins and PATH
+ * executables in command position, files anywhere else
+ *
+ * @param line Line being edited
+ * @param cursor Position of the cursor in line
+ * @param completion Output for the completions (free with freeCompletions)
+ */
+void findCompletions(char * line, size_t cursor, tcompletion * completion) {
+    size_t start = cursor, i, j;
+    char * word;
+
+    memset(completion, 0, sizeof(tcompletion));
+
+    while (start > 0 && strchr(WORD_BREAKS, line[start - 1]) == NULL) start--;
+    completion->start = start;
+
+    word = strndup(line + start, cursor - start);
+
+    // Check for malloc errors
+    if (word == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Commands start the line or follow a pipe or a background job
+    for (i = start; i > 0 && (line[i - 1] == ' ' || line[i - 1] == '\t'); i--);
+
+    if ((i == 0 || line[i - 1] == '|' || line[i - 1] == '&') && strchr(word, '/') == NULL) {
+        matchCommands(word, completion);
+    } else {
+        matchFiles(word, completion);
+    }
+
+    free(word);
+
+    // Builtins may also be executables, keep each name once
+    qsort(completion->matches, completion->count, sizeof(char *), compareNames);
+
+    for (i = 0, j = 0; i < completion->count; i++) {
+        if (j > 0 && strcmp(completion->matches[j - 1], completion->matches[i]) == 0) free(completion->matches[i]);
+        else completion->matches[j++] = completion->matches[i];
+    }
+
+    completion->count = j;
+}
+
+/**
+ * Frees the completions found by findCompletions
+ *
+ * @param completion Completions to free
+ */
+void freeCompletions(tcompletion * completion) {
+    size_t i;
+
+    for (i = 0; i < completion->count; i++) free(completion->matches[i]);
+    free(completion->matches);
+    memset(completion, 0, sizeof(tcompletion));
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Checks whether the index must be built again. Must be called with the
+ * index locked and not building.
+ *
+ * @return 1 if PATH or one of its directories changed, 0 if not
+ */
+static int indexStale() {
+    char * path = getenv("PATH");
+    struct stat dirStat;
+    size_t i;
+
+    if (built == 0) return 1;
+    if (strcmp(path != NULL ? path : "", indexedPath) != 0) return 1;
+
+    for (i = 0; i < ndirs; i++) {
+        if (stat(dirs[i].path, &dirStat) == -1) memset(&dirStat, 0, sizeof(dirStat));
+
+        if (dirStat.st_mtim.tv_sec != dirs[i].mtime.tv_sec || dirStat.st_mtim.tv_nsec != dirs[i].mtime.tv_nsec) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Background thread that builds the index: directories whose mtime did not
+ * change keep their names, the rest are read again, then every name is
+ * merged into one sorted array.
+ *
+ * @param data PATH to index (freed by the index)
+ * @return NULL
+ */
+static void * buildIndex(void * data) {
+    char * path = (char *) data, * copy, * dirPath, * saveptr;
+    tpathdir * newDirs = NULL, * dir;
+    char ** names;
+    size_t nnewDirs = 0, total = 0, i, j, k;
+    struct stat dirStat;
+
+    copy = strdup(path);
+
+    // Check for malloc errors
+    if (copy == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (dirPath = strtok_r(copy, ":", &saveptr); dirPath != NULL; dirPath = strtok_r(NULL, ":", &saveptr)) {
+        newDirs = (tpathdir *) checkedRealloc(newDirs, sizeof(tpathdir) * (nnewDirs + 1));
+        dir = newDirs + nnewDirs++;
+
+        memset(dir, 0, sizeof(tpathdir));
+        dir->path = strdup(dirPath);
+        if (stat(dirPath, &dirStat) == 0) dir->mtime = dirStat.st_mtim;
+
+        // Reuse the names of unchanged directories
+        for (i = 0; i < ndirs; i++) {
+            if (dirs[i].names == NULL || strcmp(dirs[i].path, dirPath) != 0) continue;
+            if (dirs[i].mtime.tv_sec != dir->mtime.tv_sec || dirs[i].mtime.tv_nsec != dir->mtime.tv_nsec) continue;
+
+            dir->names = dirs[i].names;
+            dir->count = dirs[i].count;
+            dirs[i].names = NULL;
+            break;
+        }
+
+        if (i == ndirs) scanDirectory(dir);
+        total += dir->count;
+    }
+
+    free(copy);
+
+    // Merge and sort every name, each one once
+    names = (char **) checkedRealloc(NULL, sizeof(char *) * (total + 1));
+
+    for (i = 0, k = 0; i < nnewDirs; i++) {
+        for (j = 0; j < newDirs[i].count; j++) names[k++] = newDirs[i].names[j];
+    }
+
+    qsort(names, total, sizeof(char *), compareNames);
+
+    for (i = 0, k = 0; i < total; i++) {
+        if (k == 0 || strcmp(names[k - 1], names[i]) != 0) names[k++] = names[i];
+    }
+
+    pthread_mutex_lock(&indexLock);
+
+    // Free the directories that were read again
+    for (i = 0; i < ndirs; i++) {
+        if (dirs[i].names != NULL) {
+            for (j = 0; j < dirs[i].count; j++) free(dirs[i].names[j]);
+            free(dirs[i].names);
+        }
+
+        free(dirs[i].path);
+    }
+
+    free(dirs);
+    free(commands);
+    free(indexedPath);
+
+    dirs = newDirs;
+    ndirs = nnewDirs;
+    commands = names;
+    ncommands = k;
+    indexedPath = path;
+    building = 0;
+    built = 1;
+
+    pthread_cond_broadcast(&indexReady);
+    pthread_mutex_unlock(&indexLock);
+
+    return NULL;
+}
+
+/**
+ * Reads the executables of a PATH directory
+ *
+ * @param dir Directory to read
+ */
+static void scanDirectory(tpathdir * dir) {
+    DIR * stream = opendir(dir->path);
+    struct dirent * entry;
+    struct stat entryStat;
+    size_t size = 0;
+
+    if (stream == NULL) return;
+
+    while ((entry = readdir(stream)) != NULL) {
+        if (entry->d_name[0] == '.' || entry->d_type == DT_DIR) continue;
+
+        // Links and unknown types may point to directories
+        if (entry->d_type != DT_REG) {
+            if (fstatat(dirfd(stream), entry->d_name, &entryStat, 0) == -1 || S_ISDIR(entryStat.st_mode)) continue;
+        }
+
+        if (faccessat(dirfd(stream), entry->d_name, X_OK, 0) == -1) continue;
+
+        if (dir->count == size) {
+            size = size == 0 ? 64 : size * 2;
+            dir->names = (char **) checkedRealloc(dir->names, sizeof(char *) * size);
+        }
+
+        dir->names[dir->count++] = strdup(entry->d_name);
+    }
+
+    closedir(stream);
+
+    // Keep empty directories apart from the ones not read yet
+    if (dir->names == NULL) dir->names = (char **) checkedRealloc(NULL, sizeof(char *));
+}
+
+/**
+ * Adds the builtins and PATH executables that start with a prefix. The
+ * index is usually built by the time of the first Tab, and only changed
+ * directories are read again after that.
+ *
+ * @param prefix Prefix of the command
+ * @param completion Completions to add to
+ */
+static void matchCommands(char * prefix, tcompletion * completion) {
+    size_t length = strlen(prefix), low, high, middle;
+    tbuiltin * builtins;
+    int nbuiltins, i;
+
+    builtins = listBuiltins(&nbuiltins);
+
+    for (i = 0; i < nbuiltins; i++) {
+        if (strncmp(builtins[i].name, prefix, length) == 0) addMatch(completion, "", builtins[i].name, "");
+    }
+
+    startCommandIndex();
+    waitCommandIndex();
+
+    pthread_mutex_lock(&indexLock);
+
+    // First name not below the prefix
+    for (low = 0, high = ncommands; low < high; ) {
+        middle = low + (high - low) / 2;
+
+        if (strcmp(commands[middle], prefix) < 0) low = middle + 1;
+        else high = middle;
+    }
+
+    for (; low < ncommands && strncmp(commands[low], prefix, length) == 0; low++) {
+        addMatch(completion, "", commands[low], "");
+    }
+
+    pthread_mutex_unlock(&indexLock);
+}
+
+/**
+ * Adds the files that complete a path. Hidden files are only completed
+ * when the name starts with a dot.
+ *
+ * @param word Path to complete
+ * @param completion Completions to add to
+ */
+static void matchFiles(char * word, tcompletion * completion) {
+    char * slash = strrchr(word, '/'), * base = word, * dir = "";
+    struct dirent * entry;
+    struct stat entryStat;
+    size_t length;
+    DIR * stream;
+    int isDir;
+
+    if (slash != NULL) {
+        dir = strndup(word, slash - word + 1);
+        base = slash + 1;
+    }
+
+    length = strlen(base);
+    stream = opendir(dir[0] != '\0' ? dir : ".");
+
+    while (stream != NULL && (entry = readdir(stream)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (entry->d_name[0] == '.' && base[0] != '.') continue;
+        if (strncmp(entry->d_name, base, length) != 0) continue;
+
+        isDir = entry->d_type == DT_DIR;
+
+        if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+            isDir = fstatat(dirfd(stream), entry->d_name, &entryStat, 0) == 0 && S_ISDIR(entryStat.st_mode);
+        }
+
+        addMatch(completion, dir, entry->d_name, isDir ? "/" : "");
+    }
+
+    if (stream != NULL) closedir(stream);
+    if (slash != NULL) free(dir);
+}
+
+/**
+ * Adds a completion made of a directory, a name and a suffix
+ *
+ * @param completion Completions to add to
+ * @param dir Directory of the name ("" if none)
+ * @param name Name
+ * @param suffix Suffix ("/" for directories)
+ */
+static void addMatch(tcompletion * completion, char * dir, char * name, char * suffix) {
+    char * match;
+
+    if (completion->count == completion->size) {
+        completion->size = completion->size == 0 ? 16 : completion->size * 2;
+        completion->matches = (char **) checkedRealloc(completion->matches, sizeof(char *) * completion->size);
+    }
+
+    match = (char *) checkedRealloc(NULL, strlen(dir) + strlen(name) + strlen(suffix) + 1);
+    sprintf(match, "%s%s%s", dir, name, suffix);
+
+    completion->matches[completion->count++] = match;
+}
+
+/**
+ * Compares two names for qsort
+ *
+ * @param a First name
+ * @param b Second name
+ * @return Result of strcmp
+ */
+static int compareNames(const void * a, const void * b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
@@ -0,0 +1,46 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <stddef.h>
+#include <time.h>
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Directory of PATH and the executables found in it
+ *
+ * @param path: Path of the directory
+ * @param mtime: Modification time when it was read
+ * @param names: Names of the executables in it
+ * @param count: Number of names
+ */
+typedef struct {
+    char * path;
+    struct timespec mtime;
+    char ** names;
+    size_t count;
+} tpathdir;
+
+/**
+ * Completions of the word under the cursor
+ *
+ * @param matches: Completed words (directories end in '/')
+ * @param count: Number of matches
+ * @param size: Allocated size of matches
+ * @param start: Offset of the completed word in the line
+ */
+typedef struct {
+    char ** matches;
+    size_t count;
+    size_t size;
+    size_t start;
+} tcompletion;
+
+// ===========================[ Prototypes ]==========================
+
+void startCommandIndex();
+void waitCommandIndex();
+void findCompletions(char * line, size_t cursor, tcompletion * completion);
+void freeCompletions(tcompletion * completion);
+
+#endif
@@ -0,0 +1,695 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "editor.h"
+#include "complete.h"
+#include "relay.h"
+#include "arena.h"
+
+// ===========================[ Constants ]===========================
+#define CTRL_KEY(c) ((c) & 0x1f)
+#define ESC 27
+#define BACKSPACE 127
+#define DEFAULT_COLUMNS 80
+
+// Keys decoded from escape sequences
+#define KEY_ALT 0x100
+#define KEY_UP 0x200
+#define KEY_DOWN 0x201
+#define KEY_RIGHT 0x202
+#define KEY_LEFT 0x203
+#define KEY_HOME 0x204
+#define KEY_END 0x205
+#define KEY_DELETE 0x206
+#define KEY_WORD_RIGHT 0x207
+#define KEY_WORD_LEFT 0x208
+#define KEY_NONE 0x2ff
+
+// ===========================[ Prototypes ]==========================
+static int readKey(char * bytes, size_t length, size_t * keyLength);
+static int editKey(teditor * editor, int key);
+static int searchKey(teditor * editor, int key);
+static void completeLine(teditor * editor);
+static void listCompletions(teditor * editor, tcompletion * completion);
+static void recallHistory(teditor * editor, int direction);
+static void setLine(teditor * editor, char * text, size_t length);
+static void insertText(teditor * editor, char * text, size_t length);
+static void deleteText(teditor * editor, size_t from, size_t to);
+static void killText(teditor * editor, size_t from, size_t to);
+static size_t previousChar(teditor * editor, size_t pos);
+static size_t nextChar(teditor * editor, size_t pos);
+static size_t previousWord(teditor * editor, size_t pos);
+static size_t nextWord(teditor * editor, size_t pos);
+static size_t textWidth(char * text, size_t length);
+static void refreshLine(teditor * editor);
+static void screenAppend(teditor * editor, size_t * used, char * text, size_t length);
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Initializes a line editor
+ *
+ * @param editor Editor to initialize
+ * @param in Terminal to read keys from
+ * @param out Terminal to draw the line on
+ * @param history History to recall lines from
+ */
+void initEditor(teditor * editor, int in, int out, thistory * history) {
+    memset(editor, 0, sizeof(teditor));
+
+    editor->in = in;
+    editor->out = out;
+    editor->history = history;
+    editor->size = 128;
+    editor->buffer = (char *) checkedRealloc(NULL, editor->size);
+    editor->buffer[0] = '\0';
+}
+
+/**
+ * Frees the buffers of a line editor, restoring the terminal
+ *
+ * @param editor Editor to free
+ */
+void freeEditor(teditor * editor) {
+    stopEditing(editor);
+
+    free(editor->buffer);
+    free(editor->killed);
+    free(editor->saved);
+    free(editor->search);
+    free(editor->screen);
+    memset(editor, 0, sizeof(teditor));
+}
+
+/**
+ * Starts editing a new line: puts the terminal in raw mode and shows the
+ * prompt. Commands for the index of completions start being read.
+ *
+ * @param editor Editor to use
+ * @param prompt Prompt to show (kept until stopEditing)
+ */
+void startEditing(teditor * editor, char * prompt) {
+    struct termios raw;
+
+    editor->length = 0;
+    editor->cursor = 0;
+    editor->buffer[0] = '\0';
+    editor->prompt = prompt;
+    editor->historyPos = 0;
+    editor->searching = 0;
+    editor->lastTab = 0;
+
+    if (editor->raw == 0 && tcgetattr(editor->in, &editor->original) == 0) {
+        raw = editor->original;
+
+        // Keys arrive one by one, unechoed, and Ctrl-C/Ctrl-Z are plain keys
+        raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+        raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+
+        editor->raw = tcsetattr(editor->in, TCSADRAIN, &raw) == 0;
+    }
+
+    refreshLine(editor);
+
+    // The index is ready by the first Tab
+    startCommandIndex();
+}
+
+/**
+ * Stops editing, restoring the terminal settings
+ *
+ * @param editor Editor to stop
+ */
+void stopEditing(teditor * editor) {
+    if (editor->raw == 0) return;
+
+    tcsetattr(editor->in, TCSADRAIN, &editor->original);
+    editor->raw = 0;
+}
+
+/**
+ * Handles the keys in a chunk of input. A key split across chunks is left
+ * unused until the rest arrives.
+ *
+ * @param editor Editor to use
+ * @param bytes Input read from the terminal
+ * @param length Number of bytes
+ * @param used Output for the number of bytes handled
+ * @return EDIT_DONE when the line is complete, EDIT_EOF on Ctrl-D on an
+ *         empty line, EDIT_MORE if more input is needed
+ */
+int feedEditor(teditor * editor, char * bytes, size_t length, size_t * used) {
+    size_t keyLength;
+    int key, result = EDIT_MORE;
+
+    *used = 0;
+
+    while (result == EDIT_MORE && *used < length) {
+        key = readKey(bytes + *used, length - *used, &keyLength);
+        if (key == -1) break;
+
+        *used += keyLength;
+        result = editor->searching ? searchKey(editor, key) : editKey(editor, key);
+    }
+
+    return result;
+}
+
+/**
+ * Gets the edited line
+ *
+ * @param editor Editor to use
+ * @return Line with a trailing newline, valid until the next startEditing
+ */
+char * editedLine(teditor * editor) {
+    editor->buffer[editor->length] = '\n';
+    editor->buffer[editor->length + 1] = '\0';
+
+    return editor->buffer;
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Decodes the key at the start of the input
+ *
+ * @param bytes Input
+ * @param length Number of bytes
+ * @param keyLength Output for the number of bytes of the key
+ * @return Byte of the key, KEY_ALT plus a byte for Alt keys, a KEY_ code
+ *         for escape sequences, -1 if the sequence is not complete yet
+ */
+static int readKey(char * bytes, size_t length, size_t * keyLength) {
+    size_t i;
+    int ctrl;
+
+    *keyLength = 1;
+    if (bytes[0] != ESC) return (unsigned char) bytes[0];
+    if (length < 2) return -1;
+
+    *keyLength = 2;
+    if (bytes[1] != '[' && bytes[1] != 'O') return KEY_ALT | (unsigned char) bytes[1];
+
+    // Parameters up to the final byte of the sequence
+    for (i = 2; i < length && (bytes[i] < 0x40 || bytes[i] > 0x7e); i++);
+    if (i == length) return -1;
+
+    *keyLength = i + 1;
+    ctrl = memmem(bytes + 2, i - 2, ";5", 2) != NULL;
+
+    switch (bytes[i]) {
+        case 'A': return KEY_UP;
+        case 'B': return KEY_DOWN;
+        case 'C': return ctrl ? KEY_WORD_RIGHT : KEY_RIGHT;
+        case 'D': return ctrl ? KEY_WORD_LEFT : KEY_LEFT;
+        case 'H': return KEY_HOME;
+        case 'F': return KEY_END;
+        case '~':
+            if (bytes[2] == '1' || bytes[2] == '7') return KEY_HOME;
+            if (bytes[2] == '4' || bytes[2] == '8') return KEY_END;
+            if (bytes[2] == '3') return KEY_DELETE;
+    }
+
+    return KEY_NONE;
+}
+
+/**
+ * Handles a key while editing
+ *
+ * @param editor Editor to use
+ * @param key Key pressed
+ * @return EDIT_DONE, EDIT_EOF or EDIT_MORE
+ */
+static int editKey(teditor * editor, int key) {
+    char byte = (char) key;
+    int tab = 0;
+
+    switch (key) {
+        case '\r':
+        case '\n':
+            editor->cursor = editor->length;
+            refreshLine(editor);
+            writeAll(editor->out, "\n", 1);
+            return EDIT_DONE;
+
+        case CTRL_KEY('c'):
+            writeAll(editor->out, "^C\n", 3);
+            editor->length = editor->cursor = 0;
+            editor->buffer[0] = '\0';
+            return EDIT_DONE;
+
+        case CTRL_KEY('d'):
+            if (editor->length == 0) {
+                writeAll(editor->out, "\n", 1);
+                return EDIT_EOF;
+            }
+            deleteText(editor, editor->cursor, nextChar(editor, editor->cursor));
+            break;
+
+        case '\t':
+            completeLine(editor);
+            tab = 1;
+            break;
+
+        case BACKSPACE:
+        case CTRL_KEY('h'):
+            deleteText(editor, previousChar(editor, editor->cursor), editor->cursor);
+            break;
+
+        case KEY_DELETE: deleteText(editor, editor->cursor, nextChar(editor, editor->cursor)); break;
+        case CTRL_KEY('a'): case KEY_HOME: editor->cursor = 0; break;
+        case CTRL_KEY('e'): case KEY_END: editor->cursor = editor->length; break;
+        case CTRL_KEY('b'): case KEY_LEFT: editor->cursor = previousChar(editor, editor->cursor); break;
+        case CTRL_KEY('f'): case KEY_RIGHT: editor->cursor = nextChar(editor, editor->cursor); break;
+        case KEY_ALT | 'b': case KEY_WORD_LEFT: editor->cursor = previousWord(editor, editor->cursor); break;
+        case KEY_ALT | 'f': case KEY_WORD_RIGHT: editor->cursor = nextWord(editor, editor->cursor); break;
+        case CTRL_KEY('p'): case KEY_UP: recallHistory(editor, -1); break;
+        case CTRL_KEY('n'): case KEY_DOWN: recallHistory(editor, 1); break;
+        case CTRL_KEY('k'): killText(editor, editor->cursor, editor->length); break;
+        case CTRL_KEY('u'): killText(editor, 0, editor->cursor); break;
+        case CTRL_KEY('w'): killText(editor, previousWord(editor, editor->cursor), editor->cursor); break;
+        case KEY_ALT | 'd': killText(editor, editor->cursor, nextWord(editor, editor->cursor)); break;
+        case CTRL_KEY('y'): insertText(editor, editor->killed, editor->killedLength); break;
+
+        case CTRL_KEY('l'):
+            writeAll(editor->out, "\033[H\033[2J", 7);
+            break;
+
+        case CTRL_KEY('r'):
+            free(editor->saved);
+            editor->saved = strndup(editor->buffer, editor->length);
+            editor->searching = 1;
+            editor->searchLength = 0;
+            editor->searchMatch = 0;
+            break;
+
+        default:
+            // Printable characters (and UTF-8 bytes) are inserted
+            if (key < KEY_ALT && (unsigned char) byte >= ' ') insertText(editor, &byte, 1);
+    }
+
+    editor->lastTab = tab;
+    refreshLine(editor);
+
+    return EDIT_MORE;
+}
+
+/**
+ * Handles a key during a reverse search: typed text finds the newest entry
+ * containing it, Ctrl-R the next older one, Ctrl-G cancels and any other
+ * key accepts the entry found and is handled as usual
+ *
+ * @param editor Editor to use
+ * @param key Key pressed
+ * @return EDIT_DONE, EDIT_EOF or EDIT_MORE
+ */
+static int searchKey(teditor * editor, int key) {
+    char byte = (char) key, * entry;
+    size_t found = 0, length;
+
+    if (key == CTRL_KEY('g') || key == CTRL_KEY('c')) {
+        editor->searching = 0;
+        editor->historyPos = 0;
+        setLine(editor, editor->saved, strlen(editor->saved));
+        refreshLine(editor);
+        return EDIT_MORE;
+    }
+
+    if (key == CTRL_KEY('r') || key == BACKSPACE || key == CTRL_KEY('h') || (key < KEY_ALT && (unsigned char) byte >= ' ')) {
+        if (key == CTRL_KEY('r')) {
+            if (editor->searchLength > 0 && editor->searchMatch > 1) {
+                found = searchHistory(editor->history, editor->search, editor->searchMatch);
+            }
+        } else {
+            if (key == BACKSPACE || key == CTRL_KEY('h')) {
+                if (editor->searchLength > 0) editor->searchLength--;
+            } else {
+                editor->search = (char *) checkedRealloc(editor->search, editor->searchLength + 2);
+                editor->search[editor->searchLength++] = byte;
+            }
+
+            // Start again from the current match, it may still match
+            editor->search = (char *) checkedRealloc(editor->search, editor->searchLength + 1);
+            editor->search[editor->searchLength] = '\0';
+
+            if (editor->searchLength > 0) {
+                found = searchHistory(editor->history, editor->search, editor->searchMatch + (editor->searchMatch > 0));
+            }
+        }
+
+        if (found > 0) {
+            entry = historyEntry(editor->history, found, &length);
+            editor->searchMatch = found;
+            setLine(editor, entry, length);
+            editor->cursor = (char *) memmem(entry, length, editor->search, editor->searchLength) - entry;
+        }
+
+        refreshLine(editor);
+        return EDIT_MORE;
+    }
+
+    // Accept the entry found
+    editor->searching = 0;
+    editor->historyPos = 0;
+
+    return editKey(editor, key);
+}
+
+/**
+ * Completes the word before the cursor with the longest common prefix of
+ * its completions. A second Tab lists them.
+ *
+ * @param editor Editor to use
+ */
+static void completeLine(teditor * editor) {
+    tcompletion completion;
+    size_t common, word, i;
+    char * first;
+
+    findCompletions(editor->buffer, editor->cursor, &completion);
+
+    if (completion.count == 0) {
+        writeAll(editor->out, "\a", 1);
+        freeCompletions(&completion);
+        return;
+    }
+
+    first = completion.matches[0];
+    common = strlen(first);
+
+    for (i = 1; i < completion.count; i++) {
+        while (common > 0 && strncmp(first, completion.matches[i], common) != 0) common--;
+    }
+
+    word = editor->cursor - completion.start;
+
+    if (common > word) {
+        deleteText(editor, completion.start, editor->cursor);
+        insertText(editor, first, common);
+    } else if (completion.count > 1 && editor->lastTab) {
+        listCompletions(editor, &completion);
+    } else if (completion.count > 1) {
+        writeAll(editor->out, "\a", 1);
+    }
+
+    // A complete word is followed by a space, a directory is not
+    if (completion.count == 1 && first[common - 1] != '/' && editor->buffer[editor->cursor] != ' ') {
+        insertText(editor, " ", 1);
+    }
+
+    freeCompletions(&completion);
+}
+
+/**
+ * Lists completions in columns below the line
+ *
+ * @param editor Editor to use
+ * @param completion Completions to list
+ */
+static void listCompletions(teditor * editor, tcompletion * completion) {
+    struct winsize window;
+    size_t width = 0, columns, rows, row, column, i, pad, used = 0;
+    size_t terminal = DEFAULT_COLUMNS;
+    char * match;
+
+    if (ioctl(editor->out, TIOCGWINSZ, &window) == 0 && window.ws_col > 0) terminal = window.ws_col;
+
+    for (i = 0; i < completion->count; i++) {
+        if (strlen(completion->matches[i]) + 2 > width) width = strlen(completion->matches[i]) + 2;
+    }
+
+    columns = terminal / width > 0 ? terminal / width : 1;
+    rows = (completion->count + columns - 1) / columns;
+
+    screenAppend(editor, &used, "\n", 1);
+
+    // Sorted down each column, like ls
+    for (row = 0; row < rows; row++) {
+        for (column = 0; column < columns && (i = column * rows + row) < completion->count; column++) {
+            match = completion->matches[i];
+            screenAppend(editor, &used, match, strlen(match));
+
+            if (column + 1 < columns && (column + 1) * rows + row < completion->count) {
+                for (pad = strlen(match); pad < width; pad++) screenAppend(editor, &used, " ", 1);
+            }
+        }
+
+        screenAppend(editor, &used, "\n", 1);
+    }
+
+    writeAll(editor->out, editor->screen, used);
+}
+
+/**
+ * Shows the previous or next history entry. The line being typed is kept
+ * and shown again after the newest entry.
+ *
+ * @param editor Editor to use
+ * @param direction -1 for older entries, 1 for newer ones
+ */
+static void recallHistory(teditor * editor, int direction) {
+    size_t count = historyCount(editor->history), length;
+    char * entry;
+
+    if (count == 0) return;
+
+    if (direction < 0) {
+        if (editor->historyPos == 1) return;
+
+        if (editor->historyPos == 0) {
+            free(editor->saved);
+            editor->saved = strndup(editor->buffer, editor->length);
+            editor->historyPos = count + 1;
+        }
+
+        editor->historyPos--;
+    } else {
+        if (editor->historyPos == 0) return;
+        editor->historyPos++;
+    }
+
+    if (editor->historyPos > count) {
+        editor->historyPos = 0;
+        setLine(editor, editor->saved, strlen(editor->saved));
+        return;
+    }
+
+    entry = historyEntry(editor->history, editor->historyPos, &length);
+    if (entry != NULL) setLine(editor, entry, length);
+}
+
+/**
+ * Replaces the line, leaving the cursor at its end
+ *
+ * @param editor Editor to use
+ * @param text New line
+ * @param length Length of the line
+ */
+static void setLine(teditor * editor, char * text, size_t length) {
+    editor->length = editor->cursor = 0;
+    insertText(editor, text, length);
+}
+
+/**
+ * Inserts text at the cursor
+ *
+ * @param editor Editor to use
+ * @param text Text to insert
+ * @param length Length of the text
+ */
+static void insertText(teditor * editor, char * text, size_t length) {
+    if (length == 0) return;
+
+    // Room for the text, the newline of editedLine and the terminator
+    if (editor->length + length + 2 > editor->size) {
+        while (editor->length + length + 2 > editor->size) editor->size *= 2;
+        editor->buffer = (char *) checkedRealloc(editor->buffer, editor->size);
+    }
+
+    memmove(editor->buffer + editor->cursor + length, editor->buffer + editor->cursor, editor->length - editor->cursor);
+    memcpy(editor->buffer + editor->cursor, text, length);
+
+    editor->length += length;
+    editor->cursor += length;
+    editor->buffer[editor->length] = '\0';
+}
+
+/**
+ * Deletes a range of the line, leaving the cursor at its start
+ *
+ * @param editor Editor to use
+ * @param from Start of the range
+ * @param to End of the range
+ */
+static void deleteText(teditor * editor, size_t from, size_t to) {
+    if (from >= to) return;
+
+    memmove(editor->buffer + from, editor->buffer + to, editor->length - to);
+
+    editor->length -= to - from;
+    editor->cursor = from;
+    editor->buffer[editor->length] = '\0';
+}
+
+/**
+ * Deletes a range of the line, keeping it to be yanked
+ *
+ * @param editor Editor to use
+ * @param from Start of the range
+ * @param to End of the range
+ */
+static void killText(teditor * editor, size_t from, size_t to) {
+    if (from >= to) return;
+
+    editor->killed = (char *) checkedRealloc(editor->killed, to - from);
+    editor->killedLength = to - from;
+    memcpy(editor->killed, editor->buffer + from, to - from);
+
+    deleteText(editor, from, to);
+}
+
+/**
+ * Finds the start of the character before a position (UTF-8 aware)
+ *
+ * @param editor Editor to use
+ * @param pos Position in the line
+ * @return Start of the previous character
+ */
+static size_t previousChar(teditor * editor, size_t pos) {
+    if (pos == 0) return 0;
+
+    for (pos--; pos > 0 && (editor->buffer[pos] & 0xc0) == 0x80; pos--);
+    return pos;
+}
+
+/**
+ * Finds the start of the character after a position (UTF-8 aware)
+ *
+ * @param editor Editor to use
+ * @param pos Position in the line
+ * @return Start of the next character
+ */
+static size_t nextChar(teditor * editor, size_t pos) {
+    if (pos >= editor->length) return editor->length;
+
+    for (pos++; pos < editor->length && (editor->buffer[pos] & 0xc0) == 0x80; pos++);
+    return pos;
+}
+
+/**
+ * Finds the start of the word before a position
+ *
+ * @param editor Editor to use
+ * @param pos Position in the line
+ * @return Start of the word
+ */
+static size_t previousWord(teditor * editor, size_t pos) {
+    while (pos > 0 && editor->buffer[pos - 1] == ' ') pos--;
+    while (pos > 0 && editor->buffer[pos - 1] != ' ') pos--;
+    return pos;
+}
+
+/**
+ * Finds the end of the word after a position
+ *
+ * @param editor Editor to use
+ * @param pos Position in the line
+ * @return End of the word
+ */
+static size_t nextWord(teditor * editor, size_t pos) {
+    while (pos < editor->length && editor->buffer[pos] == ' ') pos++;
+    while (pos < editor->length && editor->buffer[pos] != ' ') pos++;
+    return pos;
+}
+
+/**
+ * Counts the terminal columns taken by text, skipping escape sequences
+ * and UTF-8 continuation bytes
+ *
+ * @param text Text to measure
+ * @param length Length of the text
+ * @return Number of columns
+ */
+static size_t textWidth(char * text, size_t length) {
+    size_t i, width = 0;
+
+    for (i = 0; i < length; i++) {
+        if (text[i] == ESC && i + 1 < length && text[i + 1] == '[') {
+            for (i += 2; i < length && (text[i] < 0x40 || text[i] > 0x7e); i++);
+        } else if ((text[i] & 0xc0) != 0x80) {
+            width++;
+        }
+    }
+
+    return width;
+}
+
+/**
+ * Draws the prompt and the line in one write. Lines wider than the
+ * terminal scroll horizontally to keep the cursor visible.
+ *
+ * @param editor Editor to use
+ */
+static void refreshLine(teditor * editor) {
+    struct winsize window;
+    size_t columns = DEFAULT_COLUMNS, promptWidth, start = 0, end, used = 0;
+    char * prompt = editor->prompt, move[32];
+
+    if (ioctl(editor->out, TIOCGWINSZ, &window) == 0 && window.ws_col > 0) columns = window.ws_col;
+
+    if (editor->searching) {
+        prompt = (char *) checkedRealloc(NULL, editor->searchLength + 32);
+        sprintf(prompt, "(reverse-i-search)`%.*s': ", (int) editor->searchLength, editor->search);
+    }
+
+    promptWidth = textWidth(prompt, strlen(prompt));
+
+    // Scroll until the cursor fits, then show as much as fits after it
+    while (start < editor->cursor && promptWidth + textWidth(editor->buffer + start, editor->cursor - start) >= columns) {
+        start = nextChar(editor, start);
+    }
+
+    end = editor->cursor;
+    while (end < editor->length && promptWidth + textWidth(editor->buffer + start, nextChar(editor, end) - start) < columns) {
+        end = nextChar(editor, end);
+    }
+
+    screenAppend(editor, &used, "\r", 1);
+    screenAppend(editor, &used, prompt, strlen(prompt));
+    screenAppend(editor, &used, editor->buffer + start, end - start);
+    screenAppend(editor, &used, "\033[0K\r", 5);
+
+    // Move the cursor to its column
+    if (promptWidth + textWidth(editor->buffer + start, editor->cursor - start) > 0) {
+        sprintf(move, "\033[%zuC", promptWidth + textWidth(editor->buffer + start, editor->cursor - start));
+        screenAppend(editor, &used, move, strlen(move));
+    }
+
+    writeAll(editor->out, editor->screen, used);
+
+    if (editor->searching) free(prompt);
+}
+
+/**
+ * Appends text to the output of a redraw
+ *
+ * @param editor Editor to use
+ * @param used Bytes already in the output
+ * @param text Text to append
+ * @param length Length of the text
+ */
+static void screenAppend(teditor * editor, size_t * used, char * text, size_t length) {
+    if (*used + length > editor->screenSize) {
+        editor->screenSize = (*used + length) * 2;
+        editor->screen = (char *) checkedRealloc(editor->screen, editor->screenSize);
+    }
+
+    memcpy(editor->screen + *used, text, length);
+    *used += length;
+}
@@ -0,0 +1,76 @@
+#ifndef EDITOR_H
+#define EDITOR_H
+
+#include <stddef.h>
+#include <termios.h>
+
+#include "history.h"
+
+// ===========================[ Constants ]===========================
+
+// Results of feedEditor
+#define EDIT_MORE 0
+#define EDIT_DONE 1
+#define EDIT_EOF 2
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Line editor over a terminal in raw mode
+ *
+ * @param in: Terminal to read keys from
+ * @param out: Terminal to draw the line on
+ * @param original: Terminal settings to restore
+ * @param raw: Raw mode enabled
+ * @param buffer: Line being edited (NUL-terminated)
+ * @param size: Allocated size of buffer
+ * @param length: Length of the line
+ * @param cursor: Position of the cursor in the line
+ * @param killed: Text killed last, inserted again by Ctrl-Y
+ * @param killedLength: Length of killed
+ * @param prompt: Prompt shown before the line
+ * @param history: History recalled with the arrows and Ctrl-R
+ * @param historyPos: Entry shown (0 for the line being typed)
+ * @param saved: Line being typed while an entry is shown
+ * @param searching: Reverse search (Ctrl-R) in progress
+ * @param search: Text searched
+ * @param searchLength: Length of search
+ * @param searchMatch: Entry matching search (0 if none)
+ * @param lastTab: Last key was Tab (a second one lists the completions)
+ * @param screen: Output of the last redraw
+ * @param screenSize: Allocated size of screen
+ */
+typedef struct {
+    int in;
+    int out;
+    struct termios original;
+    int raw;
+    char * buffer;
+    size_t size;
+    size_t length;
+    size_t cursor;
+    char * killed;
+    size_t killedLength;
+    char * prompt;
+    thistory * history;
+    size_t historyPos;
+    char * saved;
+    char * search;
+    size_t searchLength;
+    size_t searchMatch;
+    int searching;
+    int lastTab;
+    char * screen;
+    size_t screenSize;
+} teditor;
+
+// ===========================[ Prototypes ]==========================
+
+void initEditor(teditor * editor, int in, int out, thistory * history);
+void freeEditor(teditor * editor);
+void startEditing(teditor * editor, char * prompt);
+void stopEditing(teditor * editor);
+int feedEditor(teditor * editor, char * bytes, size_t length, size_t * used);
+char * editedLine(teditor * editor);
+
+#endif
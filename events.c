@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include "events.h"
+
+// ===========================[ Constants ]===========================
+#define MAX_EVENTS 64
+
+// ===========================[ Prototypes ]==========================
+static void freeRemovedWatches();
+
+// ========================[ Global Variables ]=======================
+static int epollFd = -1;
+static twatch ** watches = NULL;
+static int nwatches = 0;
+static twatch * removedWatches = NULL;
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Creates the epoll instance used by the event loop
+ */
+void initEventLoop() {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (epollFd == -1) {
+        fprintf(stderr, "Error: epoll_create1 failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Watches a file descriptor
+ *
+ * @param fd File descriptor to watch
+ * @param events Events to wait for (0 to keep it registered but idle)
+ * @param handler Handler to call when the descriptor is ready
+ * @param data Data passed to the handler
+ * @return 0 if successful, -1 if the descriptor can not be polled
+ */
+int watchFd(int fd, uint32_t events, teventhandler handler, void * data) {
+    struct epoll_event event;
+    twatch * watch;
+    int size;
+
+    // Grow the fd -> watch table
+    if (fd >= nwatches) {
+        size = nwatches == 0 ? 64 : nwatches;
+        while (size <= fd) size *= 2;
+
+        watches = (twatch **) realloc(watches, sizeof(twatch *) * size);
+
+        // Check for malloc errors
+        if (watches == NULL) {
+            fprintf(stderr, "Error: malloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        memset(watches + nwatches, 0, sizeof(twatch *) * (size - nwatches));
+        nwatches = size;
+    }
+
+    watch = (twatch *) malloc(sizeof(twatch));
+
+    // Check for malloc errors
+    if (watch == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    watch->fd = fd;
+    watch->handler = handler;
+    watch->data = data;
+    watch->removed = 0;
+    watch->next = NULL;
+
+    event.events = events;
+    event.data.ptr = watch;
+
+    // Regular files can not be polled (EPERM)
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        free(watch);
+        return -1;
+    }
+
+    watches[fd] = watch;
+    return 0;
+}
+
+/**
+ * Changes the events a watched file descriptor waits for
+ *
+ * @param fd Watched file descriptor
+ * @param events New events
+ * @return 0 if successful, -1 if failed
+ */
+int modifyFd(int fd, uint32_t events) {
+    struct epoll_event event;
+
+    if (fd < 0 || fd >= nwatches || watches[fd] == NULL) return -1;
+
+    event.events = events;
+    event.data.ptr = watches[fd];
+
+    return epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+}
+
+/**
+ * Stops watching a file descriptor. The descriptor is not closed.
+ *
+ * @param fd Watched file descriptor
+ */
+void unwatchFd(int fd) {
+    twatch * watch;
+
+    if (fd < 0 || fd >= nwatches || watches[fd] == NULL) return;
+
+    watch = watches[fd];
+    watches[fd] = NULL;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+
+    // Free it after the current dispatch, other events may still point to it
+    watch->removed = 1;
+    watch->next = removedWatches;
+    removedWatches = watch;
+}
+
+/**
+ * Waits for ready descriptors once and calls their handlers
+ *
+ * @param timeout Maximum time to wait in milliseconds (-1 to block)
+ * @return Number of handled events, -1 if interrupted
+ */
+int runEvents(int timeout) {
+    struct epoll_event events[MAX_EVENTS];
+    twatch * watch;
+    int i, n;
+
+    n = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+
+    if (n == -1) {
+        if (errno != EINTR) fprintf(stderr, "Error: epoll_wait failed\n");
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        watch = (twatch *) events[i].data.ptr;
+
+        // Skip watches removed by a previous handler of this round
+        if (watch->removed) continue;
+
+        watch->handler(watch->fd, events[i].events, watch->data);
+    }
+
+    freeRemovedWatches();
+
+    return n;
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Frees the watches removed during the last dispatch
+ */
+static void freeRemovedWatches() {
+    twatch * watch;
+
+    while (removedWatches != NULL) {
+        watch = removedWatches;
+        removedWatches = watch->next;
+        free(watch);
+    }
+}
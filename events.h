@@ -0,0 +1,42 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Handler called when a watched file descriptor is ready
+ *
+ * @param fd: Ready file descriptor
+ * @param events: Ready events (EPOLLIN, EPOLLOUT, EPOLLHUP...)
+ * @param data: Data given when the descriptor was watched
+ */
+typedef void (*teventhandler)(int fd, uint32_t events, void * data);
+
+/**
+ * Watched file descriptor
+ *
+ * @param fd: File descriptor
+ * @param handler: Handler to call when the descriptor is ready
+ * @param data: Data passed to the handler
+ * @param removed: Set when the watch is removed while dispatching
+ * @param next: Next removed watch waiting to be freed
+ */
+typedef struct twatch {
+    int fd;
+    teventhandler handler;
+    void * data;
+    int removed;
+    struct twatch * next;
+} twatch;
+
+// ===========================[ Prototypes ]==========================
+
+void initEventLoop();
+int watchFd(int fd, uint32_t events, teventhandler handler, void * data);
+int modifyFd(int fd, uint32_t events);
+void unwatchFd(int fd);
+int runEvents(int timeout);
+
+#endif
@@ -0,0 +1,349 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "history.h"
+#include "relay.h"
+
+// ===========================[ Constants ]===========================
+#define OUTPUT_SIZE 65536
+#define REPAIR_CHUNK 4096
+
+// ===========================[ Prototypes ]==========================
+static int syncHistory(thistory * history);
+static void * remap(void * old, size_t oldSize, size_t size, int fd);
+static void repairIndex(thistory * history);
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Opens (or creates) a history log and its index (path with ".idx"). Only
+ * the files are mapped, no entry is read.
+ *
+ * @param history History to open
+ * @param path Path of the log
+ * @return 0 if successful, -1 if the files could not be opened
+ */
+int openHistory(thistory * history, char * path) {
+    char * indexPath;
+
+    memset(history, 0, sizeof(thistory));
+    history->indexFd = -1;
+
+    history->logFd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (history->logFd == -1) return -1;
+
+    indexPath = (char *) malloc(strlen(path) + 5);
+
+    // Check for malloc errors
+    if (indexPath == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sprintf(indexPath, "%s.idx", path);
+    history->indexFd = open(indexPath, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    free(indexPath);
+
+    if (history->indexFd == -1) {
+        close(history->logFd);
+        history->logFd = -1;
+        return -1;
+    }
+
+    // Index lines a crashed shell appended without their offsets
+    flock(history->indexFd, LOCK_EX);
+    repairIndex(history);
+    flock(history->indexFd, LOCK_UN);
+
+    return syncHistory(history);
+}
+
+/**
+ * Unmaps and closes a history
+ *
+ * @param history History to close
+ */
+void closeHistory(thistory * history) {
+    if (history->log != NULL) munmap(history->log, history->logSize);
+    if (history->index != NULL) munmap(history->index, history->indexSize);
+    if (history->logFd != -1) close(history->logFd);
+    if (history->indexFd != -1) close(history->indexFd);
+
+    memset(history, 0, sizeof(thistory));
+    history->logFd = -1;
+    history->indexFd = -1;
+}
+
+/**
+ * Appends a line to the history. The index lock makes the log and index
+ * appends of concurrent shells pair up.
+ *
+ * @param history History to append to
+ * @param line Line to append (a trailing '\n' is not stored twice)
+ * @return 0 if successful, -1 if failed
+ */
+int addHistory(thistory * history, char * line) {
+    struct stat logStat;
+    size_t length = strcspn(line, "\n");
+    uint64_t offset;
+    int res = -1;
+
+    if (history->logFd == -1 || length == 0) return -1;
+
+    flock(history->indexFd, LOCK_EX);
+
+    if (fstat(history->logFd, &logStat) == 0) {
+        offset = logStat.st_size;
+
+        if (writeAll(history->logFd, line, length) == 0 && writeAll(history->logFd, "\n", 1) == 0) {
+            res = writeAll(history->indexFd, (char *) &offset, sizeof(offset));
+        }
+    }
+
+    flock(history->indexFd, LOCK_UN);
+
+    return res;
+}
+
+/**
+ * Gets the number of entries, including the ones added by other shells
+ *
+ * @param history History to check
+ * @return Number of entries
+ */
+size_t historyCount(thistory * history) {
+    syncHistory(history);
+    return history->count;
+}
+
+/**
+ * Gets an entry of the history. The text points into the mapping and is
+ * not NUL-terminated.
+ *
+ * @param history History to read
+ * @param n Number of the entry (starting at 1)
+ * @param length Output for the length of the entry
+ * @return Text of the entry, NULL if there is no such entry
+ */
+char * historyEntry(thistory * history, size_t n, size_t * length) {
+    uint64_t start;
+    char * newline;
+
+    if (n < 1 || n > history->count) syncHistory(history);
+    if (n < 1 || n > history->count) return NULL;
+
+    start = history->index[n - 1];
+    if (start >= history->logSize) return NULL;
+
+    // Entries are single lines
+    newline = memchr(history->log + start, '\n', history->logSize - start);
+    if (newline == NULL) return NULL;
+
+    *length = newline - (history->log + start);
+    return history->log + start;
+}
+
+/**
+ * Finds the newest entry older than before that contains a text
+ * (incremental reverse search: pass the last match to find the next one)
+ *
+ * @param history History to search
+ * @param text Text to find
+ * @param before Number of the entry to start before (0 for the newest)
+ * @return Number of the matching entry, 0 if none
+ */
+size_t searchHistory(thistory * history, char * text, size_t before) {
+    size_t n, length, textLength = strlen(text);
+    char * entry;
+
+    syncHistory(history);
+
+    if (before == 0 || before > history->count + 1) before = history->count + 1;
+
+    for (n = before - 1; n >= 1; n--) {
+        entry = historyEntry(history, n, &length);
+        if (entry != NULL && memmem(entry, length, text, textLength) != NULL) return n;
+    }
+
+    return 0;
+}
+
+/**
+ * Finds the newest entry that starts with a prefix (!prefix)
+ *
+ * @param history History to search
+ * @param prefix Prefix to find
+ * @return Number of the matching entry, 0 if none
+ */
+size_t findHistoryPrefix(thistory * history, char * prefix) {
+    size_t n, length, prefixLength = strlen(prefix);
+    char * entry;
+
+    syncHistory(history);
+
+    for (n = history->count; n >= 1; n--) {
+        entry = historyEntry(history, n, &length);
+        if (entry != NULL && length >= prefixLength && memcmp(entry, prefix, prefixLength) == 0) return n;
+    }
+
+    return 0;
+}
+
+/**
+ * Prints the entries from first on, numbered
+ *
+ * @param history History to print
+ * @param fd File descriptor to write to
+ * @param first Number of the first entry to print
+ */
+void printHistory(thistory * history, int fd, size_t first) {
+    char * buffer, * entry;
+    size_t n, length, used = 0;
+
+    buffer = (char *) malloc(OUTPUT_SIZE);
+
+    // Check for malloc errors
+    if (buffer == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    syncHistory(history);
+    if (first < 1) first = 1;
+
+    for (n = first; n <= history->count; n++) {
+        entry = historyEntry(history, n, &length);
+        if (entry == NULL) continue;
+
+        // Entries longer than the buffer are cut
+        if (length > OUTPUT_SIZE - 32) length = OUTPUT_SIZE - 32;
+
+        if (used + length + 32 > OUTPUT_SIZE) {
+            writeAll(fd, buffer, used);
+            used = 0;
+        }
+
+        used += sprintf(buffer + used, "%5zu  ", n);
+        memcpy(buffer + used, entry, length);
+        used += length;
+        buffer[used++] = '\n';
+    }
+
+    writeAll(fd, buffer, used);
+    free(buffer);
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Maps the entries appended since the last call
+ *
+ * @param history History to update
+ * @return 0 if successful, -1 if the history is not open
+ */
+static int syncHistory(thistory * history) {
+    struct stat logStat, indexStat;
+    size_t size;
+
+    if (history->logFd == -1) return -1;
+    if (fstat(history->indexFd, &indexStat) == -1 || fstat(history->logFd, &logStat) == -1) return -1;
+
+    size = indexStat.st_size - indexStat.st_size % sizeof(uint64_t);
+    if (size == history->indexSize && (size_t) logStat.st_size == history->logSize) return 0;
+
+    history->index = (uint64_t *) remap(history->index, history->indexSize, size, history->indexFd);
+    history->log = (char *) remap(history->log, history->logSize, logStat.st_size, history->logFd);
+
+    history->indexSize = history->index == NULL ? 0 : size;
+    history->logSize = history->log == NULL ? 0 : logStat.st_size;
+    history->count = history->indexSize / sizeof(uint64_t);
+
+    // Entries whose offsets are past the mapped log are not complete yet
+    while (history->count > 0 && history->index[history->count - 1] >= history->logSize) history->count--;
+
+    return 0;
+}
+
+/**
+ * Grows a read-only mapping of a file
+ *
+ * @param old Current mapping (NULL if none)
+ * @param oldSize Size of the current mapping
+ * @param size New size
+ * @param fd File to map
+ * @return The new mapping, NULL if size is 0 or it failed
+ */
+static void * remap(void * old, size_t oldSize, size_t size, int fd) {
+    void * mapping;
+
+    if (old != NULL && size == oldSize) return old;
+    if (old != NULL) mapping = mremap(old, oldSize, size, MREMAP_MAYMOVE);
+    else if (size > 0) mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    else return NULL;
+
+    return mapping == MAP_FAILED ? NULL : mapping;
+}
+
+/**
+ * Appends the offsets of the log lines that are not indexed (a shell died
+ * between both appends). Must be called with the index locked.
+ *
+ * @param history History to repair
+ */
+static void repairIndex(thistory * history) {
+    struct stat logStat, indexStat;
+    char buffer[REPAIR_CHUNK];
+    uint64_t offset = 0, lineStart;
+    ssize_t n, i;
+
+    if (fstat(history->logFd, &logStat) == -1 || fstat(history->indexFd, &indexStat) == -1) return;
+
+    // Drop a partially written offset
+    if (indexStat.st_size % sizeof(uint64_t) != 0) {
+        indexStat.st_size -= indexStat.st_size % sizeof(uint64_t);
+        if (ftruncate(history->indexFd, indexStat.st_size) == -1) return;
+    }
+
+    // Start after the last indexed line
+    if (indexStat.st_size > 0) {
+        if (pread(history->indexFd, &offset, sizeof(offset), indexStat.st_size - sizeof(offset)) != sizeof(offset)) return;
+
+        while (offset < (uint64_t) logStat.st_size) {
+            n = pread(history->logFd, buffer, sizeof(buffer), offset);
+            if (n <= 0) return;
+
+            for (i = 0; i < n && buffer[i] != '\n'; i++);
+            offset += i;
+
+            if (i < n) {
+                offset++;
+                break;
+            }
+        }
+    }
+
+    // Every line start from there on is missing in the index
+    lineStart = offset;
+
+    while (offset < (uint64_t) logStat.st_size) {
+        n = pread(history->logFd, buffer, sizeof(buffer), offset);
+        if (n <= 0) return;
+
+        for (i = 0; i < n; i++) {
+            if (buffer[i] != '\n') continue;
+
+            writeAll(history->indexFd, (char *) &lineStart, sizeof(lineStart));
+            lineStart = offset + i + 1;
+        }
+
+        offset += n;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Command history. Lines are appended to a log file and their offsets to
+ * an index file, both mapped read-only, so opening it costs the same with
+ * ten or ten million entries.
+ *
+ * @param logFd: Log of lines, one per entry ending in '\n'
+ * @param indexFd: Offset of every entry in the log (uint64_t each)
+ * @param log: Mapping of the log
+ * @param logSize: Mapped bytes of the log
+ * @param index: Mapping of the index
+ * @param indexSize: Mapped bytes of the index
+ * @param count: Complete entries in the mappings
+ */
+typedef struct {
+    int logFd;
+    int indexFd;
+    char * log;
+    size_t logSize;
+    uint64_t * index;
+    size_t indexSize;
+    size_t count;
+} thistory;
+
+// ===========================[ Prototypes ]==========================
+
+int openHistory(thistory * history, char * path);
+void closeHistory(thistory * history);
+int addHistory(thistory * history, char * line);
+size_t historyCount(thistory * history);
+char * historyEntry(thistory * history, size_t n, size_t * length);
+size_t searchHistory(thistory * history, char * text, size_t before);
+size_t findHistoryPrefix(thistory * history, char * prefix);
+void printHistory(thistory * history, int fd, size_t first);
+
+#endif
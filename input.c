@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "input.h"
+#include "arena.h"
+
+// ===========================[ Constants ]===========================
+#define INPUT_CHUNK 4096
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Initializes a line reader
+ *
+ * @param input Reader to initialize
+ * @param fd File descriptor to read from
+ */
+void initInput(tinput * input, int fd) {
+    memset(input, 0, sizeof(tinput));
+    input->fd = fd;
+}
+
+/**
+ * Initializes a line reader over a string (e.g. the -c argument)
+ *
+ * @param input Reader to initialize
+ * @param str Lines to read
+ */
+void initInputString(tinput * input, char * str) {
+    initInput(input, -1);
+
+    input->size = strlen(str) + 1;
+    input->end = input->size - 1;
+    input->buffer = (char *) checkedRealloc(NULL, input->size);
+    input->eof = 1;
+
+    memcpy(input->buffer, str, input->size);
+}
+
+/**
+ * Frees the buffers of a line reader. The descriptor is not closed.
+ *
+ * @param input Reader to free
+ */
+void freeInput(tinput * input) {
+    free(input->buffer);
+    free(input->line);
+    initInput(input, -1);
+}
+
+/**
+ * Reads the available bytes once
+ *
+ * @param input Reader to fill
+ * @return Number of bytes read, 0 at end of file, -1 if nothing was read
+ */
+int fillInput(tinput * input) {
+    ssize_t n;
+
+    // Move unconsumed bytes to the front before reading more
+    if (input->start > 0) {
+        memmove(input->buffer, input->buffer + input->start, input->end - input->start);
+        input->end -= input->start;
+        input->start = 0;
+    }
+
+    if (input->size - input->end < INPUT_CHUNK) {
+        input->size = input->size == 0 ? INPUT_CHUNK * 2 : input->size * 2;
+        input->buffer = (char *) checkedRealloc(input->buffer, input->size);
+    }
+
+    n = read(input->fd, input->buffer + input->end, input->size - input->end);
+
+    if (n == 0) {
+        input->eof = 1;
+        return 0;
+    }
+
+    if (n < 0) {
+        // Treat read errors other than interruptions as end of file
+        if (errno != EINTR && errno != EAGAIN) input->eof = 1;
+        return -1;
+    }
+
+    input->end += n;
+    return (int) n;
+}
+
+/**
+ * Returns the next complete line, newline included. At end of file the
+ * last unterminated line is returned with a newline appended.
+ *
+ * @param input Reader to consume
+ * @return Line valid until the next call, NULL if no complete line is buffered
+ */
+char * nextLine(tinput * input) {
+    char * newline;
+    size_t len;
+
+    if (input->start == input->end) return NULL;
+
+    newline = memchr(input->buffer + input->start, '\n', input->end - input->start);
+
+    if (newline != NULL) len = newline - (input->buffer + input->start) + 1;
+    else if (input->eof) len = input->end - input->start;
+    else return NULL;
+
+    if (input->lineSize < len + 2) {
+        input->lineSize = len + 2;
+        input->line = (char *) checkedRealloc(input->line, input->lineSize);
+    }
+
+    memcpy(input->line, input->buffer + input->start, len);
+    input->start += len;
+
+    if (input->line[len - 1] != '\n') input->line[len++] = '\n';
+    input->line[len] = '\0';
+
+    return input->line;
+}
@@ -0,0 +1,39 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Buffered line reader over a file descriptor
+ *
+ * @param fd: File descriptor to read from
+ * @param buffer: Bytes read and not consumed yet
+ * @param size: Allocated size of buffer
+ * @param start: First unconsumed byte in buffer
+ * @param end: End of the data in buffer
+ * @param line: Last line returned by nextLine
+ * @param lineSize: Allocated size of line
+ * @param eof: End of file reached
+ */
+typedef struct {
+    int fd;
+    char * buffer;
+    size_t size;
+    size_t start;
+    size_t end;
+    char * line;
+    size_t lineSize;
+    int eof;
+} tinput;
+
+// ===========================[ Prototypes ]==========================
+
+void initInput(tinput * input, int fd);
+void initInputString(tinput * input, char * str);
+void freeInput(tinput * input);
+int fillInput(tinput * input);
+char * nextLine(tinput * input);
+
+#endif
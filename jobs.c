@@ -0,0 +1,495 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "jobs.h"
+
+// ===========================[ Constants ]===========================
+#define INITIAL_SLOTS 16
+#define INITIAL_PID_BUCKETS 64
+
+// ===========================[ Prototypes ]==========================
+static void growSlots(tjobstore * store);
+static void rebuildPidTable(tjobstore * store);
+static tpidslot * findPidSlot(tjobstore * store, pid_t pid);
+static void unregisterPid(tjobstore * store, pid_t pid);
+static unsigned int hashPid(pid_t pid, int capacity);
+static void readProcStats(pid_t pid, tstagestats * stats);
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Initializes an empty job store. No job is allocated until it is needed.
+ *
+ * @param store Store to initialize
+ */
+void initJobStore(tjobstore * store) {
+    memset(store, 0, sizeof(tjobstore));
+}
+
+/**
+ * Frees every job and index of a job store
+ *
+ * @param store Store to free
+ */
+void freeJobStore(tjobstore * store) {
+    int i;
+
+    // Return running jobs to the free list before freeing the slots
+    while (store->head != NULL) removeJob(store, store->head);
+
+    for (i = 0; i < store->capacity; i++) {
+        free(store->slots[i]->pids);
+        free(store->slots[i]->pipes);
+        free(store->slots[i]->stats);
+        free(store->slots[i]->command);
+        free(store->slots[i]);
+    }
+
+    free(store->slots);
+    free(store->pidTable);
+    initJobStore(store);
+}
+
+/**
+ * Adds a job to the store, reusing a free slot or growing the store
+ *
+ * @param store Store to add the job to
+ * @param line Parsed line of the job
+ * @param command Command string
+ * @return The new job
+ */
+tjob * addJob(tjobstore * store, tline * line, char * command) {
+    tjob * job;
+    int j;
+
+    if (store->freeList == NULL) growSlots(store);
+
+    // Pop a slot from the free list
+    job = store->freeList;
+    store->freeList = job->next;
+
+    store->lastId++;
+
+    job->id = store->lastId;
+    job->status = 1;
+    job->line = line;
+    memcpy(reserveJobCommand(job, strlen(command) + 1), command, strlen(command) + 1);
+    job->background = line->background;
+    job->ncommands = line->ncommands;
+    job->alive = 0;
+    job->exitStatus = 0;
+    job->timed = 0;
+    job->owned = 0;
+    job->inputFd = -1;
+    job->captureFd = -1;
+    job->capture = NULL;
+    job->cgroup = 0;
+    job->cgroupFd = -1;
+    job->pgid = 0;
+
+    // The arrays of the slot only grow, reused jobs do not allocate
+    if (line->ncommands > job->capacity) {
+        job->capacity = line->ncommands;
+        job->pids = (pid_t *) checkedRealloc(job->pids, sizeof(pid_t) * job->capacity);
+        job->pipes = (int (*)[2]) checkedRealloc(job->pipes, sizeof(int [2]) * job->capacity);
+        job->stats = (tstagestats *) checkedRealloc(job->stats, sizeof(tstagestats) * job->capacity);
+    }
+
+    memset(job->stats, 0, sizeof(tstagestats) * line->ncommands);
+
+    for (j = 0; j < line->ncommands; j++) {
+        job->pids[j] = -1;
+        snprintf(job->stats[j].name, STAGE_NAME_SIZE, "%s", line->commands[j].argv[0]);
+    }
+
+    // Append the job to the id-ordered list (ids only grow)
+    job->prev = store->tail;
+    job->next = NULL;
+
+    if (store->tail != NULL) store->tail->next = job;
+    else store->head = job;
+
+    store->tail = job;
+    store->size++;
+
+    return job;
+}
+
+/**
+ * Removes a job from the store and returns its slot to the free list
+ *
+ * @param store Store to remove the job from
+ * @param job Job to remove
+ */
+void removeJob(tjobstore * store, tjob * job) {
+    int j;
+
+    // Drop the job's processes from the pid index
+    for (j = 0; j < job->ncommands; j++) {
+        if (job->pids[j] > 0) unregisterPid(store, job->pids[j]);
+    }
+
+    // Unlink from the id-ordered list
+    if (job->prev != NULL) job->prev->next = job->next;
+    else store->head = job->next;
+
+    if (job->next != NULL) job->next->prev = job->prev;
+    else store->tail = job->prev;
+
+    if (store->foreground == job) store->foreground = NULL;
+
+    // Reset job so its slot can be used again
+    job->id = -1;
+    job->status = -1;
+    job->line = NULL;
+    job->ncommands = 0;
+    job->prev = NULL;
+    job->next = store->freeList;
+    store->freeList = job;
+    store->size--;
+}
+
+/**
+ * Records that a process belongs to the given stage of a job
+ *
+ * @param store Store of the job
+ * @param job Job of the process
+ * @param stage Index of the process in the job
+ * @param pid Process ID
+ */
+void registerPid(tjobstore * store, tjob * job, int stage, pid_t pid) {
+    unsigned int i;
+
+    job->pids[stage] = pid;
+    job->alive++;
+
+    job->stats[stage].pid = pid;
+    clock_gettime(CLOCK_MONOTONIC, &job->stats[stage].start);
+
+    if (job->pgid == 0) job->pgid = pid;
+
+    // Keep the load factor (deleted buckets included) under 1/2
+    if ((store->pidUsed + 1) * 2 > store->pidCapacity) rebuildPidTable(store);
+
+    i = hashPid(pid, store->pidCapacity);
+
+    while (store->pidTable[i].pid > 0) i = (i + 1) & (store->pidCapacity - 1);
+
+    if (store->pidTable[i].pid == 0) store->pidUsed++;
+
+    store->pidTable[i].pid = pid;
+    store->pidTable[i].job = job;
+    store->pidTable[i].stage = stage;
+}
+
+/**
+ * Finds the job a process belongs to
+ *
+ * @param store Store to search
+ * @param pid Process ID
+ * @param stage Output for the index of the process in the job (may be NULL)
+ * @return The job, NULL if the process is not part of any job
+ */
+tjob * findJobByPid(tjobstore * store, pid_t pid, int * stage) {
+    tpidslot * slot = findPidSlot(store, pid);
+
+    if (slot == NULL) return NULL;
+    if (stage != NULL) *stage = slot->stage;
+
+    return slot->job;
+}
+
+/**
+ * Drops a terminated process from the pid index, so its pid can be reused
+ *
+ * @param store Store of the job
+ * @param pid Process ID
+ * @param stage Output for the index of the process in the job (may be NULL)
+ * @return The job the process belonged to, NULL if it was not indexed
+ */
+tjob * releasePid(tjobstore * store, pid_t pid, int * stage) {
+    tpidslot * slot = findPidSlot(store, pid);
+    tjob * job;
+
+    if (slot == NULL) return NULL;
+
+    job = slot->job;
+    if (stage != NULL) *stage = slot->stage;
+
+    job->pids[slot->stage] = 0;
+    job->alive--;
+
+    slot->pid = -1;
+    slot->job = NULL;
+
+    return job;
+}
+
+/**
+ * Finds a job by its id
+ *
+ * @param store Store to search
+ * @param id Job ID
+ * @return The job, NULL if not found
+ */
+tjob * findJobById(tjobstore * store, int id) {
+    tjob * job;
+
+    for (job = store->head; job != NULL && job->id <= id; job = job->next) {
+        if (job->id == id) return job;
+    }
+
+    return NULL;
+}
+
+/**
+ * Finds a job by its position in the id-ordered list, as shown by jobs
+ *
+ * @param store Store to search
+ * @param position Position of the job (starting at 1)
+ * @return The job, NULL if not found
+ */
+tjob * getJobByPosition(tjobstore * store, int position) {
+    tjob * job;
+
+    if (position < 1) return NULL;
+
+    for (job = store->head; job != NULL && position > 1; job = job->next) position--;
+
+    return job;
+}
+
+/**
+ * Makes room in the command buffer of a job, keeping its contents
+ *
+ * @param job Job whose command changes
+ * @param size Bytes needed (including the terminator)
+ * @return The command buffer
+ */
+char * reserveJobCommand(tjob * job, size_t size) {
+    if (size > job->commandCapacity) {
+        job->commandCapacity = size < 64 ? 64 : size;
+        job->command = (char *) checkedRealloc(job->command, job->commandCapacity);
+    }
+
+    return job->command;
+}
+
+// ===========================[ Accounting ]==========================
+
+/**
+ * Stores the final resource usage of a reaped stage
+ *
+ * @param job Job of the stage
+ * @param stage Index of the stage
+ * @param status Wait status of the stage
+ * @param usage Resource usage returned by wait4
+ */
+void recordStageUsage(tjob * job, int stage, int status, struct rusage * usage) {
+    tstagestats * stats = job->stats + stage;
+
+    clock_gettime(CLOCK_MONOTONIC, &stats->end);
+
+    stats->finished = 1;
+    stats->exitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    stats->utime = usage->ru_utime;
+    stats->stime = usage->ru_stime;
+    stats->maxRss = usage->ru_maxrss;
+    stats->voluntary = usage->ru_nvcsw;
+    stats->involuntary = usage->ru_nivcsw;
+}
+
+/**
+ * Gets the resource usage of a stage: the final figures once it is reaped,
+ * the live ones from /proc while it is running
+ *
+ * @param job Job of the stage
+ * @param stage Index of the stage
+ * @param stats Output for the figures (end is the current time if running)
+ */
+void sampleStage(tjob * job, int stage, tstagestats * stats) {
+    *stats = job->stats[stage];
+
+    if (stats->finished || stats->pid <= 0) return;
+
+    clock_gettime(CLOCK_MONOTONIC, &stats->end);
+    readProcStats(stats->pid, stats);
+}
+
+/**
+ * Computes the seconds between two CLOCK_MONOTONIC times
+ *
+ * @param start First time
+ * @param end Second time
+ * @return Seconds from start to end (negative if end is earlier)
+ */
+double elapsedSeconds(struct timespec * start, struct timespec * end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Converts a rusage time to seconds
+ *
+ * @param time Time to convert
+ * @return Seconds
+ */
+double timevalSeconds(struct timeval * time) {
+    return time->tv_sec + time->tv_usec / 1e6;
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Doubles the number of job slots and adds the new ones to the free list
+ *
+ * @param store Store to grow
+ */
+static void growSlots(tjobstore * store) {
+    int i, capacity;
+
+    capacity = store->capacity == 0 ? INITIAL_SLOTS : store->capacity * 2;
+    store->slots = (tjob **) checkedRealloc(store->slots, sizeof(tjob *) * capacity);
+
+    // Push new slots in reverse so lower slots are used first
+    for (i = capacity - 1; i >= store->capacity; i--) {
+        store->slots[i] = (tjob *) checkedRealloc(NULL, sizeof(tjob));
+        memset(store->slots[i], 0, sizeof(tjob));
+
+        store->slots[i]->id = -1;
+        store->slots[i]->status = -1;
+        store->slots[i]->slot = i;
+        store->slots[i]->next = store->freeList;
+        store->freeList = store->slots[i];
+    }
+
+    store->capacity = capacity;
+}
+
+/**
+ * Rebuilds the pid index dropping deleted entries. The buckets only double
+ * when the live entries need them: a table full of deleted buckets is
+ * rebuilt at the same size, so reaping never makes it grow.
+ *
+ * @param store Store to rebuild
+ */
+static void rebuildPidTable(tjobstore * store) {
+    tpidslot * old = store->pidTable;
+    int i, live = 0, oldCapacity = store->pidCapacity;
+    unsigned int j;
+
+    for (i = 0; i < oldCapacity; i++) {
+        if (old[i].pid > 0) live++;
+    }
+
+    if (oldCapacity == 0) store->pidCapacity = INITIAL_PID_BUCKETS;
+    else if ((live + 1) * 4 > oldCapacity) store->pidCapacity = oldCapacity * 2;
+    store->pidTable = (tpidslot *) checkedRealloc(NULL, sizeof(tpidslot) * store->pidCapacity);
+    store->pidUsed = 0;
+    memset(store->pidTable, 0, sizeof(tpidslot) * store->pidCapacity);
+
+    for (i = 0; i < oldCapacity; i++) {
+        if (old[i].pid <= 0) continue;
+
+        j = hashPid(old[i].pid, store->pidCapacity);
+        while (store->pidTable[j].pid != 0) j = (j + 1) & (store->pidCapacity - 1);
+
+        store->pidTable[j] = old[i];
+        store->pidUsed++;
+    }
+
+    free(old);
+}
+
+/**
+ * Finds the bucket of a pid in the pid index
+ *
+ * @param store Store to search
+ * @param pid Process ID
+ * @return The bucket, NULL if the pid is not indexed
+ */
+static tpidslot * findPidSlot(tjobstore * store, pid_t pid) {
+    unsigned int i;
+
+    if (store->pidCapacity == 0 || pid <= 0) return NULL;
+
+    i = hashPid(pid, store->pidCapacity);
+
+    while (store->pidTable[i].pid != 0) {
+        if (store->pidTable[i].pid == pid) return &store->pidTable[i];
+        i = (i + 1) & (store->pidCapacity - 1);
+    }
+
+    return NULL;
+}
+
+/**
+ * Removes a pid from the pid index, leaving a deleted marker
+ *
+ * @param store Store to update
+ * @param pid Process ID
+ */
+static void unregisterPid(tjobstore * store, pid_t pid) {
+    tpidslot * slot = findPidSlot(store, pid);
+
+    if (slot == NULL) return;
+
+    slot->pid = -1;
+    slot->job = NULL;
+}
+
+/**
+ * Hashes a pid into a bucket index
+ *
+ * @param pid Process ID
+ * @param capacity Number of buckets (power of two)
+ * @return Bucket index
+ */
+static unsigned int hashPid(pid_t pid, int capacity) {
+    return ((unsigned int) pid * 2654435761u) & (capacity - 1);
+}
+
+
+/**
+ * Reads the CPU times, peak RSS and context switches of a running process
+ *
+ * @param pid Process ID
+ * @param stats Output for the figures
+ */
+static void readProcStats(pid_t pid, tstagestats * stats) {
+    char path[64], buffer[4096];
+    unsigned long utime, stime;
+    long ticks = sysconf(_SC_CLK_TCK);
+    char * field;
+    FILE * file;
+
+    // utime and stime are the 14th and 15th fields, after the command name
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    file = fopen(path, "r");
+    if (file == NULL) return;
+
+    if (fgets(buffer, sizeof(buffer), file) != NULL && (field = strrchr(buffer, ')')) != NULL) {
+        if (sscanf(field + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+            stats->utime.tv_sec = utime / ticks;
+            stats->utime.tv_usec = (utime % ticks) * 1000000 / ticks;
+            stats->stime.tv_sec = stime / ticks;
+            stats->stime.tv_usec = (stime % ticks) * 1000000 / ticks;
+        }
+    }
+
+    fclose(file);
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    file = fopen(path, "r");
+    if (file == NULL) return;
+
+    while (fgets(buffer, sizeof(buffer), file) != NULL) {
+        if (strncmp(buffer, "VmHWM:", 6) == 0) stats->maxRss = atol(buffer + 6);
+        else if (strncmp(buffer, "voluntary_ctxt_switches:", 24) == 0) stats->voluntary = atol(buffer + 24);
+        else if (strncmp(buffer, "nonvoluntary_ctxt_switches:", 27) == 0) stats->involuntary = atol(buffer + 27);
+    }
+
+    fclose(file);
+}
@@ -0,0 +1,165 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "parser.h"
+
+// ===========================[ Constants ]===========================
+#define STAGE_NAME_SIZE 32
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Resource usage of a job stage, final once the stage is reaped
+ *
+ * @param name: Command name of the stage
+ * @param pid: Process ID (kept after the stage is reaped)
+ * @param finished: 1 once the stage was reaped and the figures are final
+ * @param exitStatus: Exit status of the stage (128 + signal if killed)
+ * @param utime: User CPU time
+ * @param stime: System CPU time
+ * @param maxRss: Maximum resident set size in KiB
+ * @param voluntary: Voluntary context switches
+ * @param involuntary: Involuntary context switches
+ * @param start: Time the stage was started (CLOCK_MONOTONIC)
+ * @param end: Time the stage was reaped (CLOCK_MONOTONIC)
+ */
+typedef struct {
+    char name[STAGE_NAME_SIZE];
+    pid_t pid;
+    int finished;
+    int exitStatus;
+    struct timeval utime;
+    struct timeval stime;
+    long maxRss;
+    long voluntary;
+    long involuntary;
+    struct timespec start;
+    struct timespec end;
+} tstagestats;
+
+/**
+ * Job structure. Slots are reused: their arrays and command buffer are
+ * kept when the job is removed and only grow, so a long session running
+ * jobs of the same shapes stops allocating.
+ *
+ * @param id: Job ID
+ * @param status: Job status (-1: Terminated, 0: Stopped, 1: Running)
+ * @param line: Parsed line (only valid while the job is being spawned)
+ * @param pids: Array of process IDs (0 once reaped)
+ * @param pgid: Process group ID of the job
+ * @param pipes: Array of pipes
+ * @param command: Command string
+ * @param commandCapacity: Allocated size of command
+ * @param background: Background flag (0: Foreground, 1: Background)
+ * @param ncommands: Number of commands (stages) in the job
+ * @param alive: Number of stages that have not terminated yet
+ * @param exitStatus: Exit status of the last command (128 + signal if killed)
+ * @param stats: Resource usage of every stage
+ * @param capacity: Number of stages the arrays of the slot can hold
+ * @param timed: Report the resource usage when the job finishes (time prefix)
+ * @param owned: The job is removed by the builtin that started it, not when reaped
+ * @param inputFd: Descriptor the first stage reads (here-document, -1: none)
+ * @param captureFd: Descriptor the job's output and errors go to (-1: inherited)
+ * @param capture: Ring the job's output is kept in (&capture, NULL otherwise)
+ * @param cgroup: Id of the job's cgroup (limit, 0: none)
+ * @param cgroupFd: cgroup.procs of the job's cgroup while it is spawned (-1: none)
+ * @param slot: Index of the job in the store
+ * @param prev: Previous job in id order
+ * @param next: Next job in id order (next free slot when unused)
+ */
+typedef struct tjob {
+    int id;
+    int status;
+    tline * line;
+    pid_t * pids;
+    pid_t pgid;
+    int (* pipes)[2];
+    char * command;
+    size_t commandCapacity;
+    int background;
+    int ncommands;
+    int alive;
+    int exitStatus;
+    tstagestats * stats;
+    int capacity;
+    int timed;
+    int owned;
+    int inputFd;
+    int captureFd;
+    struct tcapture * capture;
+    int cgroup;
+    int cgroupFd;
+    int slot;
+    struct tjob * prev;
+    struct tjob * next;
+} tjob;
+
+/**
+ * Entry of the pid -> (job, stage) index
+ *
+ * @param pid: Process ID (0: Empty, -1: Deleted)
+ * @param job: Job the process belongs to
+ * @param stage: Index of the process in the job
+ */
+typedef struct {
+    pid_t pid;
+    tjob * job;
+    int stage;
+} tpidslot;
+
+/**
+ * Job store
+ *
+ * @param slots: Growable array of jobs, reused through the free list
+ * @param capacity: Number of allocated slots
+ * @param freeList: First unused job (linked through next)
+ * @param head: First job in id order
+ * @param tail: Last job in id order
+ * @param size: Number of jobs in the store
+ * @param lastId: Last assigned job ID
+ * @param foreground: Job running in the foreground (NULL if none)
+ * @param pidTable: Open addressing hash from pid to (job, stage)
+ * @param pidCapacity: Number of buckets in pidTable (power of two)
+ * @param pidUsed: Number of non-empty buckets (including deleted ones)
+ * @param captures: Outputs of the jobs started with &capture, in job order
+ */
+typedef struct {
+    tjob ** slots;
+    int capacity;
+    tjob * freeList;
+    tjob * head;
+    tjob * tail;
+    int size;
+    int lastId;
+    tjob * foreground;
+    tpidslot * pidTable;
+    int pidCapacity;
+    int pidUsed;
+    struct tcapture * captures;
+} tjobstore;
+
+// ===========================[ Prototypes ]==========================
+
+void initJobStore(tjobstore * store);
+void freeJobStore(tjobstore * store);
+tjob * addJob(tjobstore * store, tline * line, char * command);
+void removeJob(tjobstore * store, tjob * job);
+void registerPid(tjobstore * store, tjob * job, int stage, pid_t pid);
+tjob * findJobByPid(tjobstore * store, pid_t pid, int * stage);
+tjob * releasePid(tjobstore * store, pid_t pid, int * stage);
+tjob * findJobById(tjobstore * store, int id);
+char * reserveJobCommand(tjob * job, size_t size);
+tjob * getJobByPosition(tjobstore * store, int position);
+
+// Accounting
+void recordStageUsage(tjob * job, int stage, int status, struct rusage * usage);
+void sampleStage(tjob * job, int stage, tstagestats * stats);
+double elapsedSeconds(struct timespec * start, struct timespec * end);
+double timevalSeconds(struct timeval * time);
+
+#endif
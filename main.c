@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -6,12 +7,37 @@
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctype.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/pidfd.h>
+#include <sched.h>
+#include <sys/mman.h>
 
 #include "parser.h"
+#include "pathcache.h"
+#include "jobs.h"
+#include "events.h"
+#include "input.h"
+#include "arena.h"
+#include "builtins.h"
+#include "options.h"
+#include "trace.h"
+#include "relay.h"
+#include "history.h"
+#include "editor.h"
+#include "prompt.h"
+#include "server.h"
+#include "variables.h"
+#include "wildcard.h"
+#include "memo.h"
+#include "capture.h"
+#include "resources.h"
 
 // ===========================[ Constants ]===========================
-#define MAX_LINE 80
-#define MAX_COMMANDS 20
 
 #ifdef DEBUG
     #define DEBUG_MODE 1
@@ -19,140 +45,755 @@
     #define DEBUG_MODE 0
 #endif
 
-// ===========================[ Structures ]==========================
+// Spawn engine (1: posix_spawn, 0: fork + execvp)
+#ifdef USE_FORK
+    #define SPAWN_MODE 0
+#else
+    #define SPAWN_MODE 1
+#endif
 
-/**
- * Job structure
- * 
- * @param id: Job ID
- * @param status: Job status (0: Stopped, 1: Running)
- * @param line: Parsed line
- * @param pids: Array of process IDs
- * @param pipes: Array of pipes
- * @param command: Command string
- * @param background: Background flag (0: Foreground, 1: Background)
- */
-typedef struct {
-    int id;
-    int status;
-    tline * line;
-    pid_t * pids;
-    int ** pipes;
-    char * command;
-    int background;
-} tjob;
+// Home, clear screen and scrollback (understood by every ANSI terminal)
+#define CLEAR_SCREEN "\033[H\033[2J\033[3J"
+
+// Memory the line arena keeps for the next line, the rest is freed
+#define LINE_ARENA_KEEP (64 * 1024)
+
+// Here-documents: prompt of the body lines and size of the writes
+#define HERE_DOCUMENT_PROMPT "> "
+#define HERE_DOCUMENT_CHUNK 65536
 
 // ===========================[ Prototypes ]==========================
 
 // Functions
 void printDebugData(int mode, tline * line);
-void readLine(char * line, int max);
+void printPrompt();
+char * promptText();
+char * readLine(tinput * input);
+char * editLine(tinput * input);
 void redirectIO(tjob * job, int i);
+void redirectFile(char * file, int flags, int target);
 int isInputOk(tline * line);
+int runBuiltin(tline * line);
 int externalCommand(tline * line, char* command);
+void cachedCommand(tline * line, char * command);
+void launchJob(tjob * job);
 int changeDirectory(char * path);
-void umaskCommand(tline * line);
-void jobsCommand(tline * line);
-void bgCommand(char * job_id);
-void initializeJob(tjob * job);
-int addJob(tline * line, char * command);
-
-// Signal handlers
+void waitForegroundJob(tjob * job);
+char * resolveCommand(tarena * arena, char * name);
+pid_t spawnStage(tjob * job, int i);
+void prepareChild(tjob * job, int i);
+pid_t forkStage(tjob * job, int i, char * path);
+pid_t forkBuiltinStage(tjob * job, int i, tbuiltin * builtin);
+pid_t posixSpawnStage(tjob * job, int i, char * path, int files[3]);
+int openStageFiles(tjob * job, int i, int files[3]);
+void failStage(tjob * job, int i, int status);
+int openRedirections(tline * line, int fds[3]);
+int applyLinePrefixes(tline * line);
+int openHereInput(tline * line, tinput * input);
+void closeHereInput();
+void printTime(char * label, double seconds);
+void printJobTimes(tjob * job);
+void printStageStats(int fd, tstagestats * stats, int live);
+void placeStage(pid_t pid, int i, int nstages);
+void initHistory();
+char * expandHistory(char * line);
+tline * prepareLine(char ** text, tinput * input, int * kind);
+int serveLine(tsession * session, char * text);
+int serveJob(tsession * session, tjob * job);
+void finishServedLine(tsession * session, tjob * job);
+int serveWait(tsession * session, tcommand * command, int fds[3]);
+int startCapture(int saved[2]);
+void endCapture(tsession * session, int fd, int saved[2]);
+void expandLine(tarena * arena, tline * line);
+int assignVariables(tline * line);
+void variableChanged(char * name);
+
+// Builtins
+int cdCommand(tcommand * command, tline * line, int fds[3]);
+int exitCommand(tcommand * command, tline * line, int fds[3]);
+int umaskCommand(tcommand * command, tline * line, int fds[3]);
+int jobsCommand(tcommand * command, tline * line, int fds[3]);
+int bgCommand(tcommand * command, tline * line, int fds[3]);
+int hashCommand(tcommand * command, tline * line, int fds[3]);
+int waitCommand(tcommand * command, tline * line, int fds[3]);
+int fgCommand(tcommand * command, tline * line, int fds[3]);
+int setCommand(tcommand * command, tline * line, int fds[3]);
+int parallelCommand(tcommand * command, tline * line, int fds[3]);
+int historyCommand(tcommand * command, tline * line, int fds[3]);
+int exportCommand(tcommand * command, tline * line, int fds[3]);
+int unsetCommand(tcommand * command, tline * line, int fds[3]);
+int ulimitCommand(tcommand * command, tline * line, int fds[3]);
+
+// Event handlers
+void signalHandler(int fd, uint32_t events, void * data);
+void inputHandler(int fd, uint32_t events, void * data);
+void childExitHandler(int fd, uint32_t events, void * data);
+void childStopHandler(pid_t pid);
 void ctrlC(int sig);
 void ctrlZ(int sig);
-void terminatedChildHandler(int sig);
-
-// Utilities
-int getRunningJobIndex();
-void sortJobsById(tjob * jobs[]);
-int compareJobs(const void * a, const void * b);
 
 // ========================[ Global Variables ]=======================
-tjob * jobs[MAX_COMMANDS];
-int count = 0, bgJobs = 0, stoppedJobs = 0;
+extern char ** environ;
+tjobstore shellJobs, * jobs = &shellJobs;
+tarena lineArena;
+sigset_t shellMask;
+int bgJobs = 0, stoppedJobs = 0;
 int lastStoppedJobId = -1;
+int completedJobs = 0, lastCompletedId = -1, lastCompletedStatus = 0, lastStatus = 0;
+pid_t lastBackgroundPid = 0;
+int readingInput = 0, interrupted = 0;
+int interactive = 1;
+int allowExit = 0, exitRequested = 0;
+toptions shellOptions, lineOptions;
+tlimits shellLimits, lineLimits;
+int lineTimed = 0;
+int lineCached = 0, lineCacheEnvCount = 0;
+long lineCacheTtl = 0;
+char ** lineCacheEnv = NULL;
+int lineInputFd = -1, readingHereDocument = 0;
+tinput * shellInput = NULL;
+tsession * servedSession = NULL;
+thistory history;
+char * expandedLine = NULL;
+teditor editor;
+tprompt prompt;
+struct timespec lineStarted;
+int typing = 0, editing = 0;
 
 // ==============================[ Main ]=============================
 int main(int argc, char * argv[]) {
     tline * line;
-    int i, allowExit = 0;
+    tinput input;
+    char * buffer;
     int selectedJob = -1;
-    char buffer[MAX_LINE];
+    int sigFd = -1, scriptFd, i;
+    long long traceStart;
+
+    // Initialize variables (they become the environment), jobs (slots are
+    // allocated on demand) and the line arena
+    initVariables();
+    initJobStore(jobs);
+    initArena(&lineArena);
+    initEventLoop();
+    initOptions(&shellOptions);
+    initLimits(&shellLimits);
+    initPrompt(&prompt);
+
+    // There is no history until initHistory opens the file
+    history.logFd = -1;
+    history.indexFd = -1;
+
+    // Register the builtins
+    registerBuiltin("cd", cdCommand, 0);
+    registerBuiltin("exit", exitCommand, 0);
+    registerBuiltin("jobs", jobsCommand, 0);
+    registerBuiltin("umask", umaskCommand, 0);
+    registerBuiltin("bg", bgCommand, 0);
+    registerBuiltin("hash", hashCommand, 0);
+    registerBuiltin("wait", waitCommand, 0);
+    registerBuiltin("fg", fgCommand, 0);
+    registerBuiltin("set", setCommand, 0);
+    registerBuiltin("parallel", parallelCommand, 0);
+    registerBuiltin("history", historyCommand, 0);
+    registerBuiltin("export", exportCommand, 0);
+    registerBuiltin("unset", unsetCommand, 0);
+    registerBuiltin("ulimit", ulimitCommand, 0);
+    registerUtilityBuiltins();
+
+    // Server mode: lines come from the clients of a socket
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Usage: %s --serve socket\n", argv[0]);
+            exit(2);
+        }
 
-    // Initialize jobs
-    for (i = 0; i < MAX_COMMANDS; i++) {
-        jobs[i] = (tjob *) malloc(sizeof(tjob));
+        interactive = 0;
+        redirectFile("/dev/null", O_RDONLY, STDIN_FILENO);
 
-        // Check for malloc errors
-        if (jobs[i] == NULL) {
-            fprintf(stderr, "Error: malloc failed\n");
-            exit(EXIT_FAILURE);
+        return runServer(argv[2], serveLine, finishServedLine);
+    }
+
+    // Client mode: lines are run by a server (-c command or standard input)
+    if (argc > 1 && strcmp(argv[1], "--client") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Usage: %s --client socket [--capture] [-c command]\n", argv[0]);
+            exit(2);
         }
 
-        initializeJob(jobs[i]);
+        i = argc > 3 && strcmp(argv[3], "--capture") == 0 ? 4 : 3;
+
+        if (i + 1 < argc && strcmp(argv[i], "-c") == 0) initInputString(&input, argv[i + 1]);
+        else initInput(&input, STDIN_FILENO);
+
+        return runClient(argv[2], &input, i == 4);
     }
 
-    // Set signal handlers
-    signal(SIGINT, ctrlC);
-    signal(SIGTSTP, ctrlZ);
+    // Select the input: -c command, script file or the terminal
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Usage: %s [-c command | script]\n", argv[0]);
+            exit(2);
+        }
 
-    // Set signal handlers for child processes
-    signal(SIGCHLD, terminatedChildHandler);
-    
-    
-    // Clear screen at the beginning
-    system("clear");
+        initInputString(&input, argv[2]);
+        interactive = 0;
 
-    // Main loop
-    while (1) {
-        // Read line and tokenize
-        readLine(buffer, MAX_LINE);
-        line = tokenize(buffer);
+    } else if (argc > 1) {
+        scriptFd = open(argv[1], O_RDONLY | O_CLOEXEC);
 
-        // DEBUG
-        printDebugData(DEBUG_MODE, line);
+        if (scriptFd == -1) {
+            fprintf(stderr, "Error: %s: %s\n", argv[1], strerror(errno));
+            exit(127);
+        }
 
-        // Check for user input, errors or empty commands
-        selectedJob = isInputOk(line);
+        initInput(&input, scriptFd);
+        interactive = 0;
 
-        if (selectedJob == -1) {
-            fprintf(stderr, "Command Error: Command not found\n");
-            continue;
-        } else if (selectedJob == 0) {
-            continue;
+    } else {
+        initInput(&input, STDIN_FILENO);
+        interactive = 1;
+    }
+
+    shellInput = &input;
+
+    // Job control is only set up for interactive sessions
+    if (interactive == 1) {
+        // Block job control signals, they are read from a signalfd instead
+        sigemptyset(&shellMask);
+        sigaddset(&shellMask, SIGINT);
+        sigaddset(&shellMask, SIGTSTP);
+        sigaddset(&shellMask, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &shellMask, NULL);
+
+        sigFd = signalfd(-1, &shellMask, SFD_CLOEXEC | SFD_NONBLOCK);
+
+        if (sigFd == -1) {
+            fprintf(stderr, "Error: signalfd failed\n");
+            exit(EXIT_FAILURE);
         }
 
-        // Handle commands
-        if (selectedJob == 3) {
-            if (allowExit == 1) break;
+        // Watch signals and terminal input (input is only enabled when reading)
+        watchFd(sigFd, EPOLLIN, signalHandler, NULL);
+        watchFd(STDIN_FILENO, EPOLLONESHOT, inputHandler, &input);
+
+        // History is only kept for lines typed on a terminal, not for the
+        // ones piped to the shell
+        typing = isatty(STDIN_FILENO);
+        if (typing) initHistory();
+
+        // Lines typed on a terminal are edited in raw mode
+        editing = typing && isatty(STDOUT_FILENO);
+        if (editing) initEditor(&editor, STDIN_FILENO, STDOUT_FILENO, &history);
 
-            // If there are stopped jobs, warn the user
-            if (stoppedJobs > 0) {
-                fprintf(stdout, "There are stopped jobs.\n");
-                allowExit = 1;
-            } else break;
+        // Clear screen at the beginning, without starting a helper process
+        if (isatty(STDOUT_FILENO)) writeAll(STDOUT_FILENO, CLEAR_SCREEN, strlen(CLEAR_SCREEN));
+    }
+
+    // Main loop
+    while (1) {
+        // Read line and tokenize (exit at end of input)
+        traceStart = traceClock();
+        buffer = readLine(&input);
+        traceSpan("read line", NULL, traceStart, 0, NULL, 0);
+        if (buffer == NULL) break;
+
+        clock_gettime(CLOCK_MONOTONIC, &lineStarted);
+
+        // Expand !n and !prefix and keep the line in the history
+        if (typing) {
+            buffer = expandHistory(buffer);
+
+            if (buffer == NULL) {
+                lastStatus = 1;
+                continue;
+            }
+
+            addHistory(&history, buffer);
         }
 
+        // Parse, expand and check the line (lines that end there set $?)
+        line = prepareLine(&buffer, &input, &selectedJob);
+        if (line == NULL) continue;
+
         // Execute command
+        if (selectedJob == 1 && lineCached == 1 && line->background == 0) cachedCommand(line, buffer);
         else if (selectedJob == 1) externalCommand(line, buffer);
-        else if (selectedJob == 2) changeDirectory(line->commands[0].argv[1]);
-        else if (selectedJob == 4) jobsCommand(line);
-        else if (selectedJob == 5) umaskCommand(line);
-        else if (selectedJob == 6) bgCommand(line->commands[0].argv[1]);
+        else lastStatus = runBuiltin(line);
+
+        if (exitRequested == 1) break;
     }
 
     // Free memory
-    for (i = 0; i < MAX_COMMANDS; i++) {
-        free(jobs[i]->pids);
-        free(jobs[i]->pipes);
-        free(jobs[i]->command);
-        free(jobs[i]);
+    freeCaptures(jobs);
+    freeJobStore(jobs);
+    freeInput(&input);
+    freeArena(&lineArena);
+    if (editing) freeEditor(&editor);
+    closeHistory(&history);
+    free(expandedLine);
+    if (sigFd != -1) close(sigFd);
+    stopTrace();
+
+    return lastStatus;
+}
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Opens the history file: $HISTFILE or ~/.msh_history. Without it the
+ * shell runs without history.
+ */
+void initHistory() {
+    char * path = getVariable("HISTFILE"), * home = getVariable("HOME");
+    char defaultPath[4096];
+
+    if (path == NULL && home != NULL) {
+        snprintf(defaultPath, sizeof(defaultPath), "%s/.msh_history", home);
+        path = defaultPath;
+    }
+
+    if (path == NULL || openHistory(&history, path) == -1) closeHistory(&history);
+}
+
+/**
+ * Expands a history reference at the start of a line: !! (last entry),
+ * !n (n-th entry), !-n (n-th entry from the end) or !prefix (newest entry
+ * starting with prefix). The rest of the line is kept after the entry.
+ * 
+ * @param line Line as read
+ * @return The line to run (the same one if there is nothing to expand),
+ *         NULL if the entry does not exist
+ */
+char * expandHistory(char * line) {
+    char * start = line, * end, * entry, * designator;
+    size_t n = 0, length, count;
+
+    while (*start == ' ' || *start == '\t') start++;
+    if (start[0] != '!' || start[1] == '\0' || isspace((unsigned char) start[1]) || start[1] == '=') return line;
+
+    // The designator goes up to the first blank
+    for (end = start + 1; *end != '\0' && !isspace((unsigned char) *end); end++);
+
+    designator = strndup(start + 1, end - start - 1);
+    count = historyCount(&history);
+
+    if (strcmp(designator, "!") == 0) n = count;
+    else if (designator[0] == '-' && isdigit((unsigned char) designator[1])) {
+        n = (size_t) atol(designator + 1) <= count ? count - atol(designator + 1) + 1 : 0;
+    }
+    else if (isdigit((unsigned char) designator[0])) n = atol(designator);
+    else n = findHistoryPrefix(&history, designator);
+
+    entry = historyEntry(&history, n, &length);
+
+    if (entry == NULL) {
+        fprintf(stderr, "msh: !%s: event not found\n", designator);
+        free(designator);
+        return NULL;
+    }
+
+    free(designator);
+
+    // Entry and rest of the line
+    expandedLine = (char *) realloc(expandedLine, length + strlen(end) + 2);
+
+    // Check for malloc errors
+    if (expandedLine == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(expandedLine, entry, length);
+    strcpy(expandedLine + length, end);
+
+    // Show the line that runs, like other shells do
+    fprintf(stdout, "%s", expandedLine);
+
+    return expandedLine;
+}
+
+/**
+ * Takes a line through the steps before it runs, the same for the lines of
+ * the shell and of server sessions: parsing, variable expansion,
+ * here-documents, assignments, the line prefixes and the command check.
+ * Lines that end in one of them set lastStatus.
+ * 
+ * @param text Line as read (a copy replaces it when a here-document body
+ *             follows it in the input)
+ * @param input Input the here-document bodies are read from (NULL if the
+ *              line has none)
+ * @param kind 1 if the line runs as a job, 2 if it is a builtin that runs in
+ *             the shell process
+ * @return The line to run, NULL if it is done
+ */
+tline * prepareLine(char ** text, tinput * input, int * kind) {
+    long long traceStart = traceClock();
+    tline * line;
+
+    // Every allocation of the previous line is released at once
+    closeHereInput();
+    trimArena(&lineArena, LINE_ARENA_KEEP);
+    line = parseLine(&lineArena, *text, resolveCommand);
+    traceSpan("tokenize", NULL, traceStart, 0, NULL, 0);
+
+    // Skip lines with syntax errors
+    if (line == NULL) {
+        lastStatus = 2;
+        return NULL;
+    }
+
+    // Expand variables, lines of NAME=value words only set them
+    expandLine(&lineArena, line);
+
+    // The body of a here-document follows the line, which is kept apart
+    if (line->here_document != NULL) *text = arenaStrdup(&lineArena, *text);
+
+    if (openHereInput(line, input) == -1) {
+        lastStatus = 1;
+        return NULL;
+    }
+
+    if (assignVariables(line) == 1) {
+        lastStatus = 0;
+        return NULL;
+    }
+
+    // Apply the "time" and "set ... --" prefixes to this line only
+    if (applyLinePrefixes(line) == -1) {
+        lastStatus = 2;
+        return NULL;
+    }
+
+    // DEBUG
+    printDebugData(DEBUG_MODE, line);
+
+    // Check for user input, errors or empty commands
+    *kind = isInputOk(line);
+
+    if (*kind == -1) {
+        fprintf(stderr, "Command Error: Command not found\n");
+        lastStatus = 127;
+        return NULL;
+    }
+
+    return *kind == 0 ? NULL : line;
+}
+
+/**
+ * Runs a line of a server session in the directory, file mode mask and job
+ * table of the session. A foreground job goes on after it returns, the
+ * server sends its status once it is done.
+ * 
+ * @param session Session the line comes from
+ * @param text Command line
+ * @return Exit status, SESSION_RUNNING if session->job runs the line
+ */
+int serveLine(tsession * session, char * text) {
+    int saved[2], output = -1, selected, status;
+    tline * line;
+    tjob * job;
+
+    // Switch to the state of the session
+    servedSession = session;
+    jobs = &session->jobs;
+    lastStatus = session->lastStatus;
+    umask(session->mask);
+
+    if (fchdir(session->cwdFd) == -1) fprintf(stderr, "Error: session directory: %s\n", strerror(errno));
+
+    // Errors and builtin output are sent to the client too
+    if (session->capture) output = startCapture(saved);
+
+    // Sessions have no input of their own to read here-documents from
+    line = prepareLine(&text, NULL, &selected);
+
+    if (line == NULL) {
+        status = lastStatus;
+    } else if (lineCached == 1) {
+        // Session jobs finish after the line returns, there is no run to store
+        fprintf(stderr, "cache: not supported in server sessions\n");
+        status = 2;
+    } else if (selected == 2) {
+        status = runBuiltin(line);
+
+        // exit ends the session, not the server
+        if (exitRequested == 1) {
+            exitRequested = 0;
+            session->closing = 1;
+        }
+    } else {
+        job = addJob(jobs, line, text);
+        if (line->background == 1) fprintf(stdout, "[%d] %d\n", jobs->size, job->id);
+
+        // The output of the job is streamed through a pipe instead
+        if (output != -1) endCapture(session, output, saved);
+        output = -1;
+
+        status = serveJob(session, job);
+    }
+
+    if (output != -1) endCapture(session, output, saved);
+
+    // Keep the directory and mask the line left
+    if (session->cwdFd != -1) close(session->cwdFd);
+    session->cwdFd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    session->mask = umask(0);
+    umask(session->mask);
+
+    jobs = &shellJobs;
+    servedSession = NULL;
+
+    return status;
+}
+
+/**
+ * Launches the job of a session line. With capture on, the output of a
+ * foreground job goes to a pipe watched by the server.
+ * 
+ * @param session Session the job belongs to
+ * @param job Job to launch
+ * @return 0 for background jobs, SESSION_RUNNING for foreground jobs
+ */
+int serveJob(tsession * session, tjob * job) {
+    int fds[2] = {-1, -1};
+
+    job->inputFd = lineInputFd;
+    job->timed = lineTimed;
+
+    if (session->capture && job->background == 0) {
+        if (pipe2(fds, O_CLOEXEC) == -1) {
+            fprintf(stderr, "Error: pipe failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        job->captureFd = fds[1];
+    }
+
+    // Foreground jobs are removed by the server once their status is sent
+    job->owned = job->background == 0;
+
+    fflush(stdout);
+    launchJob(job);
+
+    if (fds[1] != -1) {
+        close(fds[1]);
+        job->captureFd = -1;
+        watchSessionOutput(session, fds[0]);
+    }
+
+    if (job->background == 0) {
+        session->job = job;
+        return SESSION_RUNNING;
     }
 
+    if (job->alive == 0) removeJob(jobs, job);
+
     return 0;
 }
 
-// ===========================[ Functions ]===========================
+/**
+ * Finishes a line of a session whose job is done, before its status is
+ * sent: the time prefix reports the job like for the lines of the shell
+ * 
+ * @param session Session of the line
+ * @param job Finished job
+ */
+void finishServedLine(tsession * session, tjob * job) {
+    int saved[2], output = -1;
+
+    if (job->timed == 0) return;
+
+    if (session->capture) output = startCapture(saved);
+    printJobTimes(job);
+    if (output != -1) endCapture(session, output, saved);
+}
+
+/**
+ * Runs the wait builtin of a session. The jobs it waits for are marked as
+ * owned, so they keep their status once reaped, and the server ends the
+ * line when they are done.
+ * 
+ * @param session Session running the line
+ * @param command Wait command
+ * @param fds Standard input, output and error
+ * @return Exit status if there is nothing to wait for, SESSION_RUNNING otherwise
+ */
+int serveWait(tsession * session, tcommand * command, int fds[3]) {
+    tjob * job, * last = NULL;
+    int i, next = 0, waited = 0, status = 0;
+
+    for (i = 1; i < command->argc; i++) {
+        if (strcmp(command->argv[i], "-n") == 0) {
+            next = 1;
+            continue;
+        }
+
+        waited = 1;
+        job = getJobByPosition(jobs, atoi(command->argv[i]));
+
+        if (job == NULL) {
+            dprintf(fds[2], "wait: %s: no such job\n", command->argv[i]);
+            status = 127;
+            last = NULL;
+            continue;
+        }
+
+        // Stopped jobs are not waited for
+        if (job->status != 1) continue;
+
+        job->owned = 1;
+        last = job;
+    }
+
+    if (waited == 1) return waitSessionJobs(session, SESSION_WAIT_ALL, last, status);
+
+    // Every running background job of the session
+    for (job = jobs->head; job != NULL; job = job->next) {
+        if (job->background == 1 && job->status == 1) job->owned = 1;
+    }
+
+    return waitSessionJobs(session, next == 1 ? SESSION_WAIT_NEXT : SESSION_WAIT_ALL, NULL, 0);
+}
+
+/**
+ * Sends the standard output and error of the shell to a memfd
+ * 
+ * @param saved Where the original descriptors are kept
+ * @return The memfd
+ */
+int startCapture(int saved[2]) {
+    int fd = memfd_create("msh-output", MFD_CLOEXEC);
+
+    if (fd == -1) {
+        fprintf(stderr, "Error: memfd_create failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    saved[0] = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+    saved[1] = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+
+    return fd;
+}
+
+/**
+ * Restores the standard output and error of the shell and sends what was
+ * captured to the client of a session
+ * 
+ * @param session Session to send to
+ * @param fd Memfd returned by startCapture
+ * @param saved Original descriptors
+ */
+void endCapture(tsession * session, int fd, int saved[2]) {
+    fflush(stdout);
+    fflush(stderr);
+
+    dup2(saved[0], STDOUT_FILENO);
+    dup2(saved[1], STDERR_FILENO);
+    close(saved[0]);
+    close(saved[1]);
+
+    sendSessionFile(session, fd);
+    close(fd);
+}
+
+/**
+ * Expands the variables in the words and redirections of a line, then the
+ * wildcards of the words (patterns without matches are kept as they are).
+ * Commands whose name changed are resolved again and words that expand to
+ * nothing are dropped.
+ * 
+ * @param arena Arena of the line
+ * @param line Parsed line
+ */
+void expandLine(tarena * arena, tline * line) {
+    tcommand * command;
+    twordlist argv;
+    char * word, * expanded;
+    int i, j;
+
+    if (line->redirect_input != NULL) line->redirect_input = expandWord(arena, line->redirect_input, lastStatus, lastBackgroundPid);
+    if (line->here_string != NULL) line->here_string = expandWord(arena, line->here_string, lastStatus, lastBackgroundPid);
+    if (line->redirect_output != NULL) line->redirect_output = expandWord(arena, line->redirect_output, lastStatus, lastBackgroundPid);
+    if (line->redirect_error != NULL) line->redirect_error = expandWord(arena, line->redirect_error, lastStatus, lastBackgroundPid);
+
+    for (i = 0; i < line->ncommands; i++) {
+        command = &line->commands[i];
+        word = command->argv[0];
+
+        // Plain commands keep the parser's array
+        for (j = 0; j < command->argc && strpbrk(command->argv[j], "$*?[") == NULL; j++);
+        if (j == command->argc) continue;
+
+        initWordList(arena, &argv, command->argc);
+
+        for (j = 0; j < command->argc; j++) {
+            expanded = expandWord(arena, command->argv[j], lastStatus, lastBackgroundPid);
+
+            if (expanded[0] == '\0') continue;
+            if (!hasGlob(expanded) || expandGlob(arena, expanded, &argv) == 0) addWord(arena, &argv, expanded);
+        }
+
+        // A line of empty words is an empty line, an empty pipeline stage is not found
+        if (argv.count == 0 && line->ncommands == 1) {
+            line->ncommands = 0;
+            return;
+        }
+
+        if (argv.count == 0) addWord(arena, &argv, "");
+
+        command->argv = argv.words;
+        command->argc = argv.count;
+
+        if (command->argv[0] != word) command->filename = resolveCommand(arena, command->argv[0]);
+    }
+}
+
+/**
+ * Sets the variables of a line made only of NAME=value words
+ * 
+ * @param line Parsed (and expanded) line
+ * @return 1 if the line was an assignment, 0 otherwise
+ */
+int assignVariables(tline * line) {
+    tcommand * command = line->commands;
+    char * equals;
+    int i;
+
+    if (line->ncommands != 1 || line->background == 1) return 0;
+
+    for (i = 0; i < command->argc; i++) {
+        equals = strchr(command->argv[i], '=');
+        if (equals == NULL || !isVariableName(command->argv[i], equals - command->argv[i])) return 0;
+    }
+
+    for (i = 0; i < command->argc; i++) {
+        equals = strchr(command->argv[i], '=');
+        *equals = '\0';
+
+        setVariable(command->argv[i], equals + 1, 0);
+        variableChanged(command->argv[i]);
+    }
+
+    return 1;
+}
+
+/**
+ * Drops what depends on the value of a variable: the command cache for
+ * PATH (the completion index notices the change itself) and the prompt
+ * segments that show HOME and USER
+ * 
+ * @param name Variable that changed
+ */
+void variableChanged(char * name) {
+    if (strcmp(name, "PATH") == 0) clearCommandCache();
+    else if (strcmp(name, "HOME") == 0) invalidatePrompt(&prompt, SEGMENT_CWD);
+    else if (strcmp(name, "USER") == 0 || strcmp(name, "LOGNAME") == 0) invalidatePrompt(&prompt, SEGMENT_USER);
+}
 
 /**
  * Prints debug data from a parsed line when DEBUG_MODE is enabled
@@ -187,454 +828,1907 @@ void printDebugData(int mode, tline * line) {
         }
     }
 
-    fprintf(stdout, "--------------------\n\n");
+    fprintf(stdout, "--------------------\n\n");
+}
+
+/**
+ * Prints the custom prompt
+ */
+void printPrompt() {
+    fprintf(stdout, "%s", promptText());
+    fflush(stdout);
+}
+
+/**
+ * Renders the prompt with the status, job count and duration of the last
+ * line
+ * 
+ * @return Prompt, valid until the next call
+ */
+char * promptText() {
+    struct timespec now;
+
+    // Lines of a here-document get a continuation prompt
+    if (readingHereDocument) return HERE_DOCUMENT_PROMPT;
+
+    // Only the segments whose input changed are formatted again
+    setPromptStatus(&prompt, lastStatus);
+    setPromptJobs(&prompt, jobs->size);
+
+    if (lineStarted.tv_sec != 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        setPromptDuration(&prompt, elapsedSeconds(&lineStarted, &now));
+    }
+
+    return renderPrompt(&prompt);
+}
+
+/**
+ * Reads a line from the standard input, running the event loop
+ * (job reaping, signals) while waiting for it
+ * 
+ * @param input Reader of the standard input
+ * @return Line read, NULL at end of input
+ */
+char * readLine(tinput * input) {
+    char * line;
+    int pollable;
+
+    if (editing) return editLine(input);
+    if (interactive == 1) printPrompt();
+
+    // Write the trace while the shell is idle
+    flushTrace();
+
+    // Regular files can not be polled, they are read directly
+    pollable = modifyFd(input->fd, EPOLLIN) == 0;
+    readingInput = 1;
+
+    while ((line = nextLine(input)) == NULL && input->eof == 0) {
+        if (pollable) runEvents(-1);
+        else fillInput(input);
+    }
+
+    readingInput = 0;
+
+    // Hang-ups are reported even without events, only take the first one
+    if (pollable) modifyFd(input->fd, EPOLLONESHOT);
+
+    // Handle pending events (e.g. reap background jobs) before running the line
+    if (jobs->size > 0) runEvents(0);
+
+    return line;
+}
+
+/**
+ * Reads a line from the terminal with the line editor, running the event
+ * loop while waiting for keys
+ * 
+ * @param input Reader of the standard input
+ * @return Line read, NULL at end of input
+ */
+char * editLine(tinput * input) {
+    int result = EDIT_MORE;
+    size_t used;
+
+    fflush(stdout);
+    flushTrace();
+
+    startEditing(&editor, promptText());
+    modifyFd(input->fd, EPOLLIN);
+    readingInput = 1;
+
+    while (result == EDIT_MORE) {
+        result = feedEditor(&editor, input->buffer + input->start, input->end - input->start, &used);
+        input->start += used;
+
+        if (result != EDIT_MORE) break;
+        if (input->eof) result = EDIT_EOF;
+        else runEvents(-1);
+    }
+
+    readingInput = 0;
+    modifyFd(input->fd, EPOLLONESHOT);
+    stopEditing(&editor);
+
+    if (jobs->size > 0) runEvents(0);
+
+    return result == EDIT_DONE ? editedLine(&editor) : NULL;
+}
+
+/**
+ * Redirects input and output for a given job
+ * 
+ * @param job Job to redirect
+ * @param i Index of the command
+ */
+void redirectIO(tjob * job, int i) {
+    int j;
+    tline * line = job->line;
+
+    // Redirect input from previous pipe, here-document or file
+    if (i > 0) {
+        dup2(job->pipes[i - 1][0], STDIN_FILENO);
+    } else if (job->inputFd != -1) {
+        dup2(job->inputFd, STDIN_FILENO);
+    } else if (line->redirect_input != NULL) {
+        redirectFile(line->redirect_input, O_RDONLY, STDIN_FILENO);
+    }
+
+    // Redirect output to next pipe or file
+    if (i < line->ncommands - 1) {
+        dup2(job->pipes[i][1], STDOUT_FILENO);
+    } else if (line->redirect_output != NULL) {
+        redirectFile(line->redirect_output, O_WRONLY | O_CREAT | O_TRUNC, STDOUT_FILENO);
+    } else if (job->captureFd != -1) {
+        dup2(job->captureFd, STDOUT_FILENO);
+    }
+
+    // Redirect error to file
+    if (line->redirect_error != NULL) {
+        redirectFile(line->redirect_error, O_WRONLY | O_CREAT | O_TRUNC, STDERR_FILENO);
+    } else if (job->captureFd != -1) {
+        dup2(job->captureFd, STDERR_FILENO);
+    }
+
+    // Close all pipe file descriptors
+    for (j = 0; j < line->ncommands - 1; j++) {
+        close(job->pipes[j][0]);
+        close(job->pipes[j][1]);
+    }
+}
+
+/**
+ * Opens a file onto a standard descriptor of a forked child. The opened
+ * descriptor is close-on-exec, only the dup2 copy survives the exec. On
+ * failure the child leaves with _exit, the shell's stdio buffers it
+ * inherited are not flushed a second time.
+ * 
+ * @param file File to open
+ * @param flags Open flags
+ * @param target Descriptor to replace
+ */
+void redirectFile(char * file, int flags, int target) {
+    int fd = open(file, flags | O_CLOEXEC, 0666);
+
+    if (fd == -1 || dup2(fd, target) == -1) {
+        fprintf(stderr, "Error: %s: %s\n", file, strerror(errno));
+        _exit(1);
+    }
+
+    close(fd);
+}
+
+/**
+ * Checks if the parsed line is correct
+ * 
+ * @param line Parsed line to check
+ * @return 1 if the line runs as a job, 2 if it is a builtin that runs in the
+ *         shell process, 0 if there are no commands, -1 if there's an error
+ */
+int isInputOk(tline * line) {
+    tbuiltin * builtin;
+    int i;
+
+    if (line->ncommands == 0) {
+        return 0;
+    }
+
+    // Builtins run in the shell unless they are part of a pipeline or a
+    // background job (only those that do not need the shell state can).
+    // SIGINT is blocked in an interactive shell and a server runs the lines
+    // of every session, so there the ones that copy streams run as jobs.
+    builtin = findBuiltin(line->commands[0].argv[0]);
+
+    if (line->ncommands == 1 && builtin != NULL) {
+        if ((builtin->flags & BUILTIN_PIPELINE) == 0) return 2;
+        if (line->background == 0 && ((builtin->flags & BUILTIN_STREAM) == 0 || (interactive == 0 && servedSession == NULL))) return 2;
+    }
+
+    // Handle external commands
+    for (i = 0; i < line->ncommands; i++) {
+        builtin = findBuiltin(line->commands[i].argv[0]);
+
+        if (builtin != NULL && (builtin->flags & BUILTIN_PIPELINE) != 0) continue;
+
+        if (line->commands[i].filename == NULL) {
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Runs a builtin in the shell process
+ * 
+ * @param line Parsed line with a single builtin command
+ * @return Exit status of the builtin
+ */
+int runBuiltin(tline * line) {
+    tbuiltin * builtin = findBuiltin(line->commands[0].argv[0]);
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    int i, status;
+    long long traceStart = traceClock();
+    struct timespec started, finished;
+    struct rusage before, after;
+
+    // Keep the order of the shell's buffered output
+    fflush(stdout);
+
+    // Builtins use the redirections through fds, the shell's own are kept
+    if (openRedirections(line, fds) == -1) return 1;
+
+    if (lineTimed) {
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        getrusage(RUSAGE_SELF, &before);
+    }
+
+    status = builtin->function(line->commands, line, fds);
+    traceSpan("builtin", builtin->name, traceStart, 0, "status", status);
+
+    // The time prefix reports the shell's own usage while the builtin ran
+    if (lineTimed) {
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        getrusage(RUSAGE_SELF, &after);
+
+        printTime("real", elapsedSeconds(&started, &finished));
+        printTime("user", timevalSeconds(&after.ru_utime) - timevalSeconds(&before.ru_utime));
+        printTime("sys", timevalSeconds(&after.ru_stime) - timevalSeconds(&before.ru_stime));
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (fds[i] != i) close(fds[i]);
+    }
+
+    return status;
+}
+
+/**
+ * Opens the redirection files of a line for a builtin run in the shell
+ * 
+ * @param line Parsed line
+ * @param fds Standard input, output and error, replaced by the open files
+ * @return 0 if successful, -1 if a file could not be opened
+ */
+int openRedirections(tline * line, int fds[3]) {
+    char * files[3] = {line->redirect_input, line->redirect_output, line->redirect_error};
+    int flags[3] = {O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC, O_WRONLY | O_CREAT | O_TRUNC};
+    int i, j;
+
+    // A copy of the here-document, the caller closes it like the files
+    if (lineInputFd != -1 && files[0] == NULL) fds[0] = fcntl(lineInputFd, F_DUPFD_CLOEXEC, 3);
+
+    for (i = 0; i < 3; i++) {
+        if (files[i] == NULL) continue;
+
+        fds[i] = open(files[i], flags[i] | O_CLOEXEC, 0666);
+
+        if (fds[i] == -1) {
+            fprintf(stderr, "Error: %s: %s\n", files[i], strerror(errno));
+
+            for (j = 0; j < i; j++) {
+                if (fds[j] != j) close(fds[j]);
+            }
+
+            fds[i] = i;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Handles the "time", "set name=value... --", "cache [options] --" and
+ * "limit [options] --" prefixes of a line. The options only apply to the rest of the line,
+ * which is run as if the prefixes were not there.
+ * 
+ * @param line Parsed line, its first command is shifted past the prefixes
+ * @return 0 if successful, -1 if an option is not valid
+ */
+int applyLinePrefixes(tline * line) {
+    tcommand * command = line->commands;
+    int i, end, shifted = 0;
+
+    lineOptions = shellOptions;
+    lineLimits = shellLimits;
+    lineTimed = 0;
+    lineCached = 0;
+    lineCacheTtl = 0;
+    lineCacheEnvCount = 0;
+
+    if (line->ncommands == 0) return 0;
+
+    while (1) {
+        end = -1;
+
+        if (strcmp(command->argv[0], "time") == 0 && command->argc > 1) {
+            lineTimed = 1;
+            end = 0;
+
+        } else if (strcmp(command->argv[0], "set") == 0) {
+            for (i = 1; i < command->argc && end == -1; i++) {
+                if (strcmp(command->argv[i], "--") == 0) end = i;
+            }
+
+            // Plain set changes the shell options
+            if (end == -1) break;
+
+            for (i = 1; i < end; i++) {
+                if (setOption(&lineOptions, command->argv[i]) == -1) {
+                    fprintf(stderr, "set: %s: invalid option\n", command->argv[i]);
+                    return -1;
+                }
+            }
+
+            if (end + 1 >= command->argc) {
+                fprintf(stderr, "set: missing command after --\n");
+                return -1;
+            }
+
+        } else if (strcmp(command->argv[0], "cache") == 0) {
+            for (i = 1; i < command->argc && end == -1; i++) {
+                if (strcmp(command->argv[i], "--") == 0) end = i;
+            }
+
+            if (end == -1 || end + 1 >= command->argc) {
+                fprintf(stderr, "cache: usage: cache [--ttl seconds] [--env name]... -- pipeline\n");
+                return -1;
+            }
+
+            lineCached = 1;
+            lineCacheEnv = (char **) arenaAlloc(&lineArena, sizeof(char *) * end);
+
+            for (i = 1; i < end; i++) {
+                if (strcmp(command->argv[i], "--ttl") == 0 && i + 1 < end) {
+                    lineCacheTtl = atol(command->argv[++i]);
+                } else if (strcmp(command->argv[i], "--env") == 0 && i + 1 < end) {
+                    lineCacheEnv[lineCacheEnvCount++] = command->argv[++i];
+                } else {
+                    fprintf(stderr, "cache: %s: invalid option\n", command->argv[i]);
+                    return -1;
+                }
+            }
+
+        } else if (strcmp(command->argv[0], "limit") == 0) {
+            for (i = 1; i < command->argc && end == -1; i++) {
+                if (strcmp(command->argv[i], "--") == 0) end = i;
+            }
+
+            if (end == -1 || end + 1 >= command->argc) {
+                fprintf(stderr, "limit: usage: limit [--cpu cpus] [--mem bytes[K|M|G]] -- pipeline\n");
+                return -1;
+            }
+
+            for (i = 1; i < end; i++) {
+                if (strcmp(command->argv[i], "--cpu") == 0 && i + 1 < end && parseCpus(command->argv[i + 1], &lineLimits.cpus) == 0) {
+                    i++;
+                } else if (strcmp(command->argv[i], "--mem") == 0 && i + 1 < end && parseSize(command->argv[i + 1], &lineLimits.memory) == 0) {
+                    i++;
+                } else {
+                    fprintf(stderr, "limit: %s: invalid option\n", command->argv[i]);
+                    return -1;
+                }
+            }
+
+        } else break;
+
+        command->argv += end + 1;
+        command->argc -= end + 1;
+        shifted = 1;
+    }
+
+    if (shifted) command->filename = resolveCommand(&lineArena, command->argv[0]);
+
+    return 0;
+}
+
+/**
+ * Creates the standard input of a line with a here-document (<<word: the
+ * lines that follow, up to one that is just word) or a here-string
+ * (<<<word: the expanded word and a newline). The data goes to a sealed
+ * memfd, so nothing touches the disk and no process has to feed it; the
+ * first stage gets the memfd as its standard input.
+ * 
+ * @param line Parsed line
+ * @param input Reader the body is read from (NULL if lines come from elsewhere)
+ * @return 0 if successful (or nothing to do), -1 if failed
+ */
+int openHereInput(tline * line, tinput * input) {
+    char chunk[HERE_DOCUMENT_CHUNK], * text;
+    size_t used = 0, length, delimiterLength;
+    int fd, res = 0;
+
+    if (line->here_document == NULL && line->here_string == NULL) return 0;
+
+    if (line->here_document != NULL && input == NULL) {
+        fprintf(stderr, "Error: here-documents need the shell's own input\n");
+        return -1;
+    }
+
+    fd = memfd_create("msh-here", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    if (fd == -1) {
+        fprintf(stderr, "Error: memfd_create failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (line->here_string != NULL) {
+        length = strlen(line->here_string);
+        res = writeAll(fd, line->here_string, length);
+        if (res == 0) res = writeAll(fd, "\n", 1);
+    } else {
+        delimiterLength = strlen(line->here_document);
+        readingHereDocument = 1;
+
+        // Lines are gathered in chunks, a multi-MB body takes few writes.
+        // Buffered lines are taken directly, readLine only waits for more.
+        while (1) {
+            if (editing || (text = nextLine(input)) == NULL) text = readLine(input);
+            if (text == NULL) break;
+
+            length = strlen(text);
+
+            if (length == delimiterLength + 1 && strncmp(text, line->here_document, delimiterLength) == 0) break;
+
+            if (used + length > sizeof(chunk)) {
+                if (writeAll(fd, chunk, used) == -1) res = -1;
+                used = 0;
+            }
+
+            if (length > sizeof(chunk)) {
+                if (writeAll(fd, text, length) == -1) res = -1;
+            } else {
+                memcpy(chunk + used, text, length);
+                used += length;
+            }
+        }
+
+        readingHereDocument = 0;
+
+        if (text == NULL) fprintf(stderr, "msh: here-document ended by end of input (wanted '%s')\n", line->here_document);
+        if (used > 0 && writeAll(fd, chunk, used) == -1) res = -1;
+    }
+
+    // Nothing can change the contents from now on
+    if (res == 0 && fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) res = -1;
+    if (res == 0 && lseek(fd, 0, SEEK_SET) == -1) res = -1;
+
+    if (res == -1) {
+        fprintf(stderr, "Error: here-document: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    lineInputFd = fd;
+
+    return 0;
+}
+
+/**
+ * Closes the here-document of the previous line, the jobs that read it
+ * have their own copy
+ */
+void closeHereInput() {
+    if (lineInputFd == -1) return;
+
+    close(lineInputFd);
+    lineInputFd = -1;
+}
+
+/**
+ * Pins a pipeline stage to a CPU of the shell's affinity mask. Compact
+ * placement puts consecutive stages on consecutive CPUs so they share
+ * caches, spread placement spaces them evenly over the available CPUs.
+ * 
+ * @param pid PID of the stage
+ * @param i Index of the stage
+ * @param nstages Number of stages of the pipeline
+ */
+void placeStage(pid_t pid, int i, int nstages) {
+    cpu_set_t allowed, set;
+    int cpu, n, slot;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) return;
+
+    n = CPU_COUNT(&allowed);
+    if (n <= 1) return;
+
+    if (lineOptions.affinity == AFFINITY_COMPACT) slot = i % n;
+    else slot = nstages >= n ? i % n : i * n / nstages;
+
+    // Find the slot-th allowed CPU
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && slot-- == 0) break;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    // The stage may already be gone
+    if (sched_setaffinity(pid, sizeof(set), &set) == -1 && errno != ESRCH) {
+        fprintf(stderr, "Error: sched_setaffinity failed: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * Executes the cd command
+ * 
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return 0 if successful, 1 if failed
+ */
+int cdCommand(tcommand * command, tline * line, int fds[3]) {
+    if (changeDirectory(command->argv[1]) == 0) return 0;
+
+    dprintf(fds[2], "Error: Directory not found\n");
+    return 1;
+}
+
+/**
+ * Executes the exit command. If there are stopped jobs the user is
+ * warned once and the shell keeps running.
+ * 
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return Exit status of the shell
+ */
+int exitCommand(tcommand * command, tline * line, int fds[3]) {
+    // If there are stopped jobs, warn the user
+    if (stoppedJobs > 0 && allowExit == 0) {
+        dprintf(fds[2], "There are stopped jobs.\n");
+        allowExit = 1;
+        return 1;
+    }
+
+    exitRequested = 1;
+    return lastStatus;
+}
+
+/**
+ * Changes the current working directory
+ * 
+ * @param path Path to change to (NULL for home directory)
+ * @return 0 if successful, -1 if failed
+ */
+int changeDirectory(char * path) {
+    int res;
+    char * dir;
+
+    if (path == NULL) {
+        dir = getVariable("HOME");
+    } else {
+        dir = path;
+    }
+
+    res = chdir(dir);
+
+    if (res == 0) invalidatePrompt(&prompt, SEGMENT_CWD);
+
+    return res;
+}
+
+/**
+ * Executes the umask command
+ * 
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return 0 if successful, 1 if failed
+ */
+int umaskCommand(tcommand * command, tline * line, int fds[3]) {
+    mode_t mode;
+    char buffer[16];
+    char * mask = NULL;
+    ssize_t n;
+
+    // Get mask if provided in the command
+    if (command->argc > 1) {
+        mask = command->argv[1];
+    }
+
+    // Get mask from stdin if not provided
+    if (mask == NULL && fds[0] != STDIN_FILENO) {
+        n = read(fds[0], buffer, sizeof(buffer) - 1);
+
+        if (n > 0) {
+            buffer[n] = '\0';
+            mask = buffer;
+        }
+    }
+
+    // Output current mask if no mask is provided
+    if (mask == NULL) {
+        mode = umask(0);
+        umask(mode);
+        dprintf(fds[1], "%04o\n", mode);
+    // Set new mask if provided
+    } else {
+        mode = strtol(mask, NULL, 8);
+        umask(mode);
+    }
+
+    return 0;
+}
+
+/**
+ * Executes the jobs command. With -l every stage is listed with its CPU
+ * time, peak memory, context switches and wall time (live for running
+ * stages, final for the ones already reaped). With -o N it prints the
+ * last N lines kept of every job started with &capture (or of one job id).
+ * 
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return 0 if successful, 1 if nothing was captured, 2 on bad usage
+ */
+int jobsCommand(tcommand * command, tline * line, int fds[3]) {
+    tstagestats stats;
+    tjob * job;
+    int i, count = 0, details = 0, lines;
+    char * outputFormat;
+
+    // -o N [id] shows the last N lines of the jobs started with &capture
+    if (command->argc > 1 && strcmp(command->argv[1], "-o") == 0) {
+        lines = command->argc > 2 ? atoi(command->argv[2]) : 0;
+
+        if (lines <= 0 || command->argc > 4) {
+            dprintf(fds[2], "Usage: jobs -o lines [id]\n");
+            return 2;
+        }
+
+        if (printCaptures(jobs, fds[1], lines, command->argc > 3 ? atoi(command->argv[3]) : 0) == -1) {
+            dprintf(fds[2], "jobs: no captured output\n");
+            return 1;
+        }
+
+        return 0;
+    }
+
+    // -l shows the resource usage of every stage
+    if (command->argc > 1 && strcmp(command->argv[1], "-l") == 0) details = 1;
+
+    // Jobs are kept in id order
+    for (job = jobs->head; job != NULL; job = job->next) {
+        count++;
+
+        // Assign output format
+        if (job->status == 0) outputFormat = "Stopped";
+        else outputFormat = "Running";
+
+        dprintf(fds[1], "[%d]  %s\t\t %s", count, outputFormat, job->command);
+
+        for (i = 0; details && i < job->ncommands; i++) {
+            sampleStage(job, i, &stats);
+            printStageStats(fds[1], &stats, 1);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Executes the bg command
+ * 
+ * @param command Command to execute (argv[1] is the job id)
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return 0 if a job was resumed, 1 otherwise
+*/
+int bgCommand(tcommand * command, tline * line, int fds[3]) {
+    char * job_id = command->argv[1];
+    tjob * job;
+    int len;
+
+    // Without id, resume the last stopped job, otherwise the id-th listed job
+    if (job_id == NULL) job = findJobById(jobs, lastStoppedJobId);
+    else job = getJobByPosition(jobs, atoi(job_id));
+
+    // Return if the job was not found or is not stopped
+    if (job == NULL || job->status != 0) return 1;
+
+    // Update background jobs and stopped jobs count
+    bgJobs++;
+    stoppedJobs--;
+
+    // Set new status and background flag
+    job->status = 1;
+    job->background = 1;
+
+    // Send SIGCONT to all processes in the job's process group
+    killpg(job->pgid, SIGCONT);
+    traceInstant("continue", NULL, 0, "job", job->id);
+
+    // Add '&' to the command string
+    len = strlen(job->command);
+    reserveJobCommand(job, len + 3);
+    job->command[len - 1] = ' ';
+    job->command[len] = '&';
+    job->command[len + 1] = '\n';
+    job->command[len + 2] = '\0';
+
+    // Print message
+    dprintf(fds[1], "[%d]+ %s", job->id, job->command);
+
+    return 0;
+}
+
+/**
+ * Executes the hash command. Without arguments it lists the cached
+ * command locations, -r clears them (and the cached directory listings of
+ * the wildcards) and any other argument is cached.
+ * 
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return 0 if successful, 1 if a command was not found
+ */
+int hashCommand(tcommand * command, tline * line, int fds[3]) {
+    int i, status = 0;
+
+    if (command->argc == 1) {
+        printCommandCache(fds[1]);
+        return 0;
+    }
+
+    for (i = 1; i < command->argc; i++) {
+        if (strcmp(command->argv[i], "-r") == 0) {
+            clearCommandCache();
+            clearGlobCache();
+        } else if (lookupCommand(command->argv[i]) == NULL) {
+            dprintf(fds[2], "hash: %s: not found\n", command->argv[i]);
+            status = 1;
+        }
+    }
+
+    return status;
+}
+
+/**
+ * Executes the wait command. Without arguments it waits for every
+ * background job, -n waits for the next job to finish and an id waits
+ * for the id-th listed job.
+ * 
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return Exit status of the last job waited for
+ */
+int waitCommand(tcommand * command, tline * line, int fds[3]) {
+    tjob * job;
+    int i, id, completed;
+    int next = 0, waited = 0, status = 0;
+
+    // A session can not block the server, which finishes the wait itself
+    if (servedSession != NULL) return serveWait(servedSession, command, fds);
+
+    interrupted = 0;
+
+    for (i = 1; i < command->argc; i++) {
+        if (strcmp(command->argv[i], "-n") == 0) {
+            next = 1;
+            continue;
+        }
+
+        waited = 1;
+        job = getJobByPosition(jobs, atoi(command->argv[i]));
+
+        if (job == NULL) {
+            dprintf(fds[2], "wait: %s: no such job\n", command->argv[i]);
+            status = 127;
+            continue;
+        }
+
+        // Wait until the job is reaped (removed jobs get id -1) or stopped
+        id = job->id;
+        while (interrupted == 0 && job->id == id && job->status == 1) runEvents(-1);
+
+        if (lastCompletedId == id) status = lastCompletedStatus;
+    }
+
+    if (waited == 1) return status;
+
+    // Wait for the next job to finish or for every running job
+    completed = completedJobs;
+
+    while (interrupted == 0 && bgJobs > 0) {
+        if (next == 1 && completedJobs != completed) break;
+        runEvents(-1);
+    }
+
+    if (interrupted == 1) return 130;
+    return next == 1 ? lastCompletedStatus : 0;
+}
+
+/**
+ * Executes the fg command. Resumes the id-th listed job, or the last
+ * stopped job, in the foreground.
+ * 
+ * @param command Command to execute (argv[1] is the job id)
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return Exit status of the job
+ */
+int fgCommand(tcommand * command, tline * line, int fds[3]) {
+    char * job_id = command->argv[1];
+    tjob * job;
+    int len;
+
+    if (job_id != NULL) job = getJobByPosition(jobs, atoi(job_id));
+    else {
+        job = findJobById(jobs, lastStoppedJobId);
+        if (job == NULL) job = jobs->tail;
+    }
+
+    if (job == NULL) {
+        dprintf(fds[2], "fg: no such job\n");
+        return 1;
+    }
+
+    // Update background jobs and stopped jobs count (only the shell's are counted)
+    if (servedSession == NULL) {
+        if (job->status == 0) stoppedJobs--;
+        else if (job->background == 1) bgJobs--;
+    }
+
+    // Remove the '&' added by bg
+    len = strlen(job->command);
+    if (len >= 3 && strcmp(job->command + len - 3, " &\n") == 0) strcpy(job->command + len - 3, "\n");
+
+    // Print command and resume the job's process group
+    dprintf(fds[1], "%s", job->command);
+
+    job->status = 1;
+    job->background = 0;
+    killpg(job->pgid, SIGCONT);
+    traceInstant("continue", NULL, 0, "job", job->id);
+
+    // The job runs the line of a session like a foreground job, the server
+    // removes it once its status is sent
+    if (servedSession != NULL) {
+        job->owned = 1;
+        servedSession->job = job;
+        return SESSION_RUNNING;
+    }
+
+    waitForegroundJob(job);
+
+    return lastStatus;
+}
+
+/**
+ * Executes the set command. Without arguments it lists the shell options,
+ * otherwise every name=value argument is applied. trace=<file> writes a
+ * Chrome trace of every line to the file until trace=off.
+ * 
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return 0 if successful, 2 if an option is not valid
+ */
+int setCommand(tcommand * command, tline * line, int fds[3]) {
+    int i, status = 0;
+
+    if (command->argc == 1) {
+        printOptions(&shellOptions, fds[1]);
+        dprintf(fds[1], "trace=%s\n", tracePath() != NULL ? tracePath() : "off");
+        printPromptSegments(&prompt, fds[1]);
+        return 0;
+    }
+
+    for (i = 1; i < command->argc; i++) {
+        // trace=<file> or trace=off, for the whole shell
+        if (strncmp(command->argv[i], "trace=", 6) == 0) {
+            if (strcmp(command->argv[i] + 6, "off") == 0) stopTrace();
+            else if (startTrace(command->argv[i] + 6) == -1) {
+                dprintf(fds[2], "set: %s: %s\n", command->argv[i] + 6, strerror(errno));
+                status = 1;
+            }
+
+        // prompt=<segment>,...
+        } else if (strncmp(command->argv[i], "prompt=", 7) == 0) {
+            if (setPromptSegments(&prompt, command->argv[i] + 7) == -1) {
+                dprintf(fds[2], "set: %s: invalid prompt segment\n", command->argv[i] + 7);
+                status = 2;
+            }
+
+        } else if (setOption(&shellOptions, command->argv[i]) == -1) {
+            dprintf(fds[2], "set: %s: invalid option\n", command->argv[i]);
+            status = 2;
+        }
+    }
+
+    return status;
+}
+
+/**
+ * Executes the parallel command: parallel [-j N] [-s] [file]. Runs every
+ * line of the file (or the standard input) as a job, with at most N jobs
+ * running at once (the available CPUs by default). The output and errors
+ * of each job are kept in a memfd and written together when it finishes,
+ * and -s lists the exit status of every line in input order.
+ * 
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return 0 if every line succeeded, the number of failed lines otherwise
+ *         (at most 101), 130 if interrupted
+ */
+int parallelCommand(tcommand * command, tline * line, int fds[3]) {
+    cpu_set_t cpus;
+    tinput fileInput, * input = &fileInput;
+    tarena arena;
+    tline * parsed;
+    tbuiltin * builtin;
+    tjob ** running;
+    char * text, ** texts = NULL;
+    int * statuses = NULL, * indexes, * outputs;
+    int i, fd, kind, maxJobs = 0, showStatuses = 0;
+    int nlines = 0, capacity = 0, nrunning = 0, finished, failed = 0, eof = 0, killed = 0;
+
+    // Server sessions have no input of their own, and a parallel run would
+    // hold the lines of every other session until it ends
+    if (shellInput == NULL) {
+        dprintf(fds[2], "parallel: not supported in server sessions\n");
+        return 2;
+    }
+
+    // Parse options
+    for (i = 1; i < command->argc && command->argv[i][0] == '-'; i++) {
+        if (strcmp(command->argv[i], "-s") == 0) showStatuses = 1;
+        else if (strcmp(command->argv[i], "-j") == 0 && i + 1 < command->argc) maxJobs = atoi(command->argv[++i]);
+        else {
+            dprintf(fds[2], "Usage: parallel [-j jobs] [-s] [file]\n");
+            return 2;
+        }
+    }
+
+    // Default to the CPUs the shell may run on
+    if (maxJobs <= 0) {
+        maxJobs = sched_getaffinity(0, sizeof(cpus), &cpus) == 0 ? CPU_COUNT(&cpus) : 1;
+    }
+
+    fd = fds[0];
+
+    if (i < command->argc) {
+        fd = open(command->argv[i], O_RDONLY | O_CLOEXEC);
+
+        if (fd == -1) {
+            dprintf(fds[2], "parallel: %s: %s\n", command->argv[i], strerror(errno));
+            return 1;
+        }
+    }
+
+    running = (tjob **) calloc(maxJobs, sizeof(tjob *));
+    indexes = (int *) calloc(maxJobs, sizeof(int));
+    outputs = (int *) calloc(maxJobs, sizeof(int));
+
+    // Check for malloc errors
+    if (running == NULL || indexes == NULL || outputs == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Lines typed after parallel on the shell's own input are already buffered
+    if (fd == shellInput->fd) input = shellInput;
+    else initInput(input, fd);
+
+    initArena(&arena);
+    interrupted = 0;
+    fflush(stdout);
+
+    while (nrunning > 0 || (eof == 0 && interrupted == 0)) {
+        // Start lines while there are free slots
+        while (eof == 0 && interrupted == 0 && nrunning < maxJobs) {
+            text = nextLine(input);
+
+            if (text == NULL) {
+                if (input->eof) eof = 1;
+                else fillInput(input);
+                continue;
+            }
+
+            // Keep every line and its status in input order
+            if (nlines == capacity) {
+                capacity = capacity == 0 ? 64 : capacity * 2;
+                statuses = (int *) realloc(statuses, sizeof(int) * capacity);
+                texts = (char **) realloc(texts, sizeof(char *) * capacity);
+
+                // Check for malloc errors
+                if (statuses == NULL || texts == NULL) {
+                    fprintf(stderr, "Error: malloc failed\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            texts[nlines] = strdup(text);
+            statuses[nlines] = 0;
+            nlines++;
+
+            resetArena(&arena);
+            parsed = parseLine(&arena, text, resolveCommand);
+
+            if (parsed == NULL) {
+                statuses[nlines - 1] = 2;
+                continue;
+            }
+
+            expandLine(&arena, parsed);
+            kind = isInputOk(parsed);
+            builtin = kind == 2 ? findBuiltin(parsed->commands[0].argv[0]) : NULL;
+
+            if (kind == 0) continue;
+
+            if (kind == -1) {
+                dprintf(fds[2], "parallel: %s: command not found\n", parsed->commands[0].argv[0]);
+                statuses[nlines - 1] = 127;
+                continue;
+            }
+
+            // Builtins that change the shell can not run in a job
+            if (builtin != NULL && (builtin->flags & BUILTIN_PIPELINE) == 0) {
+                dprintf(fds[2], "parallel: %s: not supported\n", builtin->name);
+                statuses[nlines - 1] = 1;
+                continue;
+            }
+
+            // Take a free slot
+            for (i = 0; running[i] != NULL; i++);
+
+            outputs[i] = memfd_create("parallel", MFD_CLOEXEC);
+
+            if (outputs[i] == -1) {
+                fprintf(stderr, "Error: memfd_create failed\n");
+                exit(EXIT_FAILURE);
+            }
+
+            running[i] = addJob(jobs, parsed, text);
+            running[i]->owned = 1;
+            running[i]->background = 0;
+            running[i]->captureFd = outputs[i];
+            indexes[i] = nlines - 1;
+            nrunning++;
+
+            launchJob(running[i]);
+        }
+
+        // Write the output of the finished jobs and free their slots
+        for (i = 0, finished = 0; i < maxJobs; i++) {
+            if (running[i] == NULL || running[i]->alive > 0) continue;
+
+            statuses[indexes[i]] = running[i]->exitStatus;
+
+            lseek(outputs[i], 0, SEEK_SET);
+            relayFd(outputs[i], fds[1]);
+            close(outputs[i]);
+
+            removeJob(jobs, running[i]);
+            running[i] = NULL;
+            nrunning--;
+            finished++;
+        }
+
+        if (finished > 0 || nrunning == 0) continue;
+
+        runEvents(-1);
+
+        // Ctrl+C stops the running jobs and no more lines are started
+        if (interrupted == 1 && killed == 0) {
+            for (i = 0; i < maxJobs; i++) {
+                if (running[i] != NULL && running[i]->pgid > 0) killpg(running[i]->pgid, SIGINT);
+            }
+
+            killed = 1;
+        }
+    }
+
+    for (i = 0; i < nlines; i++) {
+        if (statuses[i] != 0) failed++;
+        if (showStatuses) dprintf(fds[1], "%d\t%d\t%s", i + 1, statuses[i], texts[i]);
+        free(texts[i]);
+    }
+
+    if (fd != fds[0]) close(fd);
+
+    // A terminal can still be read after Ctrl+D
+    if (input == shellInput) input->eof = !isatty(input->fd);
+    else freeInput(input);
+    freeArena(&arena);
+    free(statuses);
+    free(texts);
+    free(running);
+    free(indexes);
+    free(outputs);
+
+    if (interrupted == 1) return 130;
+    return failed > 101 ? 101 : failed;
+}
+
+/**
+ * Executes the history command: history [n] lists the whole history or
+ * its last n entries, history -r text shows the newest entry with text.
+ * 
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return 0 if successful, 1 if there is no history or no match
+ */
+int historyCommand(tcommand * command, tline * line, int fds[3]) {
+    size_t n, count, length;
+    char * entry;
+
+    if (history.logFd == -1) {
+        dprintf(fds[2], "history: no history file\n");
+        return 1;
+    }
+
+    count = historyCount(&history);
+
+    // Reverse search
+    if (command->argc > 2 && strcmp(command->argv[1], "-r") == 0) {
+        // The newest entry is this command
+        n = searchHistory(&history, command->argv[2], count);
+        entry = historyEntry(&history, n, &length);
+
+        if (entry == NULL) return 1;
+
+        dprintf(fds[1], "%5zu  %.*s\n", n, (int) length, entry);
+        return 0;
+    }
+
+    n = command->argc > 1 ? (size_t) atol(command->argv[1]) : count;
+    printHistory(&history, fds[1], n < count ? count - n + 1 : 1);
+
+    return 0;
+}
+
+/**
+ * Executes the export command: export NAME[=value]... exports variables
+ * (setting them first), export alone lists the exported ones.
+ * 
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return 0 if successful, 1 if a name is not valid
+ */
+int exportCommand(tcommand * command, tline * line, int fds[3]) {
+    char * equals;
+    int i, status = 0;
+
+    if (command->argc == 1) printVariables(fds[1], 1);
+
+    for (i = 1; i < command->argc; i++) {
+        equals = strchr(command->argv[i], '=');
+
+        if (!isVariableName(command->argv[i], equals != NULL ? (size_t) (equals - command->argv[i]) : strlen(command->argv[i]))) {
+            dprintf(fds[2], "export: %s: not a valid name\n", command->argv[i]);
+            status = 1;
+            continue;
+        }
+
+        if (equals == NULL) exportVariable(command->argv[i]);
+        else {
+            *equals = '\0';
+            setVariable(command->argv[i], equals + 1, 1);
+        }
+
+        variableChanged(command->argv[i]);
+    }
+
+    return status;
+}
+
+/**
+ * Executes the unset command
+ * 
+ * @param command Command to execute (argv[1..] are the names)
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return 0
+ */
+int unsetCommand(tcommand * command, tline * line, int fds[3]) {
+    int i;
+
+    for (i = 1; i < command->argc; i++) {
+        unsetVariable(command->argv[i]);
+        variableChanged(command->argv[i]);
+    }
+
+    return 0;
+}
+
+/**
+ * Executes the ulimit command. The limits apply to the commands the shell
+ * starts (set in the child before exec), the shell keeps its own. -S and
+ * -H select the soft or the hard limit (both when setting, the soft one
+ * when printing), -a prints every limit and a letter selects the resource
+ * (-f by default), optionally followed by its new value.
+ * 
+ * @param command Command to execute
+ * @param line Parsed line
+ * @param fds Standard input, output and error
+ * @return 0 if successful, 1 if the value is not valid, 2 on bad usage
+ */
+int ulimitCommand(tcommand * command, tline * line, int fds[3]) {
+    int i, j, index = findLimit('f'), which = 0, all = 0;
+    char * value = NULL, * arg;
+
+    for (i = 1; i < command->argc; i++) {
+        arg = command->argv[i];
+
+        if (arg[0] != '-' || arg[1] == '\0') {
+            if (value != NULL) break;
+            value = arg;
+            continue;
+        }
+
+        for (j = 1; arg[j] != '\0' && index != -1; j++) {
+            if (arg[j] == 'S') which |= LIMIT_SOFT;
+            else if (arg[j] == 'H') which |= LIMIT_HARD;
+            else if (arg[j] == 'a') all = 1;
+            else index = findLimit(arg[j]);
+        }
+    }
+
+    if (index == -1 || i < command->argc || (all && value != NULL)) {
+        dprintf(fds[2], "Usage: ulimit [-SH] [-a | -cdflnstuv [limit]]\n");
+        return 2;
+    }
+
+    if (value != NULL) {
+        if (setLimit(&shellLimits, index, which != 0 ? which : LIMIT_SOFT | LIMIT_HARD, value) == -1) {
+            dprintf(fds[2], "ulimit: %s: invalid limit\n", value);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    which = which == LIMIT_HARD ? LIMIT_HARD : LIMIT_SOFT;
+
+    if (all == 0) printLimit(&shellLimits, index, which, fds[1], 0);
+
+    for (i = 0; all && i < LIMIT_RESOURCES; i++) printLimit(&shellLimits, i, which, fds[1], 1);
+
+    return 0;
+}
+
+/**
+ * Executes an external command from a parsed line
+ * 
+ * @param line Parsed line to execute
+ * @param command Command string
+ * @return 0 if successful, -1 if failed
+ */
+int externalCommand(tline * line, char* command) {
+    tjob * job;
+
+    // Add job to the job store
+    job = addJob(jobs, line, command);
+    job->timed = lineTimed;
+    job->inputFd = lineInputFd;
+
+    // Update background jobs count and print job id
+    if (line->background == 1) {
+        bgJobs++;
+        fprintf(stdout, "[%d] %d\n", bgJobs, job->id);
+    }
+
+
+    // Flush pending output so it is not mixed with the children's
+    fflush(stdout);
+
+    launchJob(job);
+
+    // Background jobs are reaped by childExitHandler
+    if (line->background == 0) waitForegroundJob(job);
+    else if (job->alive == 0) {
+        bgJobs--;
+        removeJob(jobs, job);
+    }
+
+    return 0;
+}
+
+/**
+ * Runs a line with the cache prefix. A stored result of the same pipeline
+ * (same key, younger than the ttl) is replayed without spawning anything;
+ * otherwise the pipeline runs with its output and errors going to files
+ * that are stored and copied to the line's output once it finishes.
+ * 
+ * @param line Parsed line (external commands in the foreground)
+ * @param command Command string
+ */
+void cachedCommand(tline * line, char * command) {
+    char key[MEMO_KEY_SIZE], outPath[MEMO_PATH_SIZE], errPath[MEMO_PATH_SIZE];
+    char * input = line->redirect_input, * output = line->redirect_output, * error = line->redirect_error;
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    size_t capacity = lineOptions.cacheSize > 0 ? lineOptions.cacheSize : DEFAULT_MEMO_SIZE;
+    int status, i, res;
+
+    // Without a store, or reading an input that has no key (a terminal or
+    // a pipe), the pipeline just runs
+    if (openMemoStore() == -1 || memoKey(line, lineInputFd, lineCacheEnv, lineCacheEnvCount, key) == -1) {
+        externalCommand(line, command);
+        return;
+    }
+
+    // Replay targets: the line's output and error files or the shell's
+    line->redirect_input = NULL;
+    res = openRedirections(line, fds);
+    line->redirect_input = input;
+
+    if (res == -1) {
+        lastStatus = 1;
+        return;
+    }
+
+    fflush(stdout);
+
+    if (replayMemo(key, lineCacheTtl, fds[1], fds[2], &status) == 0) {
+        lastStatus = status;
+    } else if (createMemoOutput(outPath) == 0 && createMemoOutput(errPath) == 0) {
+        line->redirect_output = outPath;
+        line->redirect_error = errPath;
+
+        externalCommand(line, command);
+
+        line->redirect_output = output;
+        line->redirect_error = error;
+
+        // Only runs that finished on their own are kept (not stopped or killed)
+        if (lastCompletedId == jobs->lastId && lastStatus < 128) storeMemo(key, outPath, errPath, lastStatus);
+
+        // The outputs stay in place whether they were stored or not
+        copyMemoOutput(outPath, fds[1]);
+        copyMemoOutput(errPath, fds[2]);
+        unlink(outPath);
+        unlink(errPath);
+
+        // Evicting after the copy keeps the new result even when it alone is over the capacity
+        trimMemoStore(capacity);
+    } else {
+        fprintf(stderr, "cache: the result store can not be written\n");
+        externalCommand(line, command);
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (fds[i] != i) close(fds[i]);
+    }
+}
+
+/**
+ * Creates the pipes of a job and spawns its stages, watching each of them
+ * through a pidfd so they are reaped by childExitHandler
+ * 
+ * @param job Job to launch (its line must still be valid)
+ */
+void launchJob(tjob * job) {
+    tline * line = job->line;
+    int i, pidFd;
+    pid_t pid;
+    long long traceStart;
+    size_t captureSize = lineOptions.captureSize > 0 ? lineOptions.captureSize : DEFAULT_CAPTURE_SIZE;
+
+    // limit --cpu/--mem puts the job in its own cgroup when cgroup v2 allows it
+    if (hasLimits(&lineLimits)) job->cgroup = createCgroup(&lineLimits, &job->cgroupFd);
+
+    // &capture sends the output and errors to a ring drained by the event loop
+    if (line->capture && openCapture(jobs, job, captureSize) == -1) {
+        fprintf(stderr, "Error: pipe failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Initialize pipes
+    for (i = 0; i < line->ncommands - 1; i++) {
+        if (pipe(job->pipes[i]) < 0) {
+            fprintf(stderr, "Error: pipe failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // Larger pipes let the writer run ahead of the reader
+        if (lineOptions.pipeSize > 0 && fcntl(job->pipes[i][1], F_SETPIPE_SZ, (int) lineOptions.pipeSize) == -1) {
+            fprintf(stderr, "Error: F_SETPIPE_SZ failed: %s\n", strerror(errno));
+        }
+    }
+
+    // Create children
+    for (i = 0; i < line->ncommands; i++) {
+        traceStart = traceClock();
+        pid = spawnStage(job, i);
+        traceSpan("spawn", job->stats[i].name, traceStart, 0, "pid", pid);
+
+        // posix_spawn returns once the child has called exec
+        if (SPAWN_MODE == 1 && pid > 0 && line->commands[i].filename != NULL) traceInstant("exec", job->stats[i].name, pid, NULL, 0);
+
+        if (DEBUG_MODE) fprintf(stdout, "PID: %d\n", pid);
+
+        // Skip stages that could not be spawned
+        if (pid <= 0) continue;
+
+        registerPid(jobs, job, i, pid);
+        if (line->background == 1 && i == line->ncommands - 1) lastBackgroundPid = pid;
+        if (lineOptions.affinity != AFFINITY_NONE) placeStage(pid, i, line->ncommands);
+
+        // Get notified through a pidfd when the process exits
+        pidFd = pidfd_open(pid, 0);
+
+        if (pidFd == -1 || watchFd(pidFd, EPOLLIN, childExitHandler, (void *) (long) pid) == -1) {
+            fprintf(stderr, "Error: pidfd_open failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Close all pipes in the parent process
+    for (i = 0; i < line->ncommands - 1; i++) {
+        close(job->pipes[i][0]);
+        close(job->pipes[i][1]);
+    }
+
+    // Every stage has joined the cgroup, an empty job leaves none behind
+    if (job->cgroupFd != -1) {
+        close(job->cgroupFd);
+        job->cgroupFd = -1;
+    }
+
+    if (job->alive == 0) {
+        removeCgroup(job->cgroup);
+        job->cgroup = 0;
+    }
+
+    // Only the children write to the capture
+    if (job->capture != NULL) {
+        close(job->captureFd);
+        job->captureFd = -1;
+        if (job->alive == 0) finishCapture(jobs, job);
+    }
 }
 
 /**
- * Reads a line from the standard input
+ * Waits until a foreground job terminates or is stopped
  * 
- * @param line Buffer to store the line
- * @param max Maximum number of characters to read
- * @return Number of characters read
+ * @param job Job to wait for
  */
-void readLine(char * line, int max) {
-    char * customPrompt, * cwd, * username;
-    int len;
+void waitForegroundJob(tjob * job) {
+    jobs->foreground = job;
 
-    // Get username
-    username = getenv("USER");
+    // Let the event handlers update the job
+    while (job->alive > 0 && job->status == 1) runEvents(-1);
 
-    // Get current working directory
-    cwd = getcwd(NULL, 0);
+    jobs->foreground = NULL;
 
-    // Get home subdirectory
-    if (strstr(cwd, getenv("HOME")) != NULL) {
-        len = strlen(getenv("HOME"));
-        cwd += len;
-        customPrompt = "\033[1;32m%s@msh\033[0m: \033[1;34m~%s\033[0m $> ";
-    } else {
-        customPrompt = "\033[1;32m%s@msh\033[0m: \033[1;34m%s\033[0m $> ";
-    }
+    // Only the foreground job sets $?, background jobs report to wait
+    lastStatus = job->alive == 0 ? job->exitStatus : 128 + SIGTSTP;
 
-    // Print custom prompt
-    fprintf(stdout, customPrompt, username, cwd);
-    fgets(line, max, stdin);
+    // Keep stopped jobs in the store so they can be resumed
+    if (job->alive == 0) {
+        if (job->timed) printJobTimes(job);
+        removeJob(jobs, job);
+    }
 }
 
 /**
- * Redirects input and output for a given job
+ * Prints a time line of the time prefix
  * 
- * @param job Job to redirect
- * @param i Index of the command
+ * @param label Name of the figure
+ * @param seconds Time in seconds
  */
-void redirectIO(tjob * job, int i) {
-    int j;
-    tline * line = job->line;
-
-    // Redirect input from previous pipe or file
-    if (i > 0) {
-        dup2(job->pipes[i - 1][0], STDIN_FILENO);
-    } else if (line->redirect_input != NULL) {
-        freopen(line->redirect_input, "r", stdin);
-    }
-
-    // Redirect output to next pipe or file
-    if (i < line->ncommands - 1) {
-        dup2(job->pipes[i][1], STDOUT_FILENO);
-    } else if (line->redirect_output != NULL) {
-        freopen(line->redirect_output, "w", stdout);
-    }
-
-    // Redirect error to file
-    if (line->redirect_error != NULL) {
-        freopen(line->redirect_error, "w", stderr);
-    }
+void printTime(char * label, double seconds) {
+    int minutes = (int) (seconds / 60);
 
-    // Close all pipe file descriptors
-    for (j = 0; j < line->ncommands - 1; j++) {
-        close(job->pipes[j][0]);
-        close(job->pipes[j][1]);
-    }
+    fprintf(stderr, "%s\t%dm%.3fs\n", label, minutes, seconds - minutes * 60);
 }
 
 /**
- * Checks if the parsed line is correct
+ * Prints the resource usage of a finished job run with the time prefix:
+ * the totals and then every stage
  * 
- * @param line Parsed line to check
- * @return 1 if the line is correct, 0 if there are no commands, -1 if there's an error
- *         2 if the command is cd, 3 if the command is exit, 4 if the command is jobs,
- *         5 if the command is umask, 6 if the command is bg
+ * @param job Finished job
  */
-int isInputOk(tline * line) {
+void printJobTimes(tjob * job) {
+    struct timespec * start = &job->stats[0].start, * end = &job->stats[0].end;
+    double user = 0, sys = 0;
     int i;
 
-    if (line->ncommands == 0) {
-        return 0;
-    }
+    for (i = 0; i < job->ncommands; i++) {
+        user += timevalSeconds(&job->stats[i].utime);
+        sys += timevalSeconds(&job->stats[i].stime);
 
-    // Handle cd command
-    if (line->commands->filename == NULL && strcmp(line->commands[0].argv[0], "cd") == 0) {
-        return 2;
+        if (elapsedSeconds(&job->stats[i].end, end) < 0) end = &job->stats[i].end;
     }
 
-    // Handle exit command
-    if (line->commands->filename == NULL && strcmp(line->commands[0].argv[0], "exit") == 0) {
-        return 3;
-    }
+    fflush(stdout);
 
-    // Handle jobs command
-    if (line->commands->filename == NULL && strcmp(line->commands[0].argv[0], "jobs") == 0) {
-        return 4;
-    }
+    printTime("real", elapsedSeconds(start, end));
+    printTime("user", user);
+    printTime("sys", sys);
 
-    // Handle umask command
-    if (line->commands->filename == NULL && strcmp(line->commands[0].argv[0], "umask") == 0) {
-        return 5;
-    }
+    for (i = 0; i < job->ncommands; i++) printStageStats(STDERR_FILENO, job->stats + i, 0);
+}
 
-    // Handle bg command
-    if (line->commands->filename == NULL && strcmp(line->commands[0].argv[0], "bg") == 0) {
-        return 6;
-    }
+/**
+ * Prints the resource usage of a job stage in one line
+ * 
+ * @param fd File descriptor to write to
+ * @param stats Figures of the stage
+ * @param live Include the pid and the state of the stage
+ */
+void printStageStats(int fd, tstagestats * stats, int live) {
+    char state[16];
 
-    // Handle external commands
-    for (i = 0; i < line->ncommands; i++) {
-        if (line->commands[i].filename == NULL) {
-            return -1;
-        }
+    if (live) {
+        if (stats->pid <= 0) snprintf(state, sizeof(state), "failed");
+        else if (stats->finished) snprintf(state, sizeof(state), "exit %d", stats->exitStatus);
+        else snprintf(state, sizeof(state), "running");
+
+        dprintf(fd, "      %-8d %-8s", stats->pid, state);
     }
 
-    return 1;
+    dprintf(fd, "  user %.3fs  sys %.3fs  maxrss %ldK  ctxsw %ld/%ld  wall %.3fs  %s\n",
+        timevalSeconds(&stats->utime), timevalSeconds(&stats->stime), stats->maxRss,
+        stats->voluntary, stats->involuntary, stats->pid > 0 ? elapsedSeconds(&stats->start, &stats->end) : 0.0,
+        stats->name);
 }
 
 /**
- * Changes the current working directory
+ * Resolves a command for the parser through the command location cache
  * 
- * @param path Path to change to (NULL for home directory)
- * @return 0 if successful, -1 if failed
+ * @param arena Arena of the parsed line
+ * @param name Command name
+ * @return Path of the executable, NULL if it was not found
  */
-int changeDirectory(char * path) {
-    int res;
-    char * dir;
+char * resolveCommand(tarena * arena, char * name) {
+    char * path;
 
-    if (path == NULL) {
-        dir = getenv("HOME");
-    } else {
-        dir = path;
-    }
+    // Paths are checked by the parser itself
+    if (strchr(name, '/') != NULL) return searchCommand(arena, name);
 
-    res = chdir(dir);
+    // Builtins are not looked up
+    if (findBuiltin(name) != NULL) return NULL;
 
-    if (res == -1) {
-        fprintf(stderr, "Error: Directory not found\n");
-    }
+    // Assignments are not commands, words with variables are resolved once expanded
+    if (strchr(name, '=') != NULL || strchr(name, '$') != NULL) return NULL;
 
-    return res;
+    // Copy it, the cache may drop the entry while the line is alive
+    path = lookupCommand(name);
+    if (path == NULL) return NULL;
+
+    return arenaStrdup(arena, path);
 }
 
 /**
- * Executes the umask command
- * @param line Parsed line to execute
+ * Spawns the i-th command of a job using the selected spawn engine.
+ * The executable was resolved by the parser through the command cache.
+ * 
+ * @param job Job to spawn
+ * @param i Index of the command
+ * @return PID of the new process, -1 if failed
  */
-void umaskCommand(tline * line) {
-    mode_t mode;
-    char * mask = NULL;
+pid_t spawnStage(tjob * job, int i) {
+    tcommand * command = job->line->commands + i;
+    int files[3] = {-1, -1, -1}, j;
+    tbuiltin * builtin;
+    char * path;
+    pid_t pid;
 
-    // Redirect IO to files if needed
-    if (line->redirect_input != NULL) freopen(line->redirect_input, "r", stdin);
-    if (line->redirect_output != NULL) freopen(line->redirect_output, "w", stdout);
-    if (line->redirect_error != NULL) freopen(line->redirect_error, "w", stderr);
+    path = command->filename;
 
-    // Get mask if provided in the command
-    if (line->commands[0].argc > 1) {
-        mask = line->commands[0].argv[1];
+    // Builtin stages run in a forked copy of the shell
+    if (path == NULL) {
+        builtin = findBuiltin(command->argv[0]);
+        return forkBuiltinStage(job, i, builtin);
     }
 
-    // Get mask from stdin if not provided and handle errors
-    if (mask == NULL && line->redirect_input != NULL) {
-        mask = (char *) malloc(5);
+    // posix_spawn can not set resource limits in the child
+    if (SPAWN_MODE == 0 || hasLimits(&lineLimits)) {
+        // The exec error stays in the child, so check the cached path first
+        if (path != command->argv[0] && access(path, F_OK) == -1 && errno == ENOENT) {
+            forgetCommand(command->argv[0]);
+            path = lookupCommand(command->argv[0]);
 
-        // Check for malloc errors
-        if (mask == NULL) {
-            fprintf(stderr, "Error: malloc failed\n");
-            return;
+            if (path == NULL) path = command->filename;
         }
 
-        // Get mask from stdin
-        if (mask != NULL && fgets(mask, 5, stdin) == NULL) {
-            free(mask);
-            mask = NULL;
-        }
+        return forkStage(job, i, path);
     }
 
-    // Output current mask if no mask is provided
-    if (mask == NULL) {
-        mode = umask(0);
-        umask(mode);
-        fprintf(stdout, "%04o\n", mode);
-    // Set new mask if provided
-    } else {
-        mode = strtol(mask, NULL, 8);
-        umask(mode);
+    // The redirection files are opened here, so their errors name the file
+    if (openStageFiles(job, i, files) == -1) {
+        failStage(job, i, 1);
+        return -1;
+    }
+
+    pid = posixSpawnStage(job, i, path, files);
+
+    // Retry with a fresh lookup only if the cached executable disappeared
+    if (pid == -ENOENT && path != command->argv[0] && access(path, X_OK) == -1 && errno == ENOENT) {
+        forgetCommand(command->argv[0]);
+        path = lookupCommand(command->argv[0]);
+
+        if (path != NULL) pid = posixSpawnStage(job, i, path, files);
+    }
+
+    for (j = 0; j < 3; j++) {
+        if (files[j] != -1) close(files[j]);
     }
 
-    // Reset redirection to terminal (/dev/tty)
-    if (line->redirect_input != NULL) freopen("/dev/tty", "r", stdin);
-    if (line->redirect_output != NULL) freopen("/dev/tty", "w", stdout);
-    if (line->redirect_error != NULL) freopen("/dev/tty", "w", stderr);
+    if (pid < 0) {
+        fprintf(stderr, "Error: %s: %s\n", command->argv[0], strerror(-pid));
+        failStage(job, i, 127);
+        return -1;
+    }
 
-    // Free allocated memory
-    if (mask != NULL && line->redirect_input != NULL) free(mask);
+    return pid;
 }
 
 /**
- * Executes the jobs command
+ * Opens the redirection files of the i-th command of a job in the shell,
+ * close-on-exec, for posix_spawn to duplicate. Errors are reported like
+ * redirectFile does in a forked child.
  * 
- * @param line Parsed line to execute
+ * @param job Job of the command
+ * @param i Index of the command
+ * @param files Input, output and error files (-1 if not redirected)
+ * @return 0 if successful, -1 if a file could not be opened
  */
-void jobsCommand(tline * line) {
-    int i, count = 0;
-    char * outputFormat;
+int openStageFiles(tjob * job, int i, int files[3]) {
+    tline * line = job->line;
+    char * names[3] = {NULL, NULL, line->redirect_error};
+    int flags[3] = {O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC, O_WRONLY | O_CREAT | O_TRUNC};
+    int j, k;
+
+    // Pipes and here-documents take precedence, like in redirectIO
+    if (i == 0 && job->inputFd == -1) names[0] = line->redirect_input;
+    if (i == line->ncommands - 1) names[1] = line->redirect_output;
 
-    // Redirect IO to files if needed
-    if (line->redirect_input != NULL) freopen(line->redirect_input, "r", stdin);
-    if (line->redirect_output != NULL) freopen(line->redirect_output, "w", stdout);
-    if (line->redirect_error != NULL) freopen(line->redirect_error, "w", stderr);
+    for (j = 0; j < 3; j++) {
+        if (names[j] == NULL) continue;
 
-    // Sort jobs by id
-    sortJobsById(jobs);
-    
-    for (i = 0; i < MAX_COMMANDS; i++) {
-        if (jobs[i]->id != -1) {
-            count++;
+        files[j] = open(names[j], flags[j] | O_CLOEXEC, 0666);
 
-            // Assign output format
-            if (jobs[i]->status == 0) outputFormat = "Stopped";
-            else outputFormat = "Running";                
+        if (files[j] == -1) {
+            fprintf(stderr, "Error: %s: %s\n", names[j], strerror(errno));
 
-            fprintf(stdout, "[%d]  %s\t\t %s", count, outputFormat, jobs[i]->command);
+            for (k = 0; k < j; k++) {
+                if (files[k] != -1) close(files[k]);
+                files[k] = -1;
+            }
+
+            return -1;
         }
     }
 
-    // Reset redirection to terminal (/dev/tty)
-    if (line->redirect_input != NULL) freopen("/dev/tty", "r", stdin);
-    if (line->redirect_output != NULL) freopen("/dev/tty", "w", stdout);
-    if (line->redirect_error != NULL) freopen("/dev/tty", "w", stderr);
+    return 0;
 }
 
 /**
- * Executes the bg command
+ * Records a stage that could not be spawned as finished with a status, so
+ * $?, the time prefix and jobs -l show the failure
  * 
- * @param job_id Job ID to execute
-*/
-void bgCommand(char * job_id) {
-    int i, id;
-    int len, found = 0;
-
-    // Sort jobs by id
-    sortJobsById(jobs);
-
-    if (job_id == NULL) {
-        // Search for the job by id and send SIGCONT to all processes
-        for (i = 0; i < MAX_COMMANDS; i++) {
-            if (jobs[i]->id == lastStoppedJobId) {
-                found = 1;
-                break;
-            }
-        }
-
-    } else {
-        i = atoi(job_id) - 1;
-        found = 1;
-    }
+ * @param job Job of the stage
+ * @param i Index of the stage
+ * @param status Exit status of the stage
+ */
+void failStage(tjob * job, int i, int status) {
+    tstagestats * stats = job->stats + i;
 
-    // Return if the job was not found
-    if (found == 0) return;
+    clock_gettime(CLOCK_MONOTONIC, &stats->start);
+    stats->end = stats->start;
+    stats->finished = 1;
+    stats->exitStatus = status;
 
-    // Update background jobs and stopped jobs count
-    bgJobs++;
-    stoppedJobs--;
+    // The status of the job is the one of its last command
+    if (i == job->ncommands - 1) job->exitStatus = status;
+}
 
-    // Get job id and set new status and background flag
-    id = jobs[i]->id;
-    jobs[i]->status = 1;
-    jobs[i]->background = 1;
+/**
+ * Prepares a forked child to run the i-th command of a job: process group,
+ * default signal dispositions, pipes and redirections
+ * 
+ * @param job Job the child belongs to
+ * @param i Index of the command
+ */
+void prepareChild(tjob * job, int i) {
+    // Set the child process group ID to its own PID
+    if (interactive == 1) setpgid(0, job->pgid);
 
-    // Send SIGCONT to all processes in the job's process group
-    killpg(jobs[i]->pids[0], SIGCONT);
+    // Set default signal handlers
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    sigprocmask(SIG_UNBLOCK, &shellMask, NULL);
 
-    // Add '&' to the command string
-    len = strlen(jobs[i]->command);
-    jobs[i]->command = (char *) realloc(jobs[i]->command, len + 2);
-    jobs[i]->command[len - 1] = ' ';
-    jobs[i]->command[len] = '&';
-    jobs[i]->command[len + 1] = '\n';
+    // Redirect input and output
+    redirectIO(job, i);
 
-    // Print message
-    fprintf(stdout, "[%d]+ %s", id, jobs[i]->command);
+    // Resource limits of the line (ulimit and limit)
+    if (hasLimits(&lineLimits)) applyLimits(&lineLimits, job->cgroupFd, job->id);
 }
 
-
 /**
- * Executes an external command from a parsed line
+ * Spawns the i-th command of a job with fork + execv
  * 
- * @param line Parsed line to execute
- * @param command Command string
- * @return 0 if successful, -1 if failed
+ * @param job Job to spawn
+ * @param i Index of the command
+ * @param path Path of the executable
+ * @return PID of the new process
  */
-int externalCommand(tline * line, char* command) {
-    int i, current;
-    int status;
+pid_t forkStage(tjob * job, int i, char * path) {
     pid_t pid;
+    tline * line = job->line;
 
-    // Add job to the jobs array
-    current = addJob(line, command);
-
-    // Check error when adding job
-    if (current == -1) return -1;
+    pid = fork();
 
-    // Update background jobs count and print job id
-    if (line->background == 1) {
-        bgJobs++;
-        fprintf(stdout, "[%d] %d\n", bgJobs, jobs[current]->id);
-    }
+    if (pid == 0) {
+        prepareChild(job, i);
 
+        // Execute command
+        execv(path, line->commands[i].argv);
+        fprintf(stderr, "Error: %s: %s\n", line->commands[i].argv[0], strerror(errno));
+        _exit(127);
 
-    // Initialize pipes
-    for (i = 0; i < line->ncommands - 1; i++) {
-        if (pipe(jobs[current]->pipes[i]) < 0) {
-            fprintf(stderr, "Error: pipe failed\n");
-            exit(EXIT_FAILURE);
-        }
+    } else if (pid < 0) {
+        fprintf(stderr, "Error: fork failed\n");
+        exit(EXIT_FAILURE);
     }
 
-    // Create children
-    for (i = 0; i < line->ncommands; i++) {
-        pid = fork();
-
-        if (DEBUG_MODE) fprintf(stdout, "PID: %d\n", pid);
+    // Join the job's process group
+    if (interactive == 1) setpgid(pid, job->pgid == 0 ? pid : job->pgid);
 
-        if (pid == 0) {
-            // Set the child process group ID to its own PID
-            setpgid(0, 0);
+    return pid;
+}
 
-            // Set default signal handlers
-            signal(SIGTSTP, SIG_DFL);
-            signal(SIGINT, SIG_DFL);
+/**
+ * Runs a builtin as the i-th command of a job in a forked child, so it can
+ * be part of a pipeline or run in the background
+ * 
+ * @param job Job to spawn
+ * @param i Index of the command
+ * @param builtin Builtin to run
+ * @return PID of the new process
+ */
+pid_t forkBuiltinStage(tjob * job, int i, tbuiltin * builtin) {
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    pid_t pid;
+    int status;
 
-            // Redirect input and output
-            redirectIO(jobs[current], i);
+    // Pending output of the shell must not be written again by the child
+    fflush(stdout);
 
-            // Execute command
-            execvp(line->commands[i].filename, line->commands[i].argv);
-            fprintf(stderr,"Error: execvp failed");
-            exit(EXIT_FAILURE);
+    pid = fork();
 
-        } else if (pid < 0) {
-            fprintf(stderr, "Error: fork failed\n");
-            exit(EXIT_FAILURE);
+    if (pid == 0) {
+        prepareChild(job, i);
 
-        } else {
-            if (i == 0) setpgid(pid, pid);
-            else setpgid(pid, jobs[current]->pids[0]);
-            
-            jobs[current]->pids[i] = pid;
-            jobs[current]->status = 1;
-        }
+        // There is no exec to drop the shell's descriptors, a copy of the
+        // read end of its own output would keep it from getting SIGPIPE
+        close_range(3, ~0U, 0);
 
-    }
+        status = builtin->function(job->line->commands + i, job->line, fds);
+        fflush(stdout);
+        _exit(status);
 
-    // Close all pipes in the parent process
-    for (i = 0; i < line->ncommands - 1; i++) {
-        close(jobs[current]->pipes[i][0]);
-        close(jobs[current]->pipes[i][1]);
+    } else if (pid < 0) {
+        fprintf(stderr, "Error: fork failed\n");
+        exit(EXIT_FAILURE);
     }
 
-    // Wait for children
-    for (i = 0; i < line->ncommands; i++) {
-        pid = jobs[current]->pids[i];
-
-        if (line->background == 0) {
-            waitpid(pid, &status, WUNTRACED);
+    // Join the job's process group
+    if (interactive == 1) setpgid(pid, job->pgid == 0 ? pid : job->pgid);
 
-            // Check if the process was stopped
-            if (WIFSTOPPED(status)) {
-                jobs[current]->status = 0;
-            }
-
-            // Check if the process was terminated or killed
-            if (WIFEXITED(status) || WIFSIGNALED(status)) {
-                jobs[current]->status = -1;
-            }
-        } else {
-            waitpid(pid, &status, WNOHANG);
-        }
-    }
-    
-    return 0;
+    return pid;
 }
 
 /**
- * Initializes a job structure
+ * Spawns the i-th command of a job with posix_spawn. Pipes and redirections
+ * are applied as file actions, so the shell's address space is never copied.
  * 
- * @param job Job to initialize
+ * @param job Job to spawn
+ * @param i Index of the command
+ * @param path Path of the executable
+ * @param files Redirection files opened by openStageFiles
+ * @return PID of the new process, negative error number if failed
  */
-void initializeJob(tjob * job) {
-    job->id = -1;
-    job->status = -1;
-    job->line = NULL;
-    job->pids = (pid_t *) malloc(sizeof(pid_t));
-    job->pipes = (int **) malloc(sizeof(int *));
+pid_t posixSpawnStage(tjob * job, int i, char * path, int files[3]) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t defaults, mask;
+    pid_t pid;
+    int j, res;
+    tline * line = job->line;
 
-    // Check for malloc errors
-    if (job->pids == NULL || job->pipes == NULL) {
-        fprintf(stderr, "Error: malloc failed\n");
-        exit(EXIT_FAILURE);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    // Redirect input from previous pipe, here-document or file
+    if (i > 0) {
+        posix_spawn_file_actions_adddup2(&actions, job->pipes[i - 1][0], STDIN_FILENO);
+    } else if (job->inputFd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, job->inputFd, STDIN_FILENO);
+    } else if (files[0] != -1) {
+        posix_spawn_file_actions_adddup2(&actions, files[0], STDIN_FILENO);
     }
-}
 
-/*
- * Adds a job to the jobs array
- *
- * @param line Parsed line to add
- * @param command Command string
- * @return Index of the job in the array, -1 if failed
- */
-int addJob(tline * line, char * command) {
-    int i, j, updated = 0;
-
-    for (i = 0; i < MAX_COMMANDS; i++) {
-        if (jobs[i]->id == -1) {
-            count++;
-
-            jobs[i]->id = count;
-            jobs[i]->line = line;
-            jobs[i]->command = strdup(command);
-            jobs[i]->status = 1;
-            jobs[i]->pids = (pid_t *) realloc(jobs[i]->pids, sizeof(pid_t) * line->ncommands);
-            jobs[i]->pipes = (int **) realloc(jobs[i]->pipes, sizeof(int *) * (line->ncommands - 1));
-            jobs[i]->background = line->background;
-
-            // Allocate memory for pipes
-            for (j = 0; j < line->ncommands - 1; j++) {
-                jobs[i]->pipes[j] = (int *) malloc(sizeof(int) * 2);
-            }
+    // Redirect output to next pipe or file
+    if (i < line->ncommands - 1) {
+        posix_spawn_file_actions_adddup2(&actions, job->pipes[i][1], STDOUT_FILENO);
+    } else if (files[1] != -1) {
+        posix_spawn_file_actions_adddup2(&actions, files[1], STDOUT_FILENO);
+    } else if (job->captureFd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, job->captureFd, STDOUT_FILENO);
+    }
 
-            updated = 1;
-            break;
-        }
+    // Redirect error to file
+    if (files[2] != -1) {
+        posix_spawn_file_actions_adddup2(&actions, files[2], STDERR_FILENO);
+    } else if (job->captureFd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, job->captureFd, STDERR_FILENO);
     }
 
-    // Return error if no slots are available
-    if (updated == 0) {
-        fprintf(stderr, "Error: Maximum number of commands reached\n");
-        return -1;
+    // Close all pipe file descriptors
+    for (j = 0; j < line->ncommands - 1; j++) {
+        posix_spawn_file_actions_addclose(&actions, job->pipes[j][0]);
+        posix_spawn_file_actions_addclose(&actions, job->pipes[j][1]);
     }
 
-    return i;
+    // Join the job's process group and restore default signal dispositions
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGTSTP);
+    sigaddset(&defaults, SIGPIPE);
+    sigemptyset(&mask);
+
+    posix_spawnattr_setpgroup(&attr, job->pgid);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &mask);
+
+    // Without job control, children stay in the shell's process group
+    if (interactive == 1) posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+    else posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    // Execute command
+    res = posix_spawn(&pid, path, &actions, &attr, line->commands[i].argv, variableEnvironment());
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (res != 0) return -res;
+
+    return pid;
+}
+
+// ===========================[ Event Handlers ]===========================
+
+/**
+ * Handles the signals read from the signalfd
+ * 
+ * @param fd Signal file descriptor
+ * @param events Ready events
+ * @param data Unused
+ */
+void signalHandler(int fd, uint32_t events, void * data) {
+    struct signalfd_siginfo info;
+
+    while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGINT) ctrlC(SIGINT);
+        else if (info.ssi_signo == SIGTSTP) ctrlZ(SIGTSTP);
+        else if (info.ssi_signo == SIGCHLD && info.ssi_code == CLD_STOPPED) childStopHandler(info.ssi_pid);
+    }
 }
 
-// ===========================[ Signal Handlers ]==========================
+/**
+ * Reads the standard input when it is ready
+ * 
+ * @param fd Standard input
+ * @param events Ready events
+ * @param data Reader of the standard input
+ */
+void inputHandler(int fd, uint32_t events, void * data) {
+    fillInput((tinput *) data);
+}
 
 /**
  * Handles the SIGINT signal (Ctrl+C)
@@ -642,21 +2736,27 @@ int addJob(tline * line, char * command) {
  * @param sig Signal number
  */
 void ctrlC(int sig) {
-    int runningJobIndex = -1;
+    tjob * job = jobs->foreground;
 
-    // Get the index of the running job
-    runningJobIndex = getRunningJobIndex();
+    // Interrupt builtins waiting for jobs
+    interrupted = 1;
 
-    // Return if no job is running
-    if (runningJobIndex == -1) return;
+    // Show a new prompt if no job is running
+    if (job == NULL) {
+        if (readingInput == 1) {
+            fprintf(stdout, "\n");
+            printPrompt();
+        }
+        return;
+    }
 
     // Send SIGINT to all processes in the job's process group
-    if (DEBUG_MODE) fprintf(stdout, "Sending SIGINT to process group: %d\n", jobs[runningJobIndex]->pids[0]);
-    killpg(jobs[runningJobIndex]->pids[0], SIGINT);
+    if (DEBUG_MODE) fprintf(stdout, "Sending SIGINT to process group: %d\n", job->pgid);
+    killpg(job->pgid, SIGINT);
 
 
     // Print message
-    if (DEBUG_MODE) fprintf(stdout, "Killed [%d]\t %s\n", jobs[runningJobIndex]->id, jobs[runningJobIndex]->command);
+    if (DEBUG_MODE) fprintf(stdout, "Killed [%d]\t %s\n", job->id, job->command);
 }
 
 /**
@@ -665,112 +2765,121 @@ void ctrlC(int sig) {
  * @param sig Signal number
  */
 void ctrlZ(int sig){
-    int runningJobIndex = -1;
-
-    // Get the index of the running job
-    runningJobIndex = getRunningJobIndex();
+    tjob * job = jobs->foreground;
 
     // Return if no job is running
-    if (runningJobIndex == -1) return;
+    if (job == NULL) return;
 
     // Send SIGTSTP to all processes in the job's process group
-    if (DEBUG_MODE) fprintf(stdout, "Sending SIGTSTP to process group: %d\n", jobs[runningJobIndex]->pids[0]);
-    killpg(jobs[runningJobIndex]->pids[0], SIGTSTP);
+    if (DEBUG_MODE) fprintf(stdout, "Sending SIGTSTP to process group: %d\n", job->pgid);
+    killpg(job->pgid, SIGTSTP);
+}
+
+/**
+ * Handles a stopped child. SIGCHLD signals may be merged, so the rest of
+ * the foreground job is checked too.
+ * 
+ * @param pid Process that reported the stop
+ */
+void childStopHandler(pid_t pid) {
+    siginfo_t info;
+    tjob * job;
+    int i;
+
+    job = findJobByPid(jobs, pid, NULL);
+
+    if (job == NULL || job->status != 1) job = jobs->foreground;
+    if (job == NULL || job->status != 1) return;
+
+    for (i = 0; i < job->ncommands; i++) {
+        if (job->pids[i] <= 0) continue;
+
+        info.si_pid = 0;
+        if (waitid(P_PID, job->pids[i], &info, WSTOPPED | WNOHANG) == 0 && info.si_pid != 0) break;
+    }
+
+    if (i == job->ncommands) return;
+
+    // Mark the job as stopped, it stays in the store
+    job->status = 0;
+
+    if (job->background == 1) bgJobs--;
+    job->background = 0;
 
     // Update stopped jobs count and last stopped job id
     stoppedJobs++;
-    lastStoppedJobId = jobs[runningJobIndex]->id;
-    
+    lastStoppedJobId = job->id;
+
+    traceInstant("stop", NULL, 0, "job", job->id);
+
     // Print stopped job
-    fprintf(stdout, "\n[%d]+  Stopped\t\t %s", count, jobs[runningJobIndex]->command);
+    fprintf(stdout, "\n[%d]+  Stopped\t\t %s", job->id, job->command);
 }
 
 /**
- * Handles the SIGCHLD signal (Child terminated)
+ * Reaps a child whose pidfd became readable, with one waitid on it
  * 
- * @param sig Signal number
+ * @param fd Process file descriptor
+ * @param events Ready events
+ * @param data Process ID
  */
-void terminatedChildHandler(int sig) {
-    int i, j;
-    int all_terminated;
-    pid_t pid;
+void childExitHandler(int fd, uint32_t events, void * data) {
+    struct rusage usage;
+    pid_t pid = (pid_t) (long) data;
+    int stage, status;
+    tjobstore * store;
+    tjob * job;
 
-    // Check for terminated jobs
-    for (i = 0; i < MAX_COMMANDS; i++) {
+    // Reap with wait4 to keep the resource usage of the process
+    if (wait4(pid, &status, WNOHANG, &usage) <= 0) return;
 
-        // Initialize flag for each job
-        all_terminated = 1;
+    unwatchFd(fd);
+    close(fd);
 
-        if (jobs[i]->id != -1) {
-            for (j = 0; j < jobs[i]->line->ncommands; j++) {
-                pid = jobs[i]->pids[j];
+    // Jobs of server sessions are kept in the table of their session
+    store = findJobByPid(jobs, pid, NULL) != NULL ? jobs : findSessionStore(pid);
+    if (store == NULL) return;
 
-                // Check if the process has terminated
-                if (waitpid(pid, NULL, WNOHANG) == 0) {
-                    all_terminated = 0;
-                }
-            }
+    job = releasePid(store, pid, &stage);
 
-            if (all_terminated) {
-                // Debug message
-                if (DEBUG_MODE) fprintf(stdout, "All child processes for job [%d] have terminated.\n", jobs[i]->id);
+    recordStageUsage(job, stage, status, &usage);
 
-                // Update background jobs count if the job was running in the background
-                if (jobs[i]->background == 1) bgJobs--;
+    // The stage lifetime goes on its own track
+    traceSpan("run", job->stats[stage].name, job->stats[stage].start.tv_sec * 1000000000LL + job->stats[stage].start.tv_nsec,
+        pid, "status", job->stats[stage].exitStatus);
+    traceInstant("reap", job->stats[stage].name, 0, "pid", pid);
 
-                // Reset job so it can be used again
-                jobs[i]->id = -1;
-                jobs[i]->status = -1;
-            }
-        }
-    }
-}
+    // The status of the job is the one of its last command
+    if (stage == job->ncommands - 1) job->exitStatus = job->stats[stage].exitStatus;
 
-// =============================[ Utilities ]==============================
+    // Wait until every process of the job has terminated
+    if (job->alive > 0) return;
 
-/**
- * Searches for the foreground job running at the moment.
- * 
- * @return Index of the job in the jobs array, -1 if no job is running
-*/
-int getRunningJobIndex() {
-    int i;
+    finishCapture(store, job);
+    removeCgroup(job->cgroup);
+    job->cgroup = 0;
 
-    for (i = 0; i < MAX_COMMANDS; i++) {
-        if (jobs[i]->id != -1) {
-            // Skip background jobs and return if the job is running
-            if (jobs[i]->background == 0) {
-                if (jobs[i]->status == 1) return i;
-            }
-        }
+    // Jobs of sessions other than the one running a line are only cleaned up
+    if (store != jobs) {
+        if (job != store->foreground && job->owned == 0) removeJob(store, job);
+        return;
     }
 
-    return -1;
-}
+    completedJobs++;
+    lastCompletedId = job->id;
+    lastCompletedStatus = job->exitStatus;
 
-/**
- * Sorts the jobs array by job id
- * 
- * @param jobs Array of jobs to sort
-*/
-void sortJobsById(tjob * jobs[]){
-    qsort(jobs, MAX_COMMANDS, sizeof(tjob *), compareJobs);
-}
+    // Foreground jobs are removed by waitForegroundJob, owned ones by their builtin
+    if (job == store->foreground || job->owned) return;
 
-/**
- * Compares two jobs by their id
- * 
- * @param a First job
- * @param b Second job
- * @return -1 if a < b, 1 if a > b
-*/
-int compareJobs(const void * a, const void * b) {
-    tjob * jobA = *(tjob **) a;
-    tjob * jobB = *(tjob **) b;
+    // Debug message
+    if (DEBUG_MODE) fprintf(stdout, "All child processes for job [%d] have terminated.\n", job->id);
 
-    // Jobs with id -1 are considered greater than any other job
-    if (jobA->id == -1) return 1;
-    if (jobB->id == -1) return -1;
+    // Update background jobs count if the job was running in the background
+    if (store == &shellJobs) {
+        if (job->status == 0) stoppedJobs--;
+        else if (job->background == 1) bgJobs--;
+    }
 
-    return jobA->id - jobB->id;
-}
\ No newline at end of file
+    removeJob(store, job);
+}
@@ -0,0 +1,732 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+#include "memo.h"
+#include "variables.h"
+#include "relay.h"
+#include "arena.h"
+
+// ===========================[ Constants ]===========================
+#define RECORD_SIZE 256
+#define STORE_DIR_SIZE 2048
+#define COPY_CHUNK 65536
+
+// Misses between two full passes over the store while it is under capacity
+// (other shells add to it too, and replaced results leave garbage)
+#define TRIM_INTERVAL 64
+
+// Default variables that change the output of common tools (sort, ls...)
+#define LOCALE_VARIABLES 4
+
+// FNV-1a, 128 bits
+#define FNV_OFFSET ((((thash) 0x6c62272e07bb0142ULL) << 64) | 0x62b821756295c58dULL)
+#define FNV_PRIME ((((thash) 0x0000000001000000ULL) << 64) | 0x000000000000013bULL)
+
+// ===========================[ Structures ]==========================
+typedef unsigned __int128 thash;
+
+/**
+ * Stored result, as read back for eviction
+ *
+ * @param key: Key of the result
+ * @param used: Last time it was stored or replayed
+ * @param blobs: Names of the output and error blobs
+ */
+typedef struct {
+    char key[MEMO_KEY_SIZE];
+    time_t used;
+    char blobs[2][MEMO_KEY_SIZE];
+} trecord;
+
+/**
+ * Stored output, as listed for eviction
+ *
+ * @param name: Name of the blob (hash of its content)
+ * @param size: Size in bytes
+ * @param refs: Number of record entries that name it
+ */
+typedef struct {
+    char name[MEMO_KEY_SIZE];
+    off_t size;
+    int refs;
+} tblob;
+
+// ===========================[ Prototypes ]==========================
+static thash hashBytes(thash hash, const void * data, size_t length);
+static thash hashFileIdentity(thash hash, char * path, int always);
+static thash hashIdentity(thash hash, struct stat * st);
+static void formatHash(thash hash, char text[MEMO_KEY_SIZE]);
+static int hashFile(int fd, char name[MEMO_KEY_SIZE]);
+static int hashOutput(char * path, char name[MEMO_KEY_SIZE]);
+static int linkBlob(char * path, char name[MEMO_KEY_SIZE]);
+static int readRecord(char * key, time_t * created, int * status, char blobs[2][MEMO_KEY_SIZE]);
+static int openBlob(char * name);
+static int sendBlob(int blob, int fd);
+static int loadRecords(trecord ** records);
+static int listBlobs(tblob ** blobs);
+static tblob * findBlob(tblob * blobs, int n, char * name);
+static int compareBlobs(const void * a, const void * b);
+static int compareRecords(const void * a, const void * b);
+
+// ========================[ Global Variables ]=======================
+static char storeDir[STORE_DIR_SIZE] = "";
+static off_t storeSize = -1;
+static int missesSinceTrim = 0;
+static char * localeVariables[LOCALE_VARIABLES] = {"LANG", "LC_ALL", "LC_COLLATE", "LC_CTYPE"};
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Opens the result store: $MSH_CACHE_DIR, $XDG_CACHE_HOME/msh or
+ * ~/.cache/msh, with a keys directory (one record per key), a blobs
+ * directory (outputs named by the hash of their content) and a tmp
+ * directory for outputs being written
+ *
+ * @return 0 if successful, -1 if the store can not be created
+ */
+int openMemoStore() {
+    char path[MEMO_PATH_SIZE];
+    char * subdirs[] = {"keys", "blobs", "tmp"};
+    char * dir = getVariable("MSH_CACHE_DIR"), * base;
+    int i;
+
+    if (storeDir[0] != '\0') return 0;
+
+    if (dir != NULL && dir[0] != '\0') snprintf(storeDir, sizeof(storeDir), "%s", dir);
+    else if ((base = getVariable("XDG_CACHE_HOME")) != NULL && base[0] != '\0') snprintf(storeDir, sizeof(storeDir), "%s/msh", base);
+    else if ((base = getVariable("HOME")) != NULL) {
+        snprintf(storeDir, sizeof(storeDir), "%s/.cache", base);
+        mkdir(storeDir, 0700);
+        strncat(storeDir, "/msh", sizeof(storeDir) - strlen(storeDir) - 1);
+    } else return -1;
+
+    mkdir(storeDir, 0700);
+
+    for (i = 0; i < 3; i++) {
+        snprintf(path, sizeof(path), "%s/%s", storeDir, subdirs[i]);
+
+        if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+            fprintf(stderr, "Error: %s: %s\n", path, strerror(errno));
+            storeDir[0] = '\0';
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Computes the key of a pipeline: the argv and executable of every stage,
+ * the identity (dev, inode, size, mtime) of the input file and of the
+ * argument files, the content of a here-document, the working directory
+ * and the locale and selected variables. Without a redirection the first
+ * stage reads the shell's standard input, which only has a key when it is
+ * a regular file (its identity and offset) or a device other than a
+ * terminal.
+ *
+ * @param line Parsed (and expanded) line
+ * @param inputFd Here-document or here-string of the line (-1 if none)
+ * @param names Variables selected with --env
+ * @param nnames Number of selected variables
+ * @param key Hex key
+ * @return 0 if successful, -1 if the input of the line can not be keyed
+ */
+int memoKey(tline * line, int inputFd, char ** names, int nnames, char key[MEMO_KEY_SIZE]) {
+    char cwd[MEMO_PATH_SIZE], content[MEMO_KEY_SIZE], * value;
+    thash hash = FNV_OFFSET;
+    tcommand * command;
+    struct stat st;
+    long long offset;
+    int i, j;
+
+    if (line->redirect_input == NULL && inputFd == -1) {
+        if (fstat(STDIN_FILENO, &st) == -1) return -1;
+
+        if (S_ISREG(st.st_mode)) {
+            offset = (long long) lseek(STDIN_FILENO, 0, SEEK_CUR);
+            hash = hashBytes(hashIdentity(hash, &st), &offset, sizeof(offset));
+        } else if (S_ISCHR(st.st_mode) && !isatty(STDIN_FILENO)) {
+            hash = hashBytes(hash, &st.st_rdev, sizeof(st.st_rdev));
+        } else {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < line->ncommands; i++) {
+        command = &line->commands[i];
+
+        if (command->filename != NULL) hash = hashBytes(hash, command->filename, strlen(command->filename) + 1);
+
+        for (j = 0; j < command->argc; j++) {
+            hash = hashBytes(hash, command->argv[j], strlen(command->argv[j]) + 1);
+            if (j > 0) hash = hashFileIdentity(hash, command->argv[j], 0);
+        }
+
+        hash = hashBytes(hash, "|", 1);
+    }
+
+    if (line->redirect_input != NULL) hash = hashFileIdentity(hash, line->redirect_input, 1);
+    if (inputFd != -1 && hashFile(inputFd, content) == 0) hash = hashBytes(hash, content, MEMO_KEY_SIZE);
+
+    if (getcwd(cwd, sizeof(cwd)) != NULL) hash = hashBytes(hash, cwd, strlen(cwd) + 1);
+
+    for (i = 0; i < LOCALE_VARIABLES + nnames; i++) {
+        value = getVariable(i < LOCALE_VARIABLES ? localeVariables[i] : names[i - LOCALE_VARIABLES]);
+        hash = hashBytes(hash, value != NULL ? value : "", value != NULL ? strlen(value) + 1 : 0);
+        hash = hashBytes(hash, "=", 1);
+    }
+
+    formatHash(hash, key);
+    return 0;
+}
+
+/**
+ * Replays a stored result if there is one younger than ttl
+ *
+ * @param key Key of the pipeline
+ * @param ttl Maximum age in seconds (0: no limit)
+ * @param outFd Where the output goes
+ * @param errFd Where the errors go
+ * @param status Exit status of the stored run
+ * @return 0 if it was replayed, -1 if there is no valid result
+ */
+int replayMemo(char * key, long ttl, int outFd, int errFd, int * status) {
+    char path[MEMO_PATH_SIZE], blobs[2][MEMO_KEY_SIZE];
+    time_t created;
+    int out, err;
+
+    if (readRecord(key, &created, status, blobs) == -1) return -1;
+    if (ttl > 0 && time(NULL) - created >= ttl) return -1;
+
+    // Both blobs are opened before writing, another shell may have trimmed one
+    out = openBlob(blobs[0]);
+    err = out != -1 ? openBlob(blobs[1]) : -1;
+
+    if (err == -1) {
+        if (out != -1) close(out);
+        return -1;
+    }
+
+    sendBlob(out, outFd);
+    sendBlob(err, errFd);
+    close(out);
+    close(err);
+
+    // The modification time of a record is its last use
+    snprintf(path, sizeof(path), "%s/keys/%s", storeDir, key);
+    utimensat(AT_FDCWD, path, NULL, 0);
+
+    return 0;
+}
+
+/**
+ * Creates an empty file in the store for the output of a run
+ *
+ * @param path Path of the file
+ * @return 0 if successful, -1 otherwise
+ */
+int createMemoOutput(char path[MEMO_PATH_SIZE]) {
+    int fd;
+
+    snprintf(path, MEMO_PATH_SIZE, "%s/tmp/run.XXXXXX", storeDir);
+
+    fd = mkostemp(path, O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    close(fd);
+    return 0;
+}
+
+/**
+ * Stores the result of a run: the key records it and its outputs become
+ * blobs named by their content. The record is written before the blobs are
+ * linked, so a blob trimMemoStore finds is always referenced already.
+ *
+ * @param key Key of the pipeline
+ * @param outPath File with the output (linked into the store, the caller
+ *                removes it)
+ * @param errPath File with the errors (linked into the store, the caller
+ *                removes it)
+ * @param status Exit status of the run
+ * @return 0 if successful, -1 otherwise
+ */
+int storeMemo(char * key, char * outPath, char * errPath, int status) {
+    char path[MEMO_PATH_SIZE], temp[MEMO_PATH_SIZE], blobs[2][MEMO_KEY_SIZE], record[RECORD_SIZE];
+    int fd, length;
+
+    if (hashOutput(outPath, blobs[0]) == -1 || hashOutput(errPath, blobs[1]) == -1) return -1;
+
+    length = snprintf(record, sizeof(record), "msh-memo 1\n%lld\n%d\n%s\n%s\n", (long long) time(NULL), status, blobs[0], blobs[1]);
+
+    // Write the record aside and move it in place, readers never see half of it
+    snprintf(temp, sizeof(temp), "%s/tmp/key.XXXXXX", storeDir);
+    fd = mkostemp(temp, O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    if (writeAll(fd, record, length) == -1) {
+        close(fd);
+        unlink(temp);
+        return -1;
+    }
+
+    close(fd);
+
+    snprintf(path, sizeof(path), "%s/keys/%s", storeDir, key);
+
+    if (rename(temp, path) == -1) {
+        unlink(temp);
+        return -1;
+    }
+
+    if (linkBlob(outPath, blobs[0]) == -1 || linkBlob(errPath, blobs[1]) == -1) {
+        unlink(path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Copies an output to a file descriptor with sendfile (read and write when
+ * the target does not support it)
+ *
+ * @param path Output file
+ * @param fd Target
+ * @return 0 if successful, -1 if the file is missing
+ */
+int copyMemoOutput(char * path, int fd) {
+    int blob, res;
+
+    blob = open(path, O_RDONLY | O_CLOEXEC);
+    if (blob == -1) return -1;
+
+    res = sendBlob(blob, fd);
+    close(blob);
+
+    return res;
+}
+
+/**
+ * Removes the blobs no result uses anymore, then the least recently used
+ * results (and the blobs only they used) until the blobs fit in the
+ * capacity. The store is only walked when the size kept since the last
+ * walk is over the capacity, or every TRIM_INTERVAL calls.
+ *
+ * @param capacity Maximum size of the blobs
+ */
+void trimMemoStore(size_t capacity) {
+    char path[MEMO_PATH_SIZE];
+    trecord * records;
+    tblob * blobs, * blob;
+    off_t total = 0;
+    int n, nblobs, i, j, removed = 0;
+
+    if (storeSize != -1 && (size_t) storeSize <= capacity && ++missesSinceTrim < TRIM_INTERVAL) return;
+    missesSinceTrim = 0;
+
+    // Blobs are listed before the records are loaded: a result is recorded
+    // before its blobs are linked, so a listed blob in use has its record
+    nblobs = listBlobs(&blobs);
+    if (nblobs == -1) return;
+
+    n = loadRecords(&records);
+    if (n == -1) {
+        free(blobs);
+        return;
+    }
+
+    // Count the references of every blob (blobs linked since the listing are not ours)
+    if (nblobs > 0) qsort(blobs, nblobs, sizeof(tblob), compareBlobs);
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < 2; j++) {
+            blob = findBlob(blobs, nblobs, records[i].blobs[j]);
+            if (blob != NULL) blob->refs++;
+        }
+    }
+
+    // Garbage goes whatever the size, replaced and expired results leave some
+    for (i = 0; i < nblobs; i++) {
+        if (blobs[i].refs > 0) {
+            total += blobs[i].size;
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "%s/blobs/%s", storeDir, blobs[i].name);
+        unlink(path);
+    }
+
+    // Oldest first, a blob goes with the last result that uses it
+    if ((size_t) total > capacity) qsort(records, n, sizeof(trecord), compareRecords);
+
+    while (removed < n && (size_t) total > capacity) {
+        snprintf(path, sizeof(path), "%s/keys/%s", storeDir, records[removed].key);
+        unlink(path);
+
+        for (j = 0; j < 2; j++) {
+            blob = findBlob(blobs, nblobs, records[removed].blobs[j]);
+            if (blob == NULL || --blob->refs > 0) continue;
+
+            snprintf(path, sizeof(path), "%s/blobs/%s", storeDir, blob->name);
+            if (unlink(path) == 0) total -= blob->size;
+        }
+
+        removed++;
+    }
+
+    storeSize = total;
+
+    free(blobs);
+    free(records);
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Adds bytes to an FNV-1a hash
+ *
+ * @param hash Hash so far
+ * @param data Bytes to add
+ * @param length Number of bytes
+ * @return Updated hash
+ */
+static thash hashBytes(thash hash, const void * data, size_t length) {
+    const unsigned char * bytes = (const unsigned char *) data;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * Adds the identity of a file to a hash (dev, inode, size and mtime), so
+ * a result is not reused once the file changed
+ *
+ * @param hash Hash so far
+ * @param path Path of the file
+ * @param always Add a marker when the file does not exist (otherwise only
+ *               regular files are added)
+ * @return Updated hash
+ */
+static thash hashFileIdentity(thash hash, char * path, int always) {
+    struct stat st;
+
+    if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return always ? hashBytes(hash, "?", 1) : hash;
+    }
+
+    return hashIdentity(hash, &st);
+}
+
+/**
+ * Adds the dev, inode, size and mtime of a stat result to a hash
+ *
+ * @param hash Hash so far
+ * @param st Status of the file
+ * @return Updated hash
+ */
+static thash hashIdentity(thash hash, struct stat * st) {
+    long long identity[5];
+
+    identity[0] = (long long) st->st_dev;
+    identity[1] = (long long) st->st_ino;
+    identity[2] = (long long) st->st_size;
+    identity[3] = (long long) st->st_mtim.tv_sec;
+    identity[4] = (long long) st->st_mtim.tv_nsec;
+
+    return hashBytes(hash, identity, sizeof(identity));
+}
+
+/**
+ * Formats a hash as 32 hex digits
+ *
+ * @param hash Hash
+ * @param text Output
+ */
+static void formatHash(thash hash, char text[MEMO_KEY_SIZE]) {
+    snprintf(text, MEMO_KEY_SIZE, "%016llx%016llx", (unsigned long long) (hash >> 64), (unsigned long long) hash);
+}
+
+/**
+ * Hashes the content of a file
+ *
+ * @param fd Open file
+ * @param name Hex hash
+ * @return 0 if successful, -1 if it could not be read
+ */
+static int hashFile(int fd, char name[MEMO_KEY_SIZE]) {
+    thash hash = FNV_OFFSET;
+    struct stat st;
+    void * data;
+
+    if (fstat(fd, &st) == -1) return -1;
+
+    if (st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) return -1;
+
+        hash = hashBytes(hash, data, st.st_size);
+        munmap(data, st.st_size);
+    }
+
+    formatHash(hash, name);
+
+    return 0;
+}
+
+/**
+ * Names an output by its content
+ *
+ * @param path Output file
+ * @param name Name of its blob
+ * @return 0 if successful, -1 otherwise
+ */
+static int hashOutput(char * path, char name[MEMO_KEY_SIZE]) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC), res;
+
+    if (fd == -1) return -1;
+
+    res = hashFile(fd, name);
+    close(fd);
+
+    return res;
+}
+
+/**
+ * Links an output into the blobs (a blob with the same content is shared).
+ * The output itself is left in place.
+ *
+ * @param path Output file
+ * @param name Name of the blob
+ * @return 0 if successful, -1 otherwise
+ */
+static int linkBlob(char * path, char name[MEMO_KEY_SIZE]) {
+    char blob[MEMO_PATH_SIZE];
+    struct stat st;
+
+    snprintf(blob, sizeof(blob), "%s/blobs/%s", storeDir, name);
+
+    if (link(path, blob) == -1) return errno == EEXIST ? 0 : -1;
+
+    // Keep the size of the store up to date between the walks of trimMemoStore
+    if (storeSize != -1 && stat(blob, &st) == 0) storeSize += st.st_size;
+
+    return 0;
+}
+
+/**
+ * Reads the record of a key
+ *
+ * @param key Key to read
+ * @param created Time the result was stored
+ * @param status Exit status of the run
+ * @param blobs Names of the output and error blobs
+ * @return 0 if successful, -1 if there is no valid record
+ */
+static int readRecord(char * key, time_t * created, int * status, char blobs[2][MEMO_KEY_SIZE]) {
+    char path[MEMO_PATH_SIZE], record[RECORD_SIZE];
+    long long when;
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/keys/%s", storeDir, key);
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    n = read(fd, record, sizeof(record) - 1);
+    close(fd);
+
+    if (n <= 0) return -1;
+    record[n] = '\0';
+
+    if (sscanf(record, "msh-memo 1\n%lld\n%d\n%32s\n%32s\n", &when, status, blobs[0], blobs[1]) != 4) return -1;
+
+    *created = (time_t) when;
+
+    return 0;
+}
+
+/**
+ * Opens a blob for reading
+ *
+ * @param name Name of the blob
+ * @return File descriptor, -1 if the blob is missing
+ */
+static int openBlob(char * name) {
+    char path[MEMO_PATH_SIZE];
+
+    snprintf(path, sizeof(path), "%s/blobs/%s", storeDir, name);
+
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/**
+ * Copies an open output to a file descriptor with sendfile (read and write
+ * when the target does not support it)
+ *
+ * @param blob Output to copy
+ * @param fd Target
+ * @return 0 if successful, -1 if the output can not be read
+ */
+static int sendBlob(int blob, int fd) {
+    char buffer[COPY_CHUNK];
+    struct stat st;
+    off_t offset = 0;
+    ssize_t n;
+
+    if (fstat(blob, &st) == -1) return -1;
+
+    while (offset < st.st_size) {
+        n = sendfile(fd, blob, &offset, st.st_size - offset);
+        if (n > 0) continue;
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EINVAL || errno == ENOSYS)) break;
+
+        return 0;
+    }
+
+    // Targets sendfile can not write to
+    while (offset < st.st_size && (n = pread(blob, buffer, sizeof(buffer), offset)) > 0) {
+        if (writeAll(fd, buffer, n) == -1) break;
+        offset += n;
+    }
+
+    return 0;
+}
+
+/**
+ * Loads every record of the store
+ *
+ * @param records Loaded records (to free)
+ * @return Number of records, -1 if the store can not be read
+ */
+static int loadRecords(trecord ** records) {
+    char path[MEMO_PATH_SIZE];
+    int n = 0, capacity = 0, status;
+    struct dirent * entry;
+    struct stat st;
+    trecord * record;
+    time_t created;
+    DIR * dir;
+
+    snprintf(path, sizeof(path), "%s/keys", storeDir);
+    dir = opendir(path);
+    if (dir == NULL) return -1;
+
+    *records = NULL;
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (strlen(entry->d_name) != MEMO_KEY_SIZE - 1) continue;
+
+        if (n == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            *records = (trecord *) checkedRealloc(*records, sizeof(trecord) * capacity);
+        }
+
+        record = &(*records)[n];
+        strcpy(record->key, entry->d_name);
+
+        snprintf(path, sizeof(path), "%s/keys/%s", storeDir, entry->d_name);
+        if (stat(path, &st) == -1 || readRecord(record->key, &created, &status, record->blobs) == -1) continue;
+
+        record->used = st.st_mtime;
+        n++;
+    }
+
+    closedir(dir);
+
+    return n;
+}
+
+/**
+ * Lists the blobs of the store with their sizes
+ *
+ * @param blobs Listed blobs (to free)
+ * @return Number of blobs, -1 if the store can not be read
+ */
+static int listBlobs(tblob ** blobs) {
+    char path[MEMO_PATH_SIZE];
+    int n = 0, capacity = 0;
+    struct dirent * entry;
+    struct stat st;
+    DIR * dir;
+
+    snprintf(path, sizeof(path), "%s/blobs", storeDir);
+    dir = opendir(path);
+    if (dir == NULL) return -1;
+
+    *blobs = NULL;
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (strlen(entry->d_name) != MEMO_KEY_SIZE - 1) continue;
+        if (fstatat(dirfd(dir), entry->d_name, &st, 0) == -1) continue;
+
+        if (n == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            *blobs = (tblob *) checkedRealloc(*blobs, sizeof(tblob) * capacity);
+        }
+
+        strcpy((*blobs)[n].name, entry->d_name);
+        (*blobs)[n].size = st.st_size;
+        (*blobs)[n].refs = 0;
+        n++;
+    }
+
+    closedir(dir);
+
+    return n;
+}
+
+/**
+ * Finds a blob in a list sorted by name
+ *
+ * @param blobs Sorted blobs
+ * @param n Number of blobs
+ * @param name Name of the blob
+ * @return The blob, NULL if it is not listed
+ */
+static tblob * findBlob(tblob * blobs, int n, char * name) {
+    if (n == 0) return NULL;
+
+    return (tblob *) bsearch(name, blobs, n, sizeof(tblob), compareBlobs);
+}
+
+/**
+ * Compares two blobs by name for qsort and bsearch (a name is the first
+ * member of a blob)
+ *
+ * @param a First blob
+ * @param b Second blob
+ * @return Negative, zero or positive
+ */
+static int compareBlobs(const void * a, const void * b) {
+    return strcmp((const char *) a, (const char *) b);
+}
+
+/**
+ * Compares two records by last use for qsort
+ *
+ * @param a First record
+ * @param b Second record
+ * @return Negative, zero or positive
+ */
+static int compareRecords(const void * a, const void * b) {
+    const trecord * x = (const trecord *) a, * y = (const trecord *) b;
+
+    return (x->used > y->used) - (x->used < y->used);
+}
@@ -0,0 +1,25 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stddef.h>
+
+#include "parser.h"
+
+// ===========================[ Constants ]===========================
+#define MEMO_KEY_SIZE 33
+#define MEMO_PATH_SIZE 4096
+
+// Store size when the cachesize option is not set
+#define DEFAULT_MEMO_SIZE (256 * 1024 * 1024)
+
+// ===========================[ Prototypes ]==========================
+
+int openMemoStore();
+int memoKey(tline * line, int inputFd, char ** names, int nnames, char key[MEMO_KEY_SIZE]);
+int replayMemo(char * key, long ttl, int outFd, int errFd, int * status);
+int createMemoOutput(char path[MEMO_PATH_SIZE]);
+int storeMemo(char * key, char * outPath, char * errPath, int status);
+int copyMemoOutput(char * path, int fd);
+void trimMemoStore(size_t capacity);
+
+#endif
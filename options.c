@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "options.h"
+
+// ===========================[ Prototypes ]==========================
+static void formatSize(size_t size, char * buffer, size_t length);
+
+// ========================[ Global Variables ]=======================
+static char * affinityNames[] = {"none", "compact", "spread"};
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Sets the default options
+ *
+ * @param options Options to initialize
+ */
+void initOptions(toptions * options) {
+    options->pipeSize = 0;
+    options->affinity = AFFINITY_NONE;
+    options->cacheSize = 0;
+    options->captureSize = 0;
+}
+
+/**
+ * Applies a name=value assignment
+ *
+ * @param options Options to change
+ * @param assignment Assignment as typed by the user
+ * @return 0 if successful, -1 if the option or the value is not valid
+ */
+int setOption(toptions * options, char * assignment) {
+    char * value = strchr(assignment, '=');
+    size_t nameLength, size;
+    int i;
+
+    if (value == NULL) return -1;
+
+    nameLength = value - assignment;
+    value++;
+
+    // pipesize=<bytes>[K|M|G] or default
+    if (nameLength == 8 && strncmp(assignment, "pipesize", 8) == 0) {
+        if (strcmp(value, "default") == 0) {
+            options->pipeSize = 0;
+            return 0;
+        }
+
+        // F_SETPIPE_SZ takes an int
+        if (parseSize(value, &size) == -1 || size > INT_MAX) return -1;
+
+        options->pipeSize = size;
+        return 0;
+    }
+
+    // cachesize=<bytes>[K|M|G] or default
+    if (nameLength == 9 && strncmp(assignment, "cachesize", 9) == 0) {
+        if (strcmp(value, "default") == 0) {
+            options->cacheSize = 0;
+            return 0;
+        }
+
+        return parseSize(value, &options->cacheSize);
+    }
+
+    // capturesize=<bytes>[K|M|G] or default
+    if (nameLength == 11 && strncmp(assignment, "capturesize", 11) == 0) {
+        if (strcmp(value, "default") == 0) {
+            options->captureSize = 0;
+            return 0;
+        }
+
+        if (parseSize(value, &size) == -1 || size > MAX_CAPTURE_SIZE) return -1;
+
+        options->captureSize = size;
+        return 0;
+    }
+
+    // pipeline-affinity=none|compact|spread
+    if (nameLength == 17 && strncmp(assignment, "pipeline-affinity", 17) == 0) {
+        for (i = 0; i < 3; i++) {
+            if (strcmp(value, affinityNames[i]) == 0) {
+                options->affinity = i;
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Prints every option as name=value
+ *
+ * @param options Options to print
+ * @param fd File descriptor to write to
+ */
+void printOptions(toptions * options, int fd) {
+    char size[32];
+
+    formatSize(options->pipeSize, size, sizeof(size));
+
+    dprintf(fd, "pipesize=%s\n", size);
+    dprintf(fd, "pipeline-affinity=%s\n", affinityNames[options->affinity]);
+
+    formatSize(options->cacheSize, size, sizeof(size));
+    dprintf(fd, "cachesize=%s\n", size);
+
+    formatSize(options->captureSize, size, sizeof(size));
+    dprintf(fd, "capturesize=%s\n", size);
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Parses a size with an optional K, M or G (binary) suffix
+ *
+ * @param value Text to parse
+ * @param size Parsed size
+ * @return 0 if successful, -1 if it is not a valid size
+ */
+int parseSize(char * value, size_t * size) {
+    char * end;
+    unsigned long long n;
+    int shift = 0;
+
+    // strtoull would take a sign (wrapping negative values) and spaces
+    if (*value < '0' || *value > '9') return -1;
+
+    errno = 0;
+    n = strtoull(value, &end, 10);
+    if (errno == ERANGE) return -1;
+
+    switch (*end) {
+        case 'G': case 'g': shift = 30; end++; break;
+        case 'M': case 'm': shift = 20; end++; break;
+        case 'K': case 'k': shift = 10; end++; break;
+    }
+
+    if (*end != '\0' || n == 0 || n > (ULLONG_MAX >> shift) || (n << shift) > SIZE_MAX) return -1;
+
+    n <<= shift;
+
+    *size = (size_t) n;
+    return 0;
+}
+
+/**
+ * Formats a size with the largest exact suffix
+ *
+ * @param size Size to format (0 is the default)
+ * @param buffer Output buffer
+ * @param length Size of the buffer
+ */
+static void formatSize(size_t size, char * buffer, size_t length) {
+    char * suffixes = "KMG";
+    int i = -1;
+
+    if (size == 0) {
+        snprintf(buffer, length, "default");
+        return;
+    }
+
+    while (i < 2 && size % 1024 == 0) {
+        size /= 1024;
+        i++;
+    }
+
+    if (i == -1) snprintf(buffer, length, "%zu", size);
+    else snprintf(buffer, length, "%zu%c", size, suffixes[i]);
+}
@@ -0,0 +1,40 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <stddef.h>
+
+// ===========================[ Constants ]===========================
+
+// Pipeline stage placement
+#define AFFINITY_NONE 0
+#define AFFINITY_COMPACT 1
+#define AFFINITY_SPREAD 2
+
+// Largest ring of an &capture job, every captured job holds one
+#define MAX_CAPTURE_SIZE (64 * 1024 * 1024)
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Shell options changed with set
+ *
+ * @param pipeSize: Capacity of the pipes between stages (0 keeps the default)
+ * @param affinity: CPU placement of the pipeline stages
+ * @param cacheSize: Capacity of the cache builtin's result store (0 keeps the default)
+ * @param captureSize: Ring size of every &capture job (0 keeps the default)
+ */
+typedef struct {
+    size_t pipeSize;
+    int affinity;
+    size_t cacheSize;
+    size_t captureSize;
+} toptions;
+
+// ===========================[ Prototypes ]==========================
+
+void initOptions(toptions * options);
+int setOption(toptions * options, char * assignment);
+void printOptions(toptions * options, int fd);
+int parseSize(char * value, size_t * size);
+
+#endif
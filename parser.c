@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "parser.h"
+
+// ===========================[ Constants ]===========================
+#define INITIAL_WORDS 16
+#define INITIAL_COMMANDS 4
+
+// ===========================[ Prototypes ]==========================
+static int isSymbol(char c);
+static void * growArray(tarena * arena, void * array, int * capacity, size_t size);
+static tline * syntaxError();
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Tokenizes a line. Compatible with the original parser: the result is
+ * valid until the next call and commands are resolved through PATH.
+ *
+ * @param str Line to tokenize
+ * @return Parsed line, NULL if there's a syntax error
+ */
+tline * tokenize(char * str) {
+    static tarena arena;
+
+    resetArena(&arena);
+    return parseLine(&arena, str, searchCommand);
+}
+
+/**
+ * Tokenizes a line in a single pass into an arena. The line is copied once
+ * and every argv entry points into that copy, so the result lives until
+ * the arena is reset.
+ *
+ * Symbols: '|' (pipe), '<' (input, first command), '<<' (here-document
+ * delimiter), '<<<' (here-string), '>' (output, last command), '>&' (error, last command), '&' (background) and '&capture'
+ * (background with the output kept by the shell).
+ *
+ * @param arena Arena that holds the result
+ * @param str Line to tokenize
+ * @param resolver Function that resolves command paths (NULL to skip it)
+ * @return Parsed line, NULL if there's a syntax error
+ */
+tline * parseLine(tarena * arena, char * str, tresolver resolver) {
+    tline * line;
+    char ** words, * p, * word, c;
+    int * starts;
+    int nwords = 0, wordsCapacity = INITIAL_WORDS;
+    int ncommands = 0, commandsCapacity = INITIAL_COMMANDS;
+    int commandWords = 0, outputSeen = 0, i;
+    char pending = 0;
+    size_t len;
+
+    len = strlen(str);
+    p = (char *) arenaAlloc(arena, len + 1);
+    memcpy(p, str, len + 1);
+
+    line = (tline *) arenaAlloc(arena, sizeof(tline));
+    memset(line, 0, sizeof(tline));
+
+    words = (char **) arenaAlloc(arena, sizeof(char *) * wordsCapacity);
+    starts = (int *) arenaAlloc(arena, sizeof(int) * commandsCapacity);
+    starts[0] = 0;
+
+    while (*p != '\0') {
+        // Separators end the previous word
+        if (isspace((unsigned char) *p)) {
+            *p++ = '\0';
+            continue;
+        }
+
+        if (isSymbol(*p)) {
+            c = *p;
+            *p++ = '\0';
+
+            if (c == '>' && *p == '&') {
+                *p++ = '\0';
+                c = 'e';
+            }
+
+            // '<<' and '<<<' take the input from the shell instead of a file
+            if (c == '<' && *p == '<') {
+                *p++ = '\0';
+                c = 'h';
+
+                if (*p == '<') {
+                    *p++ = '\0';
+                    c = 's';
+                }
+            }
+
+            // A redirection must be followed by its file
+            if (pending != 0) return syntaxError();
+
+            if (c == '|') {
+                if (commandWords == 0 || outputSeen) return syntaxError();
+
+                if (nwords + 1 >= wordsCapacity) words = growArray(arena, words, &wordsCapacity, sizeof(char *));
+                words[nwords++] = NULL;
+
+                if (++ncommands >= commandsCapacity) starts = growArray(arena, starts, &commandsCapacity, sizeof(int));
+                starts[ncommands] = nwords;
+                commandWords = 0;
+
+            } else if (c == '<' || c == 'h' || c == 's') {
+                if (commandWords == 0 || ncommands > 0) return syntaxError();
+                if (line->redirect_input != NULL || line->here_document != NULL || line->here_string != NULL) return syntaxError();
+                pending = c;
+
+            } else if (c == '>') {
+                if (commandWords == 0 || line->redirect_output != NULL) return syntaxError();
+                pending = c;
+                outputSeen = 1;
+
+            } else if (c == 'e') {
+                if (commandWords == 0 || line->redirect_error != NULL) return syntaxError();
+                pending = c;
+                outputSeen = 1;
+
+            } else {
+                if (line->background) return syntaxError();
+                line->background = 1;
+
+                if (strncmp(p, "capture", 7) == 0 && (p[7] == '\0' || isspace((unsigned char) p[7]) || isSymbol(p[7]))) {
+                    line->capture = 1;
+                    p += 7;
+                }
+            }
+
+            continue;
+        }
+
+        // Words are left in place, the next separator terminates them
+        word = p;
+        while (*p != '\0' && !isspace((unsigned char) *p) && !isSymbol(*p)) p++;
+
+        if (pending == '<') line->redirect_input = word;
+        else if (pending == 'h') line->here_document = word;
+        else if (pending == 's') line->here_string = word;
+        else if (pending == '>') line->redirect_output = word;
+        else if (pending == 'e') line->redirect_error = word;
+        else {
+            if (nwords + 1 >= wordsCapacity) words = growArray(arena, words, &wordsCapacity, sizeof(char *));
+            words[nwords++] = word;
+            commandWords++;
+        }
+
+        pending = 0;
+    }
+
+    if (pending != 0) return syntaxError();
+
+    // Empty lines have no commands, a trailing pipe is an error
+    if (commandWords == 0) {
+        if (ncommands > 0) return syntaxError();
+        return line;
+    }
+
+    words[nwords++] = NULL;
+    ncommands++;
+
+    line->ncommands = ncommands;
+    line->commands = (tcommand *) arenaAlloc(arena, sizeof(tcommand) * ncommands);
+
+    for (i = 0; i < ncommands; i++) {
+        line->commands[i].argv = words + starts[i];
+        line->commands[i].argc = (i + 1 < ncommands ? starts[i + 1] - 1 : nwords - 1) - starts[i];
+        line->commands[i].filename = resolver != NULL ? resolver(arena, words[starts[i]]) : NULL;
+    }
+
+    return line;
+}
+
+/**
+ * Resolves a command through PATH (default resolver)
+ *
+ * @param arena Arena that holds the result
+ * @param name Command name
+ * @return Path of the executable, NULL if it was not found
+ */
+char * searchCommand(tarena * arena, char * name) {
+    char path[PATH_MAX];
+    char * dirs, * end;
+    size_t dirLen, nameLen;
+
+    // Paths are not searched
+    if (strchr(name, '/') != NULL) {
+        if (access(name, X_OK) == 0) return name;
+        return NULL;
+    }
+
+    dirs = getenv("PATH");
+    if (dirs == NULL) return NULL;
+
+    nameLen = strlen(name);
+
+    while (*dirs != '\0') {
+        end = strchr(dirs, ':');
+        dirLen = end != NULL ? (size_t) (end - dirs) : strlen(dirs);
+
+        if (dirLen + nameLen + 2 <= sizeof(path)) {
+            memcpy(path, dirs, dirLen);
+            path[dirLen] = '/';
+            memcpy(path + dirLen + 1, name, nameLen + 1);
+
+            if (access(path, X_OK) == 0) return arenaStrdup(arena, path);
+        }
+
+        if (end == NULL) break;
+        dirs = end + 1;
+    }
+
+    return NULL;
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Checks if a character is a shell symbol
+ *
+ * @param c Character to check
+ * @return 1 if it is a symbol, 0 otherwise
+ */
+static int isSymbol(char c) {
+    return c == '|' || c == '<' || c == '>' || c == '&';
+}
+
+/**
+ * Doubles an arena array (the old copy is released with the arena)
+ *
+ * @param arena Arena of the array
+ * @param array Array to grow
+ * @param capacity Capacity of the array, updated
+ * @param size Size of each element
+ * @return Grown array
+ */
+static void * growArray(tarena * arena, void * array, int * capacity, size_t size) {
+    void * grown = arenaAlloc(arena, size * (*capacity) * 2);
+
+    memcpy(grown, array, size * (*capacity));
+    *capacity *= 2;
+
+    return grown;
+}
+
+/**
+ * Reports a syntax error
+ *
+ * @return NULL
+ */
+static tline * syntaxError() {
+    fprintf(stderr, "Syntax error checking.\n");
+    return NULL;
+}
@@ -1,3 +1,7 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "arena.h"
 
 typedef struct {
 	char * filename;
@@ -12,7 +16,15 @@ typedef struct {
 	char * redirect_output;
 	char * redirect_error;
 	int background;
+	int capture;
+	char * here_document;
+	char * here_string;
 } tline;
 
+typedef char * (*tresolver)(tarena * arena, char * name);
+
 extern tline * tokenize(char *str);
+extern tline * parseLine(tarena * arena, char * str, tresolver resolver);
+extern char * searchCommand(tarena * arena, char * name);
 
+#endif
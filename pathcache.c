@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "pathcache.h"
+
+// ===========================[ Constants ]===========================
+#define CACHE_BUCKETS 256
+
+// ===========================[ Prototypes ]==========================
+static unsigned int hashName(char * name);
+static int validatePath();
+static char * searchPath(char * name);
+static void freeEntry(tpathentry * entry);
+
+// ========================[ Global Variables ]=======================
+static tpathentry * buckets[CACHE_BUCKETS];
+static char * cachedPath = NULL;
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Returns the absolute path of a command, filling the cache on first use
+ *
+ * @param name Command name (argv[0])
+ * @return Absolute path of the command, NULL if it was not found
+ */
+char * lookupCommand(char * name) {
+    tpathentry * entry;
+    struct stat st;
+    unsigned int index;
+    char * path;
+
+    // Paths are never searched in PATH, so there is nothing to cache
+    if (strchr(name, '/') != NULL) return name;
+
+    // Drop every entry if PATH changed since the cache was filled
+    validatePath();
+
+    index = hashName(name);
+
+    for (entry = buckets[index]; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            entry->hits++;
+            return entry->path;
+        }
+    }
+
+    path = searchPath(name);
+
+    if (path == NULL || stat(path, &st) == -1) {
+        free(path);
+        return NULL;
+    }
+
+    entry = (tpathentry *) malloc(sizeof(tpathentry));
+
+    // Check for malloc errors
+    if (entry == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        free(path);
+        return NULL;
+    }
+
+    entry->name = strdup(name);
+    entry->path = path;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->hits = 1;
+    entry->next = buckets[index];
+    buckets[index] = entry;
+
+    return entry->path;
+}
+
+/**
+ * Removes a command from the cache (e.g. when its path got ENOENT)
+ *
+ * @param name Command name to remove
+ */
+void forgetCommand(char * name) {
+    tpathentry ** entry, * removed;
+
+    for (entry = &buckets[hashName(name)]; *entry != NULL; entry = &(*entry)->next) {
+        if (strcmp((*entry)->name, name) == 0) {
+            removed = *entry;
+            *entry = removed->next;
+            freeEntry(removed);
+            return;
+        }
+    }
+}
+
+/**
+ * Removes every command from the cache
+ */
+void clearCommandCache() {
+    tpathentry * entry, * next;
+    int i;
+
+    for (i = 0; i < CACHE_BUCKETS; i++) {
+        for (entry = buckets[i]; entry != NULL; entry = next) {
+            next = entry->next;
+            freeEntry(entry);
+        }
+
+        buckets[i] = NULL;
+    }
+}
+
+/**
+ * Prints the cached commands in the format used by the hash builtin
+ *
+ * @param fd File descriptor to print to
+ */
+void printCommandCache(int fd) {
+    tpathentry * entry;
+    int i, empty = 1;
+
+    validatePath();
+
+    for (i = 0; i < CACHE_BUCKETS; i++) {
+        for (entry = buckets[i]; entry != NULL; entry = entry->next) {
+            if (empty) dprintf(fd, "hits\tinode\t\tcommand\n");
+            empty = 0;
+
+            dprintf(fd, "%4d\t%-10lu\t%s\n", entry->hits, (unsigned long) entry->ino, entry->path);
+        }
+    }
+
+    if (empty) dprintf(fd, "hash: hash table empty\n");
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Hashes a command name (FNV-1a)
+ *
+ * @param name Command name
+ * @return Bucket index
+ */
+static unsigned int hashName(char * name) {
+    unsigned int hash = 2166136261u;
+
+    while (*name != '\0') {
+        hash ^= (unsigned char) *name++;
+        hash *= 16777619u;
+    }
+
+    return hash % CACHE_BUCKETS;
+}
+
+/**
+ * Clears the cache if PATH changed since it was filled
+ *
+ * @return 1 if the cache was cleared, 0 otherwise
+ */
+static int validatePath() {
+    char * path = getenv("PATH");
+
+    if (path == NULL) path = "";
+    if (cachedPath != NULL && strcmp(cachedPath, path) == 0) return 0;
+
+    clearCommandCache();
+    free(cachedPath);
+    cachedPath = strdup(path);
+
+    return 1;
+}
+
+/**
+ * Searches a command in the PATH directories
+ *
+ * @param name Command name
+ * @return Allocated absolute path, NULL if it was not found
+ */
+static char * searchPath(char * name) {
+    char * dirs, * dir, * saveptr, * path;
+    size_t len;
+
+    if (cachedPath == NULL) return NULL;
+
+    dirs = strdup(cachedPath);
+
+    for (dir = strtok_r(dirs, ":", &saveptr); dir != NULL; dir = strtok_r(NULL, ":", &saveptr)) {
+        len = strlen(dir) + strlen(name) + 2;
+        path = (char *) malloc(len);
+
+        if (path == NULL) break;
+
+        snprintf(path, len, "%s/%s", dir, name);
+
+        if (access(path, X_OK) == 0) {
+            free(dirs);
+            return path;
+        }
+
+        free(path);
+    }
+
+    free(dirs);
+    return NULL;
+}
+
+/**
+ * Frees a cache entry
+ *
+ * @param entry Entry to free
+ */
+static void freeEntry(tpathentry * entry) {
+    free(entry->name);
+    free(entry->path);
+    free(entry);
+}
@@ -0,0 +1,35 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Command location cache entry
+ *
+ * @param name: Command name as typed by the user
+ * @param path: Absolute path of the executable
+ * @param dev: Device of the executable
+ * @param ino: Inode of the executable
+ * @param hits: Number of times the entry was used
+ * @param next: Next entry in the same bucket
+ */
+typedef struct tpathentry {
+    char * name;
+    char * path;
+    dev_t dev;
+    ino_t ino;
+    int hits;
+    struct tpathentry * next;
+} tpathentry;
+
+// ===========================[ Prototypes ]==========================
+
+char * lookupCommand(char * name);
+void forgetCommand(char * name);
+void clearCommandCache();
+void printCommandCache(int fd);
+
+#endif
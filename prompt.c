@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prompt.h"
+#include "variables.h"
+
+// ===========================[ Constants ]===========================
+#define DEFAULT_SEGMENTS "user,cwd"
+
+// ===========================[ Prototypes ]==========================
+static void formatSegment(tprompt * prompt, int segment);
+static void formatCwd(char * text);
+
+// ========================[ Global Variables ]=======================
+static char * segmentNames[SEGMENT_TYPES] = {"user", "cwd", "status", "jobs", "duration"};
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Initializes a prompt with the default segments (user and cwd)
+ *
+ * @param prompt Prompt to initialize
+ */
+void initPrompt(tprompt * prompt) {
+    memset(prompt, 0, sizeof(tprompt));
+    setPromptSegments(prompt, DEFAULT_SEGMENTS);
+}
+
+/**
+ * Sets the segments of a prompt from a comma separated list of names
+ * (user, cwd, status, jobs, duration)
+ *
+ * @param prompt Prompt to configure
+ * @param spec List of segments
+ * @return 0 if successful, -1 if a segment is not valid (nothing changes)
+ */
+int setPromptSegments(tprompt * prompt, char * spec) {
+    int segments[MAX_SEGMENTS], nsegments = 0, i;
+    char * name = spec;
+    size_t length;
+
+    while (*name != '\0') {
+        length = strcspn(name, ",");
+
+        for (i = 0; i < SEGMENT_TYPES; i++) {
+            if (strlen(segmentNames[i]) == length && strncmp(name, segmentNames[i], length) == 0) break;
+        }
+
+        if (i == SEGMENT_TYPES || nsegments == MAX_SEGMENTS) return -1;
+
+        segments[nsegments++] = i;
+        name += length;
+        if (*name == ',') name++;
+    }
+
+    memcpy(prompt->segments, segments, sizeof(segments));
+    prompt->nsegments = nsegments;
+    prompt->textValid = 0;
+
+    return 0;
+}
+
+/**
+ * Prints the segments of a prompt as accepted by setPromptSegments
+ *
+ * @param prompt Prompt to print
+ * @param fd File descriptor to write to
+ */
+void printPromptSegments(tprompt * prompt, int fd) {
+    int i;
+
+    dprintf(fd, "prompt=");
+    for (i = 0; i < prompt->nsegments; i++) dprintf(fd, "%s%s", i > 0 ? "," : "", segmentNames[prompt->segments[i]]);
+    dprintf(fd, "\n");
+}
+
+/**
+ * Marks a segment to be formatted again (e.g. cwd after cd)
+ *
+ * @param prompt Prompt to update
+ * @param segment Segment that changed
+ */
+void invalidatePrompt(tprompt * prompt, int segment) {
+    prompt->valid[segment] = 0;
+    prompt->textValid = 0;
+}
+
+/**
+ * Updates the exit status shown
+ *
+ * @param prompt Prompt to update
+ * @param status Exit status of the last line
+ */
+void setPromptStatus(tprompt * prompt, int status) {
+    if (status != prompt->status) invalidatePrompt(prompt, SEGMENT_STATUS);
+    prompt->status = status;
+}
+
+/**
+ * Updates the number of jobs shown
+ *
+ * @param prompt Prompt to update
+ * @param jobs Number of jobs in the job store
+ */
+void setPromptJobs(tprompt * prompt, int jobs) {
+    if (jobs != prompt->jobs) invalidatePrompt(prompt, SEGMENT_JOBS);
+    prompt->jobs = jobs;
+}
+
+/**
+ * Updates the duration of the last line shown
+ *
+ * @param prompt Prompt to update
+ * @param seconds Wall time of the last line
+ */
+void setPromptDuration(tprompt * prompt, double seconds) {
+    long duration = (long) (seconds * 1000);
+
+    if (duration != prompt->duration) invalidatePrompt(prompt, SEGMENT_DURATION);
+    prompt->duration = duration;
+}
+
+/**
+ * Renders a prompt, formatting only the segments whose input changed
+ *
+ * @param prompt Prompt to render
+ * @return Prompt text, valid until the next call
+ */
+char * renderPrompt(tprompt * prompt) {
+    size_t used = 0;
+    int i, segment;
+
+    if (prompt->textValid) return prompt->text;
+
+    prompt->text[0] = '\0';
+
+    for (i = 0; i < prompt->nsegments; i++) {
+        segment = prompt->segments[i];
+
+        if (!prompt->valid[segment]) formatSegment(prompt, segment);
+        if (prompt->texts[segment][0] == '\0') continue;
+
+        used += snprintf(prompt->text + used, PROMPT_SIZE - used, "%s ", prompt->texts[segment]);
+        if (used >= PROMPT_SIZE) used = PROMPT_SIZE - 1;
+    }
+
+    snprintf(prompt->text + used, PROMPT_SIZE - used, "$> ");
+    prompt->textValid = 1;
+
+    return prompt->text;
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Formats the text of a segment from its input
+ *
+ * @param prompt Prompt to update
+ * @param segment Segment to format
+ */
+static void formatSegment(tprompt * prompt, int segment) {
+    char * text = prompt->texts[segment], * user;
+
+    switch (segment) {
+        case SEGMENT_USER:
+            user = getVariable("USER") != NULL ? getVariable("USER") : getVariable("LOGNAME");
+            snprintf(text, SEGMENT_SIZE, "\033[1;32m%s@msh\033[0m:", user != NULL ? user : "");
+            break;
+
+        case SEGMENT_CWD:
+            formatCwd(text);
+            break;
+
+        case SEGMENT_STATUS:
+            if (prompt->status == 0) text[0] = '\0';
+            else snprintf(text, SEGMENT_SIZE, "\033[1;31mexit %d\033[0m", prompt->status);
+            break;
+
+        case SEGMENT_JOBS:
+            if (prompt->jobs == 0) text[0] = '\0';
+            else snprintf(text, SEGMENT_SIZE, "\033[1;33m%d job%s\033[0m", prompt->jobs, prompt->jobs > 1 ? "s" : "");
+            break;
+
+        case SEGMENT_DURATION:
+            if (prompt->duration < 1000) snprintf(text, SEGMENT_SIZE, "\033[2m%ldms\033[0m", prompt->duration);
+            else snprintf(text, SEGMENT_SIZE, "\033[2m%.1fs\033[0m", prompt->duration / 1000.0);
+            break;
+    }
+
+    prompt->valid[segment] = 1;
+}
+
+/**
+ * Formats the current directory, with the home directory shown as ~
+ *
+ * @param text Output for the segment
+ */
+static void formatCwd(char * text) {
+    char cwd[SEGMENT_SIZE - 32], * home = getVariable("HOME"), * shown = cwd;
+    size_t homeLength = home != NULL ? strlen(home) : 0;
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL) strcpy(cwd, "?");
+
+    // Only the home directory itself or its subdirectories
+    if (homeLength > 1 && strncmp(cwd, home, homeLength) == 0 && (cwd[homeLength] == '/' || cwd[homeLength] == '\0')) {
+        shown = cwd + homeLength;
+        snprintf(text, SEGMENT_SIZE, "\033[1;34m~%s\033[0m", shown);
+    } else {
+        snprintf(text, SEGMENT_SIZE, "\033[1;34m%s\033[0m", shown);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#include <stddef.h>
+
+// ===========================[ Constants ]===========================
+#define PROMPT_SIZE 4096
+#define SEGMENT_SIZE 1024
+#define MAX_SEGMENTS 8
+
+// Segments
+#define SEGMENT_USER 0
+#define SEGMENT_CWD 1
+#define SEGMENT_STATUS 2
+#define SEGMENT_JOBS 3
+#define SEGMENT_DURATION 4
+#define SEGMENT_TYPES 5
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Prompt made of segments. Each segment keeps its text and is formatted
+ * again only when its input changes.
+ *
+ * @param segments: Segments shown, in order
+ * @param nsegments: Number of segments shown
+ * @param texts: Formatted text of every segment type
+ * @param valid: Segment text up to date
+ * @param status: Exit status shown by the status segment
+ * @param jobs: Number of jobs shown by the jobs segment
+ * @param duration: Milliseconds shown by the duration segment
+ * @param text: Whole prompt
+ * @param textValid: Whole prompt up to date
+ */
+typedef struct {
+    int segments[MAX_SEGMENTS];
+    int nsegments;
+    char texts[SEGMENT_TYPES][SEGMENT_SIZE];
+    int valid[SEGMENT_TYPES];
+    int status;
+    int jobs;
+    long duration;
+    char text[PROMPT_SIZE];
+    int textValid;
+} tprompt;
+
+// ===========================[ Prototypes ]==========================
+
+void initPrompt(tprompt * prompt);
+int setPromptSegments(tprompt * prompt, char * spec);
+void printPromptSegments(tprompt * prompt, int fd);
+void invalidatePrompt(tprompt * prompt, int segment);
+void setPromptStatus(tprompt * prompt, int status);
+void setPromptJobs(tprompt * prompt, int jobs);
+void setPromptDuration(tprompt * prompt, double seconds);
+char * renderPrompt(tprompt * prompt);
+
+#endif
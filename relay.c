@@ -0,0 +1,292 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "relay.h"
+
+// ===========================[ Constants ]===========================
+#define RELAY_CHUNK (1 << 30)
+#define PIPE_CHUNK 65536
+#define COPY_SIZE 65536
+
+// Result of a zero-copy attempt that moved nothing and can be retried
+#define RELAY_UNSUPPORTED -2
+
+// ===========================[ Prototypes ]==========================
+static int copyRange(int in, int out);
+static int sendFile(int in, int out);
+static int spliceFd(int in, int out);
+static int spliceAll(int in, int out, size_t length);
+static int copyBuffer(int in, int * outs, int nouts);
+static int isSpliceTarget(int fd);
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Copies everything readable from a descriptor to another. The data is
+ * moved inside the kernel when the descriptor types allow it:
+ * copy_file_range between regular files, sendfile from a regular file and
+ * splice when either end is a pipe. Otherwise it goes through a buffer.
+ *
+ * @param in Descriptor to read from
+ * @param out Descriptor to write to
+ * @return 0 if successful, -1 if failed (errno is set)
+ */
+int relayFd(int in, int out) {
+    struct stat inStat, outStat;
+    int res = RELAY_UNSUPPORTED;
+
+    if (fstat(in, &inStat) == -1 || fstat(out, &outStat) == -1) return -1;
+
+    if (S_ISREG(inStat.st_mode) && S_ISREG(outStat.st_mode)) res = copyRange(in, out);
+    if (res == RELAY_UNSUPPORTED && S_ISREG(inStat.st_mode)) res = sendFile(in, out);
+    if (res == RELAY_UNSUPPORTED && (S_ISFIFO(inStat.st_mode) || S_ISFIFO(outStat.st_mode))) res = spliceFd(in, out);
+    if (res == RELAY_UNSUPPORTED) res = copyBuffer(in, &out, 1);
+
+    return res;
+}
+
+/**
+ * Copies everything readable from a descriptor to several ones. When the
+ * input is a pipe and every output accepts splice, the pipe pages are
+ * duplicated with tee into a scratch pipe and spliced to each output, so
+ * no byte is copied to user space.
+ *
+ * @param in Descriptor to read from
+ * @param outs Descriptors to write to
+ * @param nouts Number of outputs
+ * @return 0 if successful, -1 if failed (errno is set)
+ */
+int relayTee(int in, int * outs, int nouts) {
+    struct stat inStat;
+    int scratch[2];
+    ssize_t n, copied;
+    int i;
+
+    if (nouts == 1) return relayFd(in, outs[0]);
+    if (fstat(in, &inStat) == -1) return -1;
+
+    // Fall back to a buffer unless every end can be spliced
+    for (i = 0; i < nouts; i++) {
+        if (!isSpliceTarget(outs[i])) break;
+    }
+
+    if (!S_ISFIFO(inStat.st_mode) || i < nouts || pipe2(scratch, O_CLOEXEC) == -1) {
+        return copyBuffer(in, outs, nouts);
+    }
+
+    for (;;) {
+        // Duplicate the pending pages for every output but the last one
+        n = tee(in, scratch[1], PIPE_CHUNK, 0);
+
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+
+        if (spliceAll(scratch[0], outs[0], n) == -1) break;
+
+        for (i = 1; i < nouts - 1; i++) {
+            copied = tee(in, scratch[1], n, 0);
+
+            if (copied != n || spliceAll(scratch[0], outs[i], n) == -1) {
+                n = -1;
+                break;
+            }
+        }
+
+        // The last output consumes the pages from the input
+        if (n == -1 || spliceAll(in, outs[nouts - 1], n) == -1) {
+            n = -1;
+            break;
+        }
+    }
+
+    close(scratch[0]);
+    close(scratch[1]);
+
+    return n == 0 ? 0 : -1;
+}
+
+/**
+ * Writes every byte of a buffer
+ *
+ * @param fd File descriptor to write to
+ * @param data Bytes to write
+ * @param length Number of bytes
+ * @return 0 if successful, -1 if failed
+ */
+int writeAll(int fd, const char * data, size_t length) {
+    ssize_t n;
+
+    while (length > 0) {
+        n = write(fd, data, length);
+
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        data += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Copies between regular files with copy_file_range
+ *
+ * @param in Regular file to read from
+ * @param out Regular file to write to
+ * @return 0 if successful, -1 if failed, RELAY_UNSUPPORTED if nothing was
+ *         copied and the files do not support it
+ */
+static int copyRange(int in, int out) {
+    ssize_t n;
+    int moved = 0;
+
+    while ((n = copy_file_range(in, NULL, out, NULL, RELAY_CHUNK, 0)) != 0) {
+        if (n > 0) {
+            moved = 1;
+            continue;
+        }
+
+        if (errno == EINTR) continue;
+
+        // Cross-device copies on old kernels, O_APPEND outputs, ...
+        if (!moved && (errno == EXDEV || errno == EINVAL || errno == EBADF || errno == ENOSYS || errno == EOPNOTSUPP)) {
+            return RELAY_UNSUPPORTED;
+        }
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Copies a regular file to any descriptor with sendfile
+ *
+ * @param in Regular file to read from
+ * @param out Descriptor to write to
+ * @return 0 if successful, -1 if failed, RELAY_UNSUPPORTED if nothing was
+ *         copied and the output does not support it
+ */
+static int sendFile(int in, int out) {
+    ssize_t n;
+    int moved = 0;
+
+    while ((n = sendfile(out, in, NULL, RELAY_CHUNK)) != 0) {
+        if (n > 0) {
+            moved = 1;
+            continue;
+        }
+
+        if (errno == EINTR) continue;
+        if (!moved && (errno == EINVAL || errno == ENOSYS)) return RELAY_UNSUPPORTED;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Copies between descriptors with splice, one of them must be a pipe
+ *
+ * @param in Descriptor to read from
+ * @param out Descriptor to write to
+ * @return 0 if successful, -1 if failed, RELAY_UNSUPPORTED if nothing was
+ *         copied and the descriptors do not support it
+ */
+static int spliceFd(int in, int out) {
+    ssize_t n;
+    int moved = 0;
+
+    while ((n = splice(in, NULL, out, NULL, PIPE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE)) != 0) {
+        if (n > 0) {
+            moved = 1;
+            continue;
+        }
+
+        if (errno == EINTR) continue;
+        if (!moved && (errno == EINVAL || errno == ENOSYS)) return RELAY_UNSUPPORTED;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Splices an exact number of bytes from a pipe
+ *
+ * @param in Pipe to read from
+ * @param out Descriptor to write to
+ * @param length Number of bytes to move
+ * @return 0 if successful, -1 if failed
+ */
+static int spliceAll(int in, int out, size_t length) {
+    ssize_t n;
+
+    while (length > 0) {
+        n = splice(in, NULL, out, NULL, length, SPLICE_F_MOVE);
+
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        length -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * Copies through a user space buffer, the fallback for every other case
+ *
+ * @param in Descriptor to read from
+ * @param outs Descriptors to write to
+ * @param nouts Number of outputs
+ * @return 0 if successful, -1 if failed
+ */
+static int copyBuffer(int in, int * outs, int nouts) {
+    char buffer[COPY_SIZE];
+    ssize_t n;
+    int i;
+
+    while ((n = read(in, buffer, sizeof(buffer))) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        for (i = 0; i < nouts; i++) {
+            if (writeAll(outs[i], buffer, n) == -1) return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Checks if splice can write to a descriptor: pipes and regular files
+ * not opened in append mode
+ *
+ * @param fd Descriptor to check
+ * @return 1 if it can, 0 otherwise
+ */
+static int isSpliceTarget(int fd) {
+    struct stat fdStat;
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags == -1 || fstat(fd, &fdStat) == -1) return 0;
+    if (S_ISFIFO(fdStat.st_mode)) return 1;
+
+    return S_ISREG(fdStat.st_mode) && (flags & O_APPEND) == 0;
+}
@@ -0,0 +1,12 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stddef.h>
+
+// ===========================[ Prototypes ]==========================
+
+int relayFd(int in, int out);
+int relayTee(int in, int * outs, int nouts);
+int writeAll(int fd, const char * data, size_t length);
+
+#endif
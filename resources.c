@@ -0,0 +1,408 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/stat.h>
+
+#include "resources.h"
+#include "variables.h"
+
+// ===========================[ Constants ]===========================
+#define CPU_PERIOD 100000
+#define MAX_CPUS 65536
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Resource that ulimit can change
+ *
+ * @param option: Option letter of ulimit
+ * @param resource: RLIMIT_* resource
+ * @param scale: Bytes (or units) of one step of the value ulimit shows
+ * @param name: Description shown by ulimit -a
+ */
+typedef struct {
+    char option;
+    int resource;
+    rlim_t scale;
+    char * name;
+} tresource;
+
+// ===========================[ Prototypes ]==========================
+static int cgroupRoot();
+static int enableController(int root, int dir, char * controller, char * file);
+static int writeCgroupFile(int dir, char * file, char * value);
+static void effectiveLimit(tlimits * limits, int index, struct rlimit * limit);
+static void restrictCpus(double cpus, int job);
+
+// ========================[ Global Variables ]=======================
+static tresource resources[LIMIT_RESOURCES] = {
+    {'c', RLIMIT_CORE, 1024, "core file size (KiB)"},
+    {'d', RLIMIT_DATA, 1024, "data seg size (KiB)"},
+    {'f', RLIMIT_FSIZE, 1024, "file size (KiB)"},
+    {'l', RLIMIT_MEMLOCK, 1024, "max locked memory (KiB)"},
+    {'n', RLIMIT_NOFILE, 1, "open files"},
+    {'s', RLIMIT_STACK, 1024, "stack size (KiB)"},
+    {'t', RLIMIT_CPU, 1, "cpu time (seconds)"},
+    {'u', RLIMIT_NPROC, 1, "max user processes"},
+    {'v', RLIMIT_AS, 1024, "virtual memory (KiB)"}
+};
+
+// Directory jobs get their cgroups in (-2: not looked up yet, -1: none)
+static int cgroupRootFd = -2;
+static int cgroupCount = 0;
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Clears every limit
+ *
+ * @param limits Limits to initialize
+ */
+void initLimits(tlimits * limits) {
+    memset(limits, 0, sizeof(tlimits));
+}
+
+/**
+ * Checks if any limit has to be applied to the processes of a job
+ *
+ * @param limits Limits to check
+ * @return 1 if there is some limit, 0 otherwise
+ */
+int hasLimits(tlimits * limits) {
+    return limits->soft != 0 || limits->hard != 0 || limits->cpus > 0 || limits->memory > 0;
+}
+
+/**
+ * Finds a resource by its ulimit option letter
+ *
+ * @param option Option letter
+ * @return Index of the resource, -1 if there is none
+ */
+int findLimit(char option) {
+    int i;
+
+    for (i = 0; i < LIMIT_RESOURCES; i++) {
+        if (resources[i].option == option) return i;
+    }
+
+    return -1;
+}
+
+/**
+ * Sets the soft and/or hard limit of a resource for the processes the
+ * shell starts. The shell itself keeps its own limits.
+ *
+ * @param limits Limits to change
+ * @param index Index of the resource
+ * @param which LIMIT_SOFT, LIMIT_HARD or both
+ * @param value Number of units of the resource or "unlimited"
+ * @return 0 if successful, -1 if the value is not valid or over the hard limit
+ */
+int setLimit(tlimits * limits, int index, int which, char * value) {
+    struct rlimit current;
+    unsigned long long n;
+    rlim_t limit;
+    char * end;
+
+    if (strcmp(value, "unlimited") == 0) limit = RLIM_INFINITY;
+    else {
+        errno = 0;
+        n = strtoull(value, &end, 10);
+
+        if (end == value || *end != '\0' || errno != 0 || value[0] == '-') return -1;
+        if (n > RLIM_INFINITY / resources[index].scale) return -1;
+
+        limit = (rlim_t) n * resources[index].scale;
+    }
+
+    effectiveLimit(limits, index, &current);
+
+    // Only root raises a hard limit, and no soft limit goes over the hard one
+    if ((which & LIMIT_HARD) && limit > current.rlim_max && geteuid() != 0) return -1;
+    if (which == LIMIT_SOFT && limit > current.rlim_max) return -1;
+
+    if (which & LIMIT_SOFT) {
+        current.rlim_cur = limit;
+        limits->soft |= 1u << index;
+    }
+
+    if (which & LIMIT_HARD) {
+        current.rlim_max = limit;
+        limits->hard |= 1u << index;
+    }
+
+    // Keep the soft limit of the effective pair within the hard one
+    if (current.rlim_cur > current.rlim_max) {
+        current.rlim_cur = current.rlim_max;
+        limits->soft |= 1u << index;
+    }
+
+    limits->values[index] = current;
+
+    return 0;
+}
+
+/**
+ * Prints the limit the processes of a job get for a resource
+ *
+ * @param limits Limits of the shell
+ * @param index Index of the resource
+ * @param which LIMIT_SOFT or LIMIT_HARD
+ * @param fd File descriptor to write to
+ * @param verbose Print the description and option too (ulimit -a)
+ */
+void printLimit(tlimits * limits, int index, int which, int fd, int verbose) {
+    struct rlimit limit;
+    rlim_t value;
+
+    effectiveLimit(limits, index, &limit);
+    value = which == LIMIT_HARD ? limit.rlim_max : limit.rlim_cur;
+
+    if (verbose) dprintf(fd, "%-28s(-%c) ", resources[index].name, resources[index].option);
+
+    if (value == RLIM_INFINITY) dprintf(fd, "unlimited\n");
+    else dprintf(fd, "%llu\n", (unsigned long long) (value / resources[index].scale));
+}
+
+/**
+ * Parses a number of CPUs, fractions allowed (0.5 is half a CPU)
+ *
+ * @param value Text to parse
+ * @param cpus Parsed number of CPUs
+ * @return 0 if successful, -1 if it is not a valid number
+ */
+int parseCpus(char * value, double * cpus) {
+    char * end;
+    double n = strtod(value, &end);
+
+    if (end == value || *end != '\0' || !(n > 0) || n > MAX_CPUS) return -1;
+
+    *cpus = n;
+    return 0;
+}
+
+// ==========================[ Job placement ]========================
+
+/**
+ * Creates a cgroup v2 for a job with the CPU and memory limits. Jobs go
+ * under $MSH_CGROUP when it is set (a delegated, writable cgroup).
+ *
+ * @param limits Limits of the job
+ * @param procsFd Output for the cgroup.procs descriptor the stages join with
+ * @return Id of the cgroup, 0 if cgroups can not be used (rlimits apply)
+ */
+int createCgroup(tlimits * limits, int * procsFd) {
+    char name[64], value[64];
+    int root, dir, id, res = 0;
+
+    *procsFd = -1;
+
+    if (limits->cpus <= 0 && limits->memory == 0) return 0;
+
+    root = cgroupRoot();
+    if (root == -1) return 0;
+
+    id = ++cgroupCount;
+    snprintf(name, sizeof(name), "msh-%d-%d", (int) getpid(), id);
+
+    if (mkdirat(root, name, 0755) == -1) return 0;
+
+    dir = openat(root, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir == -1) res = -1;
+
+    if (res == 0 && limits->cpus > 0) {
+        snprintf(value, sizeof(value), "%lld %d", (long long) (limits->cpus * CPU_PERIOD + 0.5), CPU_PERIOD);
+        res = enableController(root, dir, "+cpu", "cpu.max");
+        if (res == 0) res = writeCgroupFile(dir, "cpu.max", value);
+    }
+
+    if (res == 0 && limits->memory > 0) {
+        snprintf(value, sizeof(value), "%zu", limits->memory);
+        res = enableController(root, dir, "+memory", "memory.max");
+        if (res == 0) res = writeCgroupFile(dir, "memory.max", value);
+    }
+
+    if (res == 0) {
+        *procsFd = openat(dir, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+        if (*procsFd == -1) res = -1;
+    }
+
+    if (dir != -1) close(dir);
+
+    if (res == -1) {
+        unlinkat(root, name, AT_REMOVEDIR);
+        return 0;
+    }
+
+    return id;
+}
+
+/**
+ * Removes the cgroup of a job once its processes are gone. It is left in
+ * place if something the job started is still in it.
+ *
+ * @param id Id of the cgroup
+ */
+void removeCgroup(int id) {
+    char name[64];
+
+    if (id == 0 || cgroupRootFd < 0) return;
+
+    snprintf(name, sizeof(name), "msh-%d-%d", (int) getpid(), id);
+    unlinkat(cgroupRootFd, name, AT_REMOVEDIR);
+}
+
+/**
+ * Applies the limits in a forked child before it execs. The child joins
+ * the job's cgroup when there is one; otherwise --mem becomes an address
+ * space limit and --cpu keeps the child on that many CPUs.
+ *
+ * @param limits Limits of the job
+ * @param procsFd cgroup.procs of the job's cgroup (-1 if none)
+ * @param job Id of the job (spreads the CPUs of --cpu between jobs)
+ */
+void applyLimits(tlimits * limits, int procsFd, int job) {
+    struct rlimit limit;
+    int i, placed = 0;
+
+    // Writing 0 moves the writing process
+    if (procsFd != -1) placed = write(procsFd, "0", 1) == 1;
+
+    for (i = 0; i < LIMIT_RESOURCES; i++) {
+        if (((limits->soft | limits->hard) & (1u << i)) == 0) continue;
+
+        if (setrlimit(resources[i].resource, &limits->values[i]) == -1) {
+            fprintf(stderr, "Error: setrlimit failed: %s\n", strerror(errno));
+        }
+    }
+
+    if (placed) return;
+
+    if (limits->memory > 0 && getrlimit(RLIMIT_AS, &limit) == 0) {
+        if (limit.rlim_max > limits->memory) limit.rlim_max = limits->memory;
+        if (limit.rlim_cur > limit.rlim_max) limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_AS, &limit);
+    }
+
+    if (limits->cpus > 0) restrictCpus(limits->cpus, job);
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Opens the directory job cgroups are created in: $MSH_CGROUP, a
+ * delegated cgroup v2 without processes of its own. The shell's own cgroup
+ * is not used, it holds the shell, so cgroup v2 would not let it enable
+ * controllers for its children.
+ *
+ * @return Directory descriptor, -1 if there is no usable cgroup v2
+ */
+static int cgroupRoot() {
+    char * base;
+
+    if (cgroupRootFd != -2) return cgroupRootFd;
+    cgroupRootFd = -1;
+
+    base = getVariable("MSH_CGROUP");
+    if (base != NULL && base[0] != '\0') cgroupRootFd = open(base, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    return cgroupRootFd;
+}
+
+/**
+ * Makes a controller available to a job cgroup, enabling it for the
+ * children of the root if needed (fails if the root has processes)
+ *
+ * @param root Directory of the parent cgroup
+ * @param dir Directory of the job cgroup
+ * @param controller "+cpu" or "+memory"
+ * @param file Interface file that exists once the controller is enabled
+ * @return 0 if successful, -1 otherwise
+ */
+static int enableController(int root, int dir, char * controller, char * file) {
+    if (faccessat(dir, file, F_OK, 0) == 0) return 0;
+    if (writeCgroupFile(root, "cgroup.subtree_control", controller) == -1) return -1;
+
+    return faccessat(dir, file, F_OK, 0);
+}
+
+/**
+ * Writes a value to a cgroup interface file
+ *
+ * @param dir Directory of the cgroup
+ * @param file Interface file
+ * @param value Value to write
+ * @return 0 if successful, -1 otherwise
+ */
+static int writeCgroupFile(int dir, char * file, char * value) {
+    ssize_t length = strlen(value);
+    int fd, res;
+
+    fd = openat(dir, file, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    res = write(fd, value, length) == length ? 0 : -1;
+    close(fd);
+
+    return res;
+}
+
+/**
+ * Gets the limits a child gets for a resource: the ones set with ulimit
+ * over the shell's own
+ *
+ * @param limits Limits of the shell
+ * @param index Index of the resource
+ * @param limit Output for the limits
+ */
+static void effectiveLimit(tlimits * limits, int index, struct rlimit * limit) {
+    if (getrlimit(resources[index].resource, limit) == -1) {
+        limit->rlim_cur = RLIM_INFINITY;
+        limit->rlim_max = RLIM_INFINITY;
+    }
+
+    if (limits->soft & (1u << index)) limit->rlim_cur = limits->values[index].rlim_cur;
+    if (limits->hard & (1u << index)) limit->rlim_max = limits->values[index].rlim_max;
+}
+
+/**
+ * Keeps the calling process on some CPUs of its affinity mask. Each job
+ * starts further along the mask, like placeStage spreads stages, so jobs
+ * do not all pile onto the first CPUs.
+ *
+ * @param cpus Number of CPUs (rounded up)
+ * @param job Id of the job
+ */
+static void restrictCpus(double cpus, int job) {
+    cpu_set_t allowed, set;
+    int cpu, n, i, start, slot, left = (int) cpus;
+
+    // Part of a CPU takes a whole one
+    if (left < cpus) left++;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) return;
+
+    n = CPU_COUNT(&allowed);
+    if (left >= n) return;
+
+    // The left allowed CPUs from the job's slot on, wrapping around
+    CPU_ZERO(&set);
+    start = (int) (((long long) job * left) % n);
+
+    for (i = 0; i < left; i++) {
+        slot = (start + i) % n;
+
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed) && slot-- == 0) break;
+        }
+
+        CPU_SET(cpu, &set);
+    }
+
+    sched_setaffinity(0, sizeof(set), &set);
+}
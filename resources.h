@@ -0,0 +1,47 @@
+#ifndef RESOURCES_H
+#define RESOURCES_H
+
+#include <stddef.h>
+#include <sys/resource.h>
+
+// ===========================[ Constants ]===========================
+#define LIMIT_RESOURCES 9
+
+// Which value of a resource limit is changed or shown
+#define LIMIT_SOFT 1
+#define LIMIT_HARD 2
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Limits applied to the processes of a job before they exec
+ *
+ * @param soft: Bitmask of the resources with a soft limit set
+ * @param hard: Bitmask of the resources with a hard limit set
+ * @param values: Limits of every resource (ulimit)
+ * @param cpus: CPUs the job may use (limit --cpu, 0: no limit)
+ * @param memory: Bytes of memory the job may use (limit --mem, 0: no limit)
+ */
+typedef struct {
+    unsigned int soft;
+    unsigned int hard;
+    struct rlimit values[LIMIT_RESOURCES];
+    double cpus;
+    size_t memory;
+} tlimits;
+
+// ===========================[ Prototypes ]==========================
+
+void initLimits(tlimits * limits);
+int hasLimits(tlimits * limits);
+int findLimit(char option);
+int setLimit(tlimits * limits, int index, int which, char * value);
+void printLimit(tlimits * limits, int index, int which, int fd, int verbose);
+int parseCpus(char * value, double * cpus);
+
+// Job placement
+int createCgroup(tlimits * limits, int * procsFd);
+void removeCgroup(int id);
+void applyLimits(tlimits * limits, int procsFd, int job);
+
+#endif
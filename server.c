@@ -0,0 +1,685 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include "server.h"
+#include "events.h"
+#include "relay.h"
+#include "capture.h"
+
+// ===========================[ Constants ]===========================
+#define OUTPUT_CHUNK 65536
+#define HEADER_SIZE 32
+
+// ===========================[ Prototypes ]==========================
+static void acceptHandler(int fd, uint32_t events, void * data);
+static void sessionHandler(int fd, uint32_t events, void * data);
+static void outputHandler(int fd, uint32_t events, void * data);
+static void pumpSession(tsession * session);
+static int waitDone(tsession * session);
+static int endWait(tsession * session);
+static int handleRequest(tsession * session, char * request);
+static void finishLine(tsession * session);
+static void closeOutput(tsession * session);
+static void closeSession(tsession * session);
+static void sendFrame(tsession * session, char * data, size_t length);
+static void sendStatus(tsession * session, int status);
+static void queueReply(tsession * session, const char * data, size_t length);
+static void flushSession(tsession * session);
+static void updateSession(tsession * session);
+static int sendAll(int fd, const char * data, size_t length);
+static int readReplies(tinput * replies);
+static int readFrame(tinput * input, size_t length, int out);
+
+// ========================[ Global Variables ]=======================
+static tsession * sessions = NULL;
+static tlinerunner lineRunner = NULL;
+static tlinefinisher lineFinisher = NULL;
+static int startCwdFd = -1;
+static mode_t startMask = 0;
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Serves command lines on a Unix socket until the process is killed. Every
+ * connection is a session multiplexed on the event loop: its requests are
+ * read as they arrive and its lines are run one at a time. Replies are
+ * queued on non-blocking sockets, a client that stops reading only holds
+ * its own session.
+ *
+ * Requests (one per line):
+ *     run <command line>    Runs a line
+ *     capture on|off        Sends the output of the next lines back
+ * Replies (every request ends with a status):
+ *     out <n>\n<n bytes>    Output of the line (only with capture on)
+ *     status <n>            Exit status, once the line is done
+ *
+ * @param path Path of the socket (a stale socket there is replaced)
+ * @param runner Function that runs the lines
+ * @param finisher Function called when the job of a line is done
+ * @return 1 if the socket could not be created (it only returns on errors)
+ */
+int runServer(char * path, tlinerunner runner, tlinefinisher finisher) {
+    struct sockaddr_un address;
+    struct stat socketStat;
+    tsession * session, * next;
+    int listenFd;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: %s: socket path too long\n", path);
+        return 1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    // Replace the socket of a server that did not clean up
+    if (stat(path, &socketStat) == 0 && S_ISSOCK(socketStat.st_mode)) unlink(path);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (listenFd == -1 || bind(listenFd, (struct sockaddr *) &address, sizeof(address)) == -1 || listen(listenFd, SOMAXCONN) == -1) {
+        fprintf(stderr, "Error: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    // Clients that go away must not kill the server (children get SIGPIPE back)
+    signal(SIGPIPE, SIG_IGN);
+
+    // New sessions start where the server was started, whatever the lines
+    // of other sessions changed
+    lineRunner = runner;
+    lineFinisher = finisher;
+    startCwdFd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    startMask = umask(0);
+    umask(startMask);
+
+    watchFd(listenFd, EPOLLIN, acceptHandler, NULL);
+
+    for (;;) {
+        runEvents(-1);
+
+        for (session = sessions; session != NULL; session = next) {
+            next = session->next;
+            pumpSession(session);
+        }
+    }
+}
+
+/**
+ * Runs the lines of an input on a server and writes their output. Each line
+ * is sent once the previous one is done.
+ *
+ * @param path Path of the server socket
+ * @param input Lines to run
+ * @param capture Ask for the output of the lines
+ * @return Exit status of the last line, 2 if the server can not be reached
+ */
+int runClient(char * path, tinput * input, int capture) {
+    struct sockaddr_un address;
+    tinput replies;
+    char * line;
+    int fd, status = 0;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd == -1 || connect(fd, (struct sockaddr *) &address, sizeof(address)) == -1) {
+        fprintf(stderr, "Error: %s: %s\n", path, strerror(errno));
+        return 2;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    initInput(&replies, fd);
+
+    if (capture && (sendAll(fd, "capture on\n", 11) == -1 || readReplies(&replies) == -1)) status = -1;
+
+    while (status != -1) {
+        while ((line = nextLine(input)) == NULL && input->eof == 0) fillInput(input);
+        if (line == NULL) break;
+
+        if (sendAll(fd, "run ", 4) == -1 || sendAll(fd, line, strlen(line)) == -1) status = -1;
+        else status = readReplies(&replies);
+    }
+
+    if (status == -1) {
+        fprintf(stderr, "Error: %s: connection closed\n", path);
+        status = 2;
+    }
+
+    close(fd);
+    freeInput(&replies);
+
+    return status;
+}
+
+/**
+ * Streams the output of the job of a session to its client as it arrives
+ *
+ * @param session Session running a job
+ * @param fd Read end of the output of the job
+ */
+void watchSessionOutput(tsession * session, int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    session->outputFd = fd;
+    watchFd(fd, EPOLLIN, outputHandler, session);
+}
+
+/**
+ * Sends the contents of a file to the client of a session as output
+ * frames (e.g. the output of a builtin kept in a memfd)
+ *
+ * @param session Session to send to
+ * @param fd File to send (from its start)
+ */
+void sendSessionFile(tsession * session, int fd) {
+    char buffer[OUTPUT_CHUNK];
+    off_t offset = 0;
+    ssize_t n;
+
+    while ((n = pread(fd, buffer, sizeof(buffer), offset)) != 0) {
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) break;
+
+        sendFrame(session, buffer, n);
+        offset += n;
+    }
+}
+
+/**
+ * Makes the current line of a session wait for the background jobs its
+ * wait builtin marked as owned. The server finishes the line once they are
+ * done, so a wait never blocks the other sessions.
+ *
+ * @param session Session running the line
+ * @param mode SESSION_WAIT_ALL (every owned job) or SESSION_WAIT_NEXT (the
+ *             first one to finish)
+ * @param job Job whose status ends the wait (NULL: status)
+ * @param status Status of the wait when there is no job
+ * @return Exit status if there is nothing to wait for, SESSION_RUNNING otherwise
+ */
+int waitSessionJobs(tsession * session, int mode, tjob * job, int status) {
+    session->waiting = mode;
+    session->waitJob = job;
+    session->waitStatus = status;
+
+    if (waitDone(session) == 0) return SESSION_RUNNING;
+
+    return endWait(session);
+}
+
+/**
+ * Finds the job table of the session a process belongs to
+ *
+ * @param pid Process to find
+ * @return Job table of its session, NULL if it is not a session job
+ */
+tjobstore * findSessionStore(pid_t pid) {
+    tsession * session;
+
+    for (session = sessions; session != NULL; session = session->next) {
+        if (findJobByPid(&session->jobs, pid, NULL) != NULL) return &session->jobs;
+    }
+
+    return NULL;
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Accepts a new client as a session, starting in the directory and with
+ * the mask the server was started with
+ *
+ * @param fd Listening socket
+ * @param events Ready events
+ * @param data Unused
+ */
+static void acceptHandler(int fd, uint32_t events, void * data) {
+    tsession * session;
+    int client;
+
+    client = accept4(fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (client == -1) return;
+
+    session = (tsession *) calloc(1, sizeof(tsession));
+
+    // Check for malloc errors
+    if (session == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    session->fd = client;
+    session->cwdFd = startCwdFd != -1 ? fcntl(startCwdFd, F_DUPFD_CLOEXEC, 0) : -1;
+    session->mask = startMask;
+    session->outputFd = -1;
+
+    initInput(&session->input, client);
+    initJobStore(&session->jobs);
+
+    session->next = sessions;
+    sessions = session;
+
+    watchFd(client, EPOLLIN, sessionHandler, session);
+}
+
+/**
+ * Reads the requests of a session and sends its queued replies. Requests
+ * are run by the server loop, so a blocking line never runs inside another
+ * one.
+ *
+ * @param fd Client socket
+ * @param events Ready events
+ * @param data Session
+ */
+static void sessionHandler(int fd, uint32_t events, void * data) {
+    tsession * session = (tsession *) data;
+
+    if (session->input.eof == 0 && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) fillInput(&session->input);
+
+    flushSession(session);
+}
+
+/**
+ * Sends the output of a session job as it arrives
+ *
+ * @param fd Read end of the output
+ * @param events Ready events
+ * @param data Session
+ */
+static void outputHandler(int fd, uint32_t events, void * data) {
+    tsession * session = (tsession *) data;
+    char buffer[OUTPUT_CHUNK];
+    ssize_t n;
+
+    n = read(fd, buffer, sizeof(buffer));
+
+    if (n > 0) sendFrame(session, buffer, n);
+    else if (n == 0 || (errno != EAGAIN && errno != EINTR)) closeOutput(session);
+}
+
+/**
+ * Finishes the line of a session if its job is done and runs the next
+ * requests until one starts a job. Requests wait while the client is
+ * behind on its replies. Sessions whose client is gone are closed once
+ * their last line is done and its replies are sent.
+ *
+ * @param session Session to advance
+ */
+static void pumpSession(tsession * session) {
+    char * request;
+    int status;
+
+    for (;;) {
+        if (session->job != NULL) {
+            if (session->job->alive > 0) return;
+            finishLine(session);
+        }
+
+        if (session->waiting) {
+            if (waitDone(session) == 0) return;
+            sendStatus(session, endWait(session));
+        }
+
+        if (session->closing || session->broken) break;
+        if (session->queueEnd - session->queueStart >= SESSION_QUEUE_LIMIT) return;
+
+        request = nextLine(&session->input);
+        if (request == NULL) break;
+
+        status = handleRequest(session, request);
+        if (status != SESSION_RUNNING) sendStatus(session, status);
+    }
+
+    if (session->queueEnd > session->queueStart) return;
+
+    if (session->closing || session->broken || (session->input.eof && session->input.start == session->input.end)) closeSession(session);
+}
+
+/**
+ * Checks whether the wait of a session is over. The owned background jobs
+ * stay in the table once reaped, so their status is still there.
+ *
+ * @param session Waiting session
+ * @return 1 if the wait is over, 0 otherwise
+ */
+static int waitDone(tsession * session) {
+    tjob * job;
+    int running = 0;
+
+    for (job = session->jobs.head; job != NULL; job = job->next) {
+        if (job->owned == 0 || job->background == 0) continue;
+
+        if (job->alive > 0) running++;
+        else if (session->waiting == SESSION_WAIT_NEXT && session->waitJob == NULL) session->waitJob = job;
+    }
+
+    return running == 0 || (session->waiting == SESSION_WAIT_NEXT && session->waitJob != NULL);
+}
+
+/**
+ * Ends the wait of a session: finished jobs are removed and the ones still
+ * running go back to being removed when reaped
+ *
+ * @param session Waiting session
+ * @return Exit status of the wait
+ */
+static int endWait(tsession * session) {
+    int status = session->waitJob != NULL ? session->waitJob->exitStatus : session->waitStatus;
+    tjob * job, * next;
+
+    for (job = session->jobs.head; job != NULL; job = next) {
+        next = job->next;
+        if (job->owned == 0 || job->background == 0) continue;
+
+        if (job->alive == 0) removeJob(&session->jobs, job);
+        else job->owned = 0;
+    }
+
+    session->waiting = 0;
+    session->waitJob = NULL;
+
+    return status;
+}
+
+/**
+ * Handles a request of a session
+ *
+ * @param session Session of the request
+ * @param request Request line
+ * @return Exit status to send, SESSION_RUNNING if a job runs the line
+ */
+static int handleRequest(tsession * session, char * request) {
+    if (strncmp(request, "run ", 4) == 0) return lineRunner(session, request + 4);
+
+    if (strcmp(request, "capture on\n") == 0 || strcmp(request, "capture off\n") == 0) {
+        session->capture = request[9] == 'n';
+        return 0;
+    }
+
+    return 2;
+}
+
+/**
+ * Sends the rest of the output and the status of a finished job
+ *
+ * @param session Session whose job finished
+ */
+static void finishLine(tsession * session) {
+    char buffer[OUTPUT_CHUNK];
+    ssize_t n;
+    int status = session->job->exitStatus;
+
+    // Output written before the exit and not read yet
+    if (session->outputFd != -1) {
+        while ((n = read(session->outputFd, buffer, sizeof(buffer))) > 0) sendFrame(session, buffer, n);
+        closeOutput(session);
+    }
+
+    lineFinisher(session, session->job);
+
+    removeJob(&session->jobs, session->job);
+    session->job = NULL;
+
+    sendStatus(session, status);
+}
+
+/**
+ * Stops streaming the output of the job of a session
+ *
+ * @param session Session to update
+ */
+static void closeOutput(tsession * session) {
+    if (session->outputFd == -1) return;
+
+    unwatchFd(session->outputFd);
+    close(session->outputFd);
+    session->outputFd = -1;
+}
+
+/**
+ * Closes a session. Its background jobs get SIGHUP, like the jobs of a
+ * shell whose terminal hangs up.
+ *
+ * @param session Session to close
+ */
+static void closeSession(tsession * session) {
+    tsession ** link;
+    tjob * job;
+    int i;
+
+    for (link = &sessions; *link != session; link = &(*link)->next);
+    *link = session->next;
+
+    for (job = session->jobs.head; job != NULL; job = job->next) {
+        for (i = 0; i < job->ncommands; i++) {
+            if (job->pids[i] > 0) kill(job->pids[i], SIGHUP);
+        }
+    }
+
+    closeOutput(session);
+    unwatchFd(session->fd);
+
+    close(session->fd);
+    if (session->cwdFd != -1) close(session->cwdFd);
+
+    free(session->queue);
+    freeInput(&session->input);
+    freeCaptures(&session->jobs);
+    freeJobStore(&session->jobs);
+    free(session);
+}
+
+/**
+ * Sends an output frame to the client of a session
+ *
+ * @param session Session to send to
+ * @param data Output
+ * @param length Length of the output
+ */
+static void sendFrame(tsession * session, char * data, size_t length) {
+    char header[HEADER_SIZE];
+
+    snprintf(header, sizeof(header), "out %zu\n", length);
+
+    queueReply(session, header, strlen(header));
+    queueReply(session, data, length);
+}
+
+/**
+ * Sends the status of a line to the client of a session
+ *
+ * @param session Session to send to
+ * @param status Exit status of the line
+ */
+static void sendStatus(tsession * session, int status) {
+    char header[HEADER_SIZE];
+
+    session->lastStatus = status;
+
+    snprintf(header, sizeof(header), "status %d\n", status);
+    queueReply(session, header, strlen(header));
+}
+
+/**
+ * Queues a reply for the client of a session and sends what the socket
+ * takes right away
+ *
+ * @param session Session to send to
+ * @param data Reply
+ * @param length Length of the reply
+ */
+static void queueReply(tsession * session, const char * data, size_t length) {
+    if (session->broken) return;
+
+    // Move the unsent bytes to the front before growing the queue
+    if (session->queueSize - session->queueEnd < length) {
+        if (session->queueStart > 0) {
+            memmove(session->queue, session->queue + session->queueStart, session->queueEnd - session->queueStart);
+            session->queueEnd -= session->queueStart;
+            session->queueStart = 0;
+        }
+
+        while (session->queueSize - session->queueEnd < length) {
+            session->queueSize = session->queueSize == 0 ? OUTPUT_CHUNK : session->queueSize * 2;
+        }
+
+        session->queue = (char *) checkedRealloc(session->queue, session->queueSize);
+    }
+
+    memcpy(session->queue + session->queueEnd, data, length);
+    session->queueEnd += length;
+
+    flushSession(session);
+}
+
+/**
+ * Sends the queued replies of a session until the socket is full. A client
+ * that is gone loses what it did not take.
+ *
+ * @param session Session to flush
+ */
+static void flushSession(tsession * session) {
+    ssize_t n;
+
+    while (session->queueStart < session->queueEnd) {
+        n = send(session->fd, session->queue + session->queueStart, session->queueEnd - session->queueStart, MSG_NOSIGNAL);
+
+        if (n > 0) {
+            session->queueStart += n;
+            continue;
+        }
+
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && errno == EAGAIN) break;
+
+        // The job of a client that is gone gets SIGPIPE on its next write
+        session->broken = 1;
+        session->queueStart = session->queueEnd;
+        closeOutput(session);
+    }
+
+    // An empty queue gives back the memory of a large output
+    if (session->queueStart == session->queueEnd) {
+        session->queueStart = 0;
+        session->queueEnd = 0;
+
+        if (session->queueSize > OUTPUT_CHUNK) {
+            free(session->queue);
+            session->queue = NULL;
+            session->queueSize = 0;
+        }
+    }
+
+    updateSession(session);
+}
+
+/**
+ * Watches the socket of a session for what it can do next (read requests,
+ * send queued replies) and pauses the output of its job while the client
+ * is behind, so the job blocks on its pipe instead of the queue growing
+ *
+ * @param session Session to update
+ */
+static void updateSession(tsession * session) {
+    size_t queued = session->queueEnd - session->queueStart;
+    uint32_t events = 0;
+
+    if (session->input.eof == 0 && session->broken == 0) events |= EPOLLIN;
+    if (queued > 0) events |= EPOLLOUT;
+
+    // Hang-ups are reported even without events, stop watching
+    if (events == 0) unwatchFd(session->fd);
+    else if (modifyFd(session->fd, events) == -1) watchFd(session->fd, events, sessionHandler, session);
+
+    if (session->outputFd != -1) modifyFd(session->outputFd, queued < SESSION_QUEUE_LIMIT ? EPOLLIN : 0);
+}
+
+/**
+ * Writes a whole buffer to a (blocking) socket without raising SIGPIPE
+ *
+ * @param fd Socket to write to
+ * @param data Data to write
+ * @param length Length of the data
+ * @return 0 if successful, -1 if the peer is gone
+ */
+static int sendAll(int fd, const char * data, size_t length) {
+    ssize_t n;
+
+    while (length > 0) {
+        n = send(fd, data, length, MSG_NOSIGNAL);
+
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        data += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the replies to a request, writing its output frames to the
+ * standard output
+ *
+ * @param replies Replies of the server
+ * @return Exit status of the request, -1 if the connection was closed
+ */
+static int readReplies(tinput * replies) {
+    char * reply;
+
+    for (;;) {
+        while ((reply = nextLine(replies)) == NULL && replies->eof == 0) fillInput(replies);
+        if (reply == NULL) return -1;
+
+        if (strncmp(reply, "status ", 7) == 0) return atoi(reply + 7);
+
+        if (strncmp(reply, "out ", 4) == 0 && readFrame(replies, strtoul(reply + 4, NULL, 10), STDOUT_FILENO) == -1) return -1;
+    }
+}
+
+/**
+ * Copies an output frame from the replies of a server
+ *
+ * @param input Replies of the server
+ * @param length Length of the frame
+ * @param out File descriptor to write it to
+ * @return 0 if successful, -1 if the connection was closed
+ */
+static int readFrame(tinput * input, size_t length, int out) {
+    size_t available;
+
+    while (length > 0) {
+        if (input->start == input->end) {
+            if (input->eof || fillInput(input) == 0) return -1;
+            continue;
+        }
+
+        available = input->end - input->start;
+        if (available > length) available = length;
+
+        writeAll(out, input->buffer + input->start, available);
+
+        input->start += available;
+        length -= available;
+    }
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <sys/types.h>
+
+#include "input.h"
+#include "jobs.h"
+
+// ===========================[ Constants ]===========================
+
+// Result of a line runner when the line goes on in a job
+#define SESSION_RUNNING -1
+
+// What the wait builtin of a session waits for
+#define SESSION_WAIT_ALL 1
+#define SESSION_WAIT_NEXT 2
+
+// Unsent replies of a session past which the output of its job and its
+// next requests wait for the client
+#define SESSION_QUEUE_LIMIT (1024 * 1024)
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Client session of the shell server. Every session has its own working
+ * directory, file mode mask and job table.
+ *
+ * @param fd: Connected socket
+ * @param input: Requests read from the socket
+ * @param jobs: Job table of the session
+ * @param cwdFd: Working directory (open directory)
+ * @param mask: File mode creation mask
+ * @param lastStatus: Exit status of the last line
+ * @param capture: Send the output of the lines back to the client
+ * @param job: Job running the current line (NULL if none)
+ * @param waiting: The current line waits for the owned background jobs of
+ *                 the session (SESSION_WAIT_ALL, SESSION_WAIT_NEXT or 0)
+ * @param waitJob: Job whose status ends the wait (NULL: waitStatus)
+ * @param waitStatus: Status of the wait when there is no waitJob
+ * @param outputFd: Read end of the output of job (-1 if none)
+ * @param closing: Close the session once the current line is done
+ * @param queue: Replies the client has not taken yet (the socket never
+ *               blocks the server)
+ * @param queueStart: Start of the unsent replies in queue
+ * @param queueEnd: End of the unsent replies in queue
+ * @param queueSize: Capacity of queue
+ * @param broken: Set once the client can not be written to
+ * @param next: Next session
+ */
+typedef struct tsession {
+    int fd;
+    tinput input;
+    tjobstore jobs;
+    int cwdFd;
+    mode_t mask;
+    int lastStatus;
+    int capture;
+    tjob * job;
+    int waiting;
+    tjob * waitJob;
+    int waitStatus;
+    int outputFd;
+    int closing;
+    char * queue;
+    size_t queueStart;
+    size_t queueEnd;
+    size_t queueSize;
+    int broken;
+    struct tsession * next;
+} tsession;
+
+/**
+ * Runs a command line of a session
+ *
+ * @param session: Session the line comes from
+ * @param line: Command line (with its newline)
+ * @return Exit status, or SESSION_RUNNING if session->job runs the line or
+ *         it waits for jobs of the session
+ */
+typedef int (*tlinerunner)(tsession * session, char * line);
+
+/**
+ * Finishes a line of a session whose job is done, before its status is sent
+ *
+ * @param session: Session of the line
+ * @param job: Finished job of the line
+ */
+typedef void (*tlinefinisher)(tsession * session, tjob * job);
+
+// ===========================[ Prototypes ]==========================
+
+int runServer(char * path, tlinerunner runner, tlinefinisher finisher);
+int runClient(char * path, tinput * input, int capture);
+void watchSessionOutput(tsession * session, int fd);
+void sendSessionFile(tsession * session, int fd);
+int waitSessionJobs(tsession * session, int mode, tjob * job, int status);
+tjobstore * findSessionStore(pid_t pid);
+
+#endif
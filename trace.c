@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "trace.h"
+
+// ===========================[ Constants ]===========================
+#define RING_SIZE 4096
+#define FLUSH_THRESHOLD (RING_SIZE / 2)
+
+// ===========================[ Prototypes ]==========================
+static void recordEvent(char phase, const char * name, const char * label, long long start,
+    long long duration, int tid, const char * argName, long arg);
+static void writeEvent(ttraceevent * event);
+
+// ========================[ Global Variables ]=======================
+static ttraceevent ring[RING_SIZE];
+static atomic_ulong head = 0, tail = 0;
+static atomic_flag flushing = ATOMIC_FLAG_INIT;
+static atomic_ulong dropped = 0;
+static atomic_int enabled = 0;
+static FILE * traceFile = NULL;
+static char * traceFileName = NULL;
+static int firstEvent = 1;
+static pid_t shellPid;
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Starts writing trace events to a file in Chrome trace format (it can be
+ * opened with chrome://tracing or Perfetto). A running trace is stopped.
+ *
+ * @param path File to write to
+ * @return 0 if successful, -1 if the file could not be opened
+ */
+int startTrace(char * path) {
+    unsigned long i;
+
+    stopTrace();
+
+    traceFile = fopen(path, "we");
+    if (traceFile == NULL) return -1;
+
+    traceFileName = strdup(path);
+    shellPid = getpid();
+    firstEvent = 1;
+
+    // Slot i is free for the producer that claims position i
+    for (i = 0; i < RING_SIZE; i++) atomic_store(&ring[i].sequence, i);
+    atomic_store(&head, 0);
+    atomic_store(&tail, 0);
+    atomic_store(&dropped, 0);
+
+    fprintf(traceFile, "{\"traceEvents\": [\n");
+    atomic_store(&enabled, 1);
+
+    return 0;
+}
+
+/**
+ * Flushes the pending events and closes the trace file
+ */
+void stopTrace() {
+    if (!atomic_load(&enabled)) return;
+
+    flushTrace();
+    atomic_store(&enabled, 0);
+
+    fprintf(traceFile, "\n], \"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped\": %lu}}\n", atomic_load(&dropped));
+    fclose(traceFile);
+
+    free(traceFileName);
+    traceFile = NULL;
+    traceFileName = NULL;
+}
+
+/**
+ * Writes the events in the ring to the trace file. Only one thread flushes
+ * at a time, the others return at once.
+ */
+void flushTrace() {
+    ttraceevent * event;
+    unsigned long position;
+
+    if (!atomic_load(&enabled) || atomic_flag_test_and_set(&flushing)) return;
+
+    position = atomic_load(&head);
+
+    for (;;) {
+        event = ring + (position & (RING_SIZE - 1));
+
+        // Stop at the first slot not published yet
+        if (atomic_load_explicit(&event->sequence, memory_order_acquire) != position + 1) break;
+
+        writeEvent(event);
+        atomic_store_explicit(&event->sequence, position + RING_SIZE, memory_order_release);
+        position++;
+    }
+
+    atomic_store(&head, position);
+    fflush(traceFile);
+    atomic_flag_clear(&flushing);
+}
+
+/**
+ * Gets the file the trace is written to
+ *
+ * @return Path of the trace, NULL if tracing is off
+ */
+char * tracePath() {
+    return atomic_load(&enabled) ? traceFileName : NULL;
+}
+
+/**
+ * Reads the trace clock
+ *
+ * @return Nanoseconds of CLOCK_MONOTONIC, 0 if tracing is off (so untraced
+ *         runs do not pay for the clock)
+ */
+long long traceClock() {
+    struct timespec now;
+
+    if (!atomic_load_explicit(&enabled, memory_order_relaxed)) return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Records a phase that started at start and ends now
+ *
+ * @param name Event name
+ * @param label Detail appended to the name (NULL if none)
+ * @param start Start of the phase, from traceClock
+ * @param tid Track of the event (0 for the shell)
+ * @param argName Name of the argument (NULL if none)
+ * @param arg Argument value
+ */
+void traceSpan(const char * name, const char * label, long long start, int tid, const char * argName, long arg) {
+    long long now = traceClock();
+
+    if (now == 0 || start == 0) return;
+
+    recordEvent('X', name, label, start, now - start, tid, argName, arg);
+}
+
+/**
+ * Records an instant event
+ *
+ * @param name Event name
+ * @param label Detail appended to the name (NULL if none)
+ * @param tid Track of the event (0 for the shell)
+ * @param argName Name of the argument (NULL if none)
+ * @param arg Argument value
+ */
+void traceInstant(const char * name, const char * label, int tid, const char * argName, long arg) {
+    long long now = traceClock();
+
+    if (now == 0) return;
+
+    recordEvent('i', name, label, now, 0, tid, argName, arg);
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Claims a ring slot and publishes an event in it. Producers never block:
+ * when the ring is full the event is counted as dropped.
+ *
+ * @param phase Chrome trace phase
+ * @param name Event name
+ * @param label Detail appended to the name (NULL if none)
+ * @param start Start time in nanoseconds
+ * @param duration Duration in nanoseconds
+ * @param tid Track of the event (0 for the shell)
+ * @param argName Name of the argument (NULL if none)
+ * @param arg Argument value
+ */
+static void recordEvent(char phase, const char * name, const char * label, long long start,
+    long long duration, int tid, const char * argName, long arg) {
+    ttraceevent * event;
+    unsigned long position, sequence;
+
+    position = atomic_load_explicit(&tail, memory_order_relaxed);
+
+    for (;;) {
+        event = ring + (position & (RING_SIZE - 1));
+        sequence = atomic_load_explicit(&event->sequence, memory_order_acquire);
+
+        if (sequence == position) {
+            if (atomic_compare_exchange_weak(&tail, &position, position + 1)) break;
+        } else if (sequence < position) {
+            atomic_fetch_add(&dropped, 1);
+            return;
+        } else {
+            position = atomic_load_explicit(&tail, memory_order_relaxed);
+        }
+    }
+
+    if (label != NULL) snprintf(event->name, TRACE_NAME_SIZE, "%s %s", name, label);
+    else snprintf(event->name, TRACE_NAME_SIZE, "%s", name);
+
+    event->phase = phase;
+    event->start = start;
+    event->duration = duration;
+    event->tid = tid == 0 ? shellPid : tid;
+    event->argName = argName;
+    event->arg = arg;
+
+    atomic_store_explicit(&event->sequence, position + 1, memory_order_release);
+
+    if (position + 1 - atomic_load(&head) >= FLUSH_THRESHOLD) flushTrace();
+}
+
+/**
+ * Writes an event as a Chrome trace JSON object
+ *
+ * @param event Event to write
+ */
+static void writeEvent(ttraceevent * event) {
+    char * c;
+
+    if (!firstEvent) fprintf(traceFile, ",\n");
+    firstEvent = 0;
+
+    fprintf(traceFile, "{\"name\": \"");
+
+    // Names come from command lines, escape them
+    for (c = event->name; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') fputc('\\', traceFile);
+        if ((unsigned char) *c >= ' ') fputc(*c, traceFile);
+    }
+
+    fprintf(traceFile, "\", \"cat\": \"shell\", \"ph\": \"%c\", \"ts\": %.3f, ", event->phase, event->start / 1000.0);
+
+    if (event->phase == 'X') fprintf(traceFile, "\"dur\": %.3f, ", event->duration / 1000.0);
+    else fprintf(traceFile, "\"s\": \"t\", ");
+
+    fprintf(traceFile, "\"pid\": %d, \"tid\": %d", shellPid, event->tid);
+
+    if (event->argName != NULL) fprintf(traceFile, ", \"args\": {\"%s\": %ld}", event->argName, event->arg);
+
+    fprintf(traceFile, "}");
+}
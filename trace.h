@@ -0,0 +1,44 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+
+// ===========================[ Constants ]===========================
+#define TRACE_NAME_SIZE 48
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Trace event, stored in the ring until it is flushed
+ *
+ * @param sequence: Ring slot sequence number (slot state for producers)
+ * @param name: Event name
+ * @param phase: Chrome trace phase ('X': Complete, 'i': Instant)
+ * @param start: Start time in nanoseconds (CLOCK_MONOTONIC)
+ * @param duration: Duration in nanoseconds (complete events)
+ * @param tid: Track of the event (the shell or a child pid)
+ * @param argName: Name of the argument (NULL if none)
+ * @param arg: Argument value
+ */
+typedef struct {
+    atomic_ulong sequence;
+    char name[TRACE_NAME_SIZE];
+    char phase;
+    long long start;
+    long long duration;
+    int tid;
+    const char * argName;
+    long arg;
+} ttraceevent;
+
+// ===========================[ Prototypes ]==========================
+
+int startTrace(char * path);
+void stopTrace();
+void flushTrace();
+char * tracePath();
+long long traceClock();
+void traceSpan(const char * name, const char * label, long long start, int tid, const char * argName, long arg);
+void traceInstant(const char * name, const char * label, int tid, const char * argName, long arg);
+
+#endif
@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "variables.h"
+
+// ===========================[ Constants ]===========================
+#define INITIAL_BUCKETS 64
+#define INITIAL_ENVIRONMENT 64
+#define NUMBER_SIZE 24
+
+// ===========================[ Prototypes ]==========================
+static unsigned int hashName(const char * name, size_t length);
+static tvariable * lookupVariable(const char * name, size_t length);
+static tvariable * createVariable(const char * name, size_t length);
+static void storeValue(tvariable * variable, const char * value);
+static void addToEnvironment(tvariable * variable);
+static void removeFromEnvironment(tvariable * variable);
+static void growBuckets();
+static size_t parseReference(char * p, const char ** name, size_t * length, char * number, int status, pid_t lastBackground);
+static int compareVariables(const void * a, const void * b);
+
+// ========================[ Global Variables ]=======================
+extern char ** environ;
+static tvariable ** buckets = NULL;
+static int nbuckets = 0, nvariables = 0;
+static char ** envp = NULL;
+static int envCount = 0, envCapacity = 0;
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Imports the environment as exported variables. From then on the
+ * exported variables are the process environment: environ points to an
+ * array that is updated in place when a variable changes.
+ */
+void initVariables() {
+    char ** entry, * equals;
+    tvariable * variable;
+
+    nbuckets = INITIAL_BUCKETS;
+    buckets = (tvariable **) checkedRealloc(NULL, sizeof(tvariable *) * nbuckets);
+    memset(buckets, 0, sizeof(tvariable *) * nbuckets);
+
+    envCapacity = INITIAL_ENVIRONMENT;
+    envp = (char **) checkedRealloc(NULL, sizeof(char *) * envCapacity);
+    envp[0] = NULL;
+
+    for (entry = environ; entry != NULL && *entry != NULL; entry++) {
+        equals = strchr(*entry, '=');
+        if (equals == NULL || !isVariableName(*entry, equals - *entry)) continue;
+
+        variable = lookupVariable(*entry, equals - *entry);
+        if (variable == NULL) variable = createVariable(*entry, equals - *entry);
+
+        storeValue(variable, equals + 1);
+        variable->exported = 1;
+        if (variable->envIndex == -1) addToEnvironment(variable);
+    }
+
+    environ = envp;
+}
+
+/**
+ * Returns the value of a variable
+ *
+ * @param name Name of the variable
+ * @return Value, NULL if the variable is not set
+ */
+char * getVariable(const char * name) {
+    return findVariable(name, strlen(name));
+}
+
+/**
+ * Returns the value of a variable whose name is part of a longer string
+ *
+ * @param name Start of the name
+ * @param length Length of the name
+ * @return Value, NULL if the variable is not set
+ */
+char * findVariable(const char * name, size_t length) {
+    tvariable * variable = lookupVariable(name, length);
+
+    return variable != NULL ? variable->text + variable->nameLength + 1 : NULL;
+}
+
+/**
+ * Sets a variable. An exported variable changes its environment entry in
+ * place.
+ *
+ * @param name Name of the variable
+ * @param value New value
+ * @param export 1 to export the variable, 0 to keep it as it was
+ */
+void setVariable(const char * name, const char * value, int export) {
+    size_t length = strlen(name);
+    tvariable * variable = lookupVariable(name, length);
+
+    if (variable == NULL) variable = createVariable(name, length);
+
+    storeValue(variable, value);
+
+    if (export) variable->exported = 1;
+    if (variable->exported && variable->envIndex == -1) addToEnvironment(variable);
+}
+
+/**
+ * Exports a variable (set to an empty value if it does not exist)
+ *
+ * @param name Name of the variable
+ */
+void exportVariable(const char * name) {
+    tvariable * variable = lookupVariable(name, strlen(name));
+
+    if (variable == NULL) setVariable(name, "", 1);
+    else if (variable->envIndex == -1) {
+        variable->exported = 1;
+        addToEnvironment(variable);
+    }
+}
+
+/**
+ * Removes a variable
+ *
+ * @param name Name of the variable
+ */
+void unsetVariable(const char * name) {
+    size_t length = strlen(name);
+    tvariable ** link, * variable;
+
+    for (link = &buckets[hashName(name, length) & (nbuckets - 1)]; *link != NULL; link = &(*link)->next) {
+        variable = *link;
+
+        if (variable->nameLength == length && memcmp(variable->text, name, length) == 0) {
+            if (variable->envIndex != -1) removeFromEnvironment(variable);
+
+            *link = variable->next;
+            free(variable->text);
+            free(variable);
+            nvariables--;
+            return;
+        }
+    }
+}
+
+/**
+ * Returns the environment of the commands run by the shell
+ *
+ * @return NULL terminated "NAME=value" array (same as environ)
+ */
+char ** variableEnvironment() {
+    return envp;
+}
+
+/**
+ * Prints the variables sorted by name, in a form that can be read back
+ *
+ * @param fd File descriptor to print to
+ * @param exportedOnly Print only exported variables (as export NAME=value)
+ */
+void printVariables(int fd, int exportedOnly) {
+    tvariable ** sorted, * variable;
+    int i, n = 0;
+
+    if (nvariables == 0) return;
+
+    sorted = (tvariable **) checkedRealloc(NULL, sizeof(tvariable *) * nvariables);
+
+    for (i = 0; i < nbuckets; i++) {
+        for (variable = buckets[i]; variable != NULL; variable = variable->next) {
+            if (!exportedOnly || variable->exported) sorted[n++] = variable;
+        }
+    }
+
+    qsort(sorted, n, sizeof(tvariable *), compareVariables);
+
+    for (i = 0; i < n; i++) dprintf(fd, "%s%s\n", exportedOnly ? "export " : "", sorted[i]->text);
+
+    free(sorted);
+}
+
+/**
+ * Checks if a string is a valid variable name (letters, digits and
+ * underscores, not starting with a digit)
+ *
+ * @param name Name to check
+ * @param length Length of the name
+ * @return 1 if valid, 0 otherwise
+ */
+int isVariableName(const char * name, size_t length) {
+    size_t i;
+
+    if (length == 0 || isdigit((unsigned char) name[0])) return 0;
+
+    for (i = 0; i < length; i++) {
+        if (!isalnum((unsigned char) name[i]) && name[i] != '_') return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Expands $NAME, ${NAME}, $? and $! in a word. Words without references
+ * are returned as they are, the others are built in the arena, so no
+ * expansion allocates from the heap.
+ *
+ * @param arena Arena of the line
+ * @param word Word to expand
+ * @param status Value of $?
+ * @param lastBackground Value of $! (0 if no background job was started)
+ * @return Expanded word
+ */
+char * expandWord(tarena * arena, char * word, int status, pid_t lastBackground) {
+    char number[NUMBER_SIZE], * p, * expanded, * out;
+    const char * name, * value;
+    size_t length = 0, nameLength, used;
+
+    if (strchr(word, '$') == NULL) return word;
+
+    // First pass: length of the result
+    for (p = word; *p != '\0'; ) {
+        used = *p == '$' ? parseReference(p, &name, &nameLength, number, status, lastBackground) : 0;
+
+        if (used == 0) {
+            length++;
+            p++;
+            continue;
+        }
+
+        value = name == number ? number : findVariable(name, nameLength);
+        if (value != NULL) length += strlen(value);
+        p += used;
+    }
+
+    expanded = out = (char *) arenaAlloc(arena, length + 1);
+
+    // Second pass: copy
+    for (p = word; *p != '\0'; ) {
+        used = *p == '$' ? parseReference(p, &name, &nameLength, number, status, lastBackground) : 0;
+
+        if (used == 0) {
+            *out++ = *p++;
+            continue;
+        }
+
+        value = name == number ? number : findVariable(name, nameLength);
+
+        if (value != NULL) {
+            nameLength = strlen(value);
+            memcpy(out, value, nameLength);
+            out += nameLength;
+        }
+
+        p += used;
+    }
+
+    *out = '\0';
+
+    return expanded;
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Hashes a variable name (FNV-1a)
+ *
+ * @param name Name
+ * @param length Length of the name
+ * @return Hash
+ */
+static unsigned int hashName(const char * name, size_t length) {
+    unsigned int hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * Finds a variable
+ *
+ * @param name Start of the name
+ * @param length Length of the name
+ * @return Variable, NULL if it is not set
+ */
+static tvariable * lookupVariable(const char * name, size_t length) {
+    tvariable * variable;
+
+    if (buckets == NULL) return NULL;
+
+    for (variable = buckets[hashName(name, length) & (nbuckets - 1)]; variable != NULL; variable = variable->next) {
+        if (variable->nameLength == length && memcmp(variable->text, name, length) == 0) return variable;
+    }
+
+    return NULL;
+}
+
+/**
+ * Creates an empty, not exported variable
+ *
+ * @param name Start of the name
+ * @param length Length of the name
+ * @return New variable
+ */
+static tvariable * createVariable(const char * name, size_t length) {
+    tvariable * variable;
+    unsigned int index;
+
+    if (nvariables >= nbuckets) growBuckets();
+
+    variable = (tvariable *) checkedRealloc(NULL, sizeof(tvariable));
+    variable->capacity = length + 2;
+    variable->text = (char *) checkedRealloc(NULL, variable->capacity);
+    variable->nameLength = length;
+    variable->exported = 0;
+    variable->envIndex = -1;
+
+    memcpy(variable->text, name, length);
+    variable->text[length] = '=';
+    variable->text[length + 1] = '\0';
+
+    index = hashName(name, length) & (nbuckets - 1);
+    variable->next = buckets[index];
+    buckets[index] = variable;
+    nvariables++;
+
+    return variable;
+}
+
+/**
+ * Stores the value of a variable, reusing its buffer when it fits
+ *
+ * @param variable Variable to update
+ * @param value New value
+ */
+static void storeValue(tvariable * variable, const char * value) {
+    size_t size = variable->nameLength + strlen(value) + 2;
+
+    if (size > variable->capacity) {
+        variable->capacity = size * 2;
+        variable->text = (char *) checkedRealloc(variable->text, variable->capacity);
+
+        // The environment entry follows the buffer
+        if (variable->envIndex != -1) envp[variable->envIndex] = variable->text;
+    }
+
+    strcpy(variable->text + variable->nameLength + 1, value);
+}
+
+/**
+ * Appends a variable to the environment
+ *
+ * @param variable Variable to add
+ */
+static void addToEnvironment(tvariable * variable) {
+    int installed = environ == envp;
+
+    if (envCount + 1 >= envCapacity) {
+        envCapacity *= 2;
+        envp = (char **) checkedRealloc(envp, sizeof(char *) * envCapacity);
+
+        // Keep environ on the array once it was handed over
+        if (installed) environ = envp;
+    }
+
+    variable->envIndex = envCount;
+    envp[envCount++] = variable->text;
+    envp[envCount] = NULL;
+}
+
+/**
+ * Removes a variable from the environment, moving the last entry into
+ * its place
+ *
+ * @param variable Variable to remove
+ */
+static void removeFromEnvironment(tvariable * variable) {
+    tvariable * last;
+    char * equals;
+
+    envCount--;
+
+    if (variable->envIndex != envCount) {
+        equals = strchr(envp[envCount], '=');
+        last = lookupVariable(envp[envCount], equals - envp[envCount]);
+
+        envp[variable->envIndex] = envp[envCount];
+        last->envIndex = variable->envIndex;
+    }
+
+    envp[envCount] = NULL;
+    variable->envIndex = -1;
+    variable->exported = 0;
+}
+
+/**
+ * Doubles the number of buckets of the store
+ */
+static void growBuckets() {
+    tvariable ** old = buckets, * variable, * next;
+    int oldCount = nbuckets, i;
+    unsigned int index;
+
+    nbuckets *= 2;
+    buckets = (tvariable **) checkedRealloc(NULL, sizeof(tvariable *) * nbuckets);
+    memset(buckets, 0, sizeof(tvariable *) * nbuckets);
+
+    for (i = 0; i < oldCount; i++) {
+        for (variable = old[i]; variable != NULL; variable = next) {
+            next = variable->next;
+            index = hashName(variable->text, variable->nameLength) & (nbuckets - 1);
+            variable->next = buckets[index];
+            buckets[index] = variable;
+        }
+    }
+
+    free(old);
+}
+
+/**
+ * Parses a variable reference starting at a '$'
+ *
+ * @param p Start of the reference
+ * @param name Start of the name (number for $? and $!)
+ * @param length Length of the name
+ * @param number Buffer for the value of $? and $!
+ * @param status Value of $?
+ * @param lastBackground Value of $!
+ * @return Length of the reference, 0 if the '$' is literal
+ */
+static size_t parseReference(char * p, const char ** name, size_t * length, char * number, int status, pid_t lastBackground) {
+    size_t n = 0;
+
+    if (p[1] == '?' || p[1] == '!') {
+        if (p[1] == '?') snprintf(number, NUMBER_SIZE, "%d", status);
+        else if (lastBackground > 0) snprintf(number, NUMBER_SIZE, "%d", (int) lastBackground);
+        else number[0] = '\0';
+
+        *name = number;
+        return 2;
+    }
+
+    if (p[1] == '{') {
+        while (p[2 + n] != '\0' && p[2 + n] != '}') n++;
+        if (p[2 + n] != '}' || !isVariableName(p + 2, n)) return 0;
+
+        *name = p + 2;
+        *length = n;
+        return n + 3;
+    }
+
+    while (isalnum((unsigned char) p[1 + n]) || p[1 + n] == '_') n++;
+    if (!isVariableName(p + 1, n)) return 0;
+
+    *name = p + 1;
+    *length = n;
+    return n + 1;
+}
+
+/**
+ * Compares two variables by name for qsort
+ *
+ * @param a First variable
+ * @param b Second variable
+ * @return Negative, zero or positive
+ */
+static int compareVariables(const void * a, const void * b) {
+    const tvariable * x = *(const tvariable **) a, * y = *(const tvariable **) b;
+    size_t length = x->nameLength < y->nameLength ? x->nameLength : y->nameLength;
+    int result = memcmp(x->text, y->text, length);
+
+    return result != 0 ? result : (int) x->nameLength - (int) y->nameLength;
+}
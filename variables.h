@@ -0,0 +1,44 @@
+#ifndef VARIABLES_H
+#define VARIABLES_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "arena.h"
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Shell variable. The name and the value are kept together as
+ * "NAME=value", the form envp entries take, so exporting never copies.
+ *
+ * @param text: "NAME=value"
+ * @param nameLength: Length of the name
+ * @param capacity: Allocated size of text
+ * @param exported: Passed to the environment of commands
+ * @param envIndex: Position in the environment (-1 if not exported)
+ * @param next: Next variable in the same bucket
+ */
+typedef struct tvariable {
+    char * text;
+    size_t nameLength;
+    size_t capacity;
+    int exported;
+    int envIndex;
+    struct tvariable * next;
+} tvariable;
+
+// ===========================[ Prototypes ]==========================
+
+void initVariables();
+char * getVariable(const char * name);
+char * findVariable(const char * name, size_t length);
+void setVariable(const char * name, const char * value, int export);
+void exportVariable(const char * name);
+void unsetVariable(const char * name);
+char ** variableEnvironment();
+void printVariables(int fd, int exportedOnly);
+int isVariableName(const char * name, size_t length);
+char * expandWord(tarena * arena, char * word, int status, pid_t lastBackground);
+
+#endif
@@ -0,0 +1,681 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "wildcard.h"
+
+// ===========================[ Constants ]===========================
+#define DIRENT_BUFFER 65536
+#define CACHE_LISTINGS 64
+#define INITIAL_ENTRIES 64
+
+// Pattern tokens
+#define TOKEN_CHAR 0
+#define TOKEN_ANY 1
+#define TOKEN_STAR 2
+#define TOKEN_CLASS 3
+
+// Path components
+#define COMPONENT_LITERAL 0
+#define COMPONENT_PATTERN 1
+#define COMPONENT_GLOBSTAR 2
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Entry returned by getdents64
+ */
+typedef struct {
+    ino_t d_ino;
+    off_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} tdirent;
+
+/**
+ * Token of a compiled pattern
+ *
+ * @param type: TOKEN_CHAR, TOKEN_ANY (?), TOKEN_STAR (*) or TOKEN_CLASS ([...])
+ * @param c: Character of TOKEN_CHAR
+ * @param set: Bitmap of the characters of TOKEN_CLASS
+ */
+typedef struct {
+    int type;
+    unsigned char c;
+    unsigned char * set;
+} ttoken;
+
+/**
+ * Compiled component of a path pattern (the text between slashes)
+ *
+ * @param type: COMPONENT_LITERAL, COMPONENT_PATTERN or COMPONENT_GLOBSTAR (**)
+ * @param text: Text of the component
+ * @param tokens: Tokens of a pattern
+ * @param ntokens: Number of tokens
+ * @param prefix: Literal characters the pattern starts with
+ * @param prefixLength: Length of prefix
+ * @param suffix: Literal characters the pattern ends with
+ * @param suffixLength: Length of suffix
+ */
+typedef struct {
+    int type;
+    char * text;
+    ttoken * tokens;
+    int ntokens;
+    char * prefix;
+    size_t prefixLength;
+    char * suffix;
+    size_t suffixLength;
+} tcomponent;
+
+// ===========================[ Prototypes ]==========================
+static int compilePattern(tarena * arena, char * pattern, tcomponent ** components);
+static void compileComponent(tarena * arena, tcomponent * component, char * text, size_t length);
+static char * parseClass(tarena * arena, char * p, char * end, ttoken * token);
+static int matchTokens(ttoken * tokens, int ntokens, const char * name);
+static int matchComponent(tcomponent * component, const char * name);
+static void walk(tarena * arena, char * dir, tcomponent * components, int index, int ncomponents, twordlist * list);
+static int isDirectory(char * dir, char * name, unsigned char type);
+static tlisting * getListing(char * dir);
+static int readListing(int fd, tlisting * listing);
+static char * joinPath(tarena * arena, char * dir, char * name);
+static int compareNames(const void * a, const void * b);
+static void freeListing(tlisting * listing);
+
+// ========================[ Global Variables ]=======================
+static tlisting cache[CACHE_LISTINGS];
+static int cached = 0;
+static unsigned long lookupClock = 0;
+
+// ===========================[ Functions ]===========================
+
+/**
+ * Initializes a word list in an arena
+ *
+ * @param arena Arena of the list
+ * @param list List to initialize
+ * @param capacity Initial capacity
+ */
+void initWordList(tarena * arena, twordlist * list, int capacity) {
+    list->capacity = capacity + 1;
+    list->count = 0;
+    list->words = (char **) arenaAlloc(arena, sizeof(char *) * list->capacity);
+    list->words[0] = NULL;
+}
+
+/**
+ * Appends a word to a word list, keeping it NULL terminated
+ *
+ * @param arena Arena of the list
+ * @param list List to append to
+ * @param word Word to append
+ */
+void addWord(tarena * arena, twordlist * list, char * word) {
+    char ** grown;
+
+    if (list->count + 1 >= list->capacity) {
+        grown = (char **) arenaAlloc(arena, sizeof(char *) * list->capacity * 2);
+        memcpy(grown, list->words, sizeof(char *) * list->capacity);
+        list->words = grown;
+        list->capacity *= 2;
+    }
+
+    list->words[list->count++] = word;
+    list->words[list->count] = NULL;
+}
+
+/**
+ * Checks if a word has wildcards
+ *
+ * @param word Word to check
+ * @return 1 if it has *, ? or [, 0 otherwise
+ */
+int hasGlob(const char * word) {
+    return strpbrk(word, "*?[") != NULL;
+}
+
+/**
+ * Expands a pattern with *, ?, [...] and ** into the paths that match it,
+ * sorted per directory. Directories are read with getdents64 and kept in
+ * a cache validated by (dev, inode, mtime), so globbing the same large
+ * directory again only costs a stat.
+ *
+ * @param arena Arena of the line (pattern and results are allocated there)
+ * @param pattern Pattern to expand
+ * @param list List the matches are appended to
+ * @return Number of matches (0: nothing was appended)
+ */
+int expandGlob(tarena * arena, char * pattern, twordlist * list) {
+    tcomponent * components;
+    int ncomponents, before = list->count;
+
+    ncomponents = compilePattern(arena, pattern, &components);
+    walk(arena, pattern[0] == '/' ? "/" : "", components, 0, ncomponents, list);
+
+    return list->count - before;
+}
+
+/**
+ * Drops every cached directory listing
+ */
+void clearGlobCache() {
+    int i;
+
+    for (i = 0; i < cached; i++) freeListing(&cache[i]);
+    cached = 0;
+}
+
+// =============================[ Utilities ]==============================
+
+/**
+ * Compiles a pattern once into its path components
+ *
+ * @param arena Arena of the line
+ * @param pattern Pattern to compile
+ * @param components Compiled components
+ * @return Number of components
+ */
+static int compilePattern(tarena * arena, char * pattern, tcomponent ** components) {
+    char * p = pattern, * slash;
+    int n = 0, capacity = 1;
+
+    for (slash = pattern; *slash != '\0'; slash++) capacity += *slash == '/';
+    *components = (tcomponent *) arenaAlloc(arena, sizeof(tcomponent) * capacity);
+
+    // Repeated and leading slashes are skipped, a trailing one keeps an
+    // empty component that only directories satisfy
+    while (*p == '/') p++;
+
+    while (1) {
+        slash = strchr(p, '/');
+        compileComponent(arena, &(*components)[n++], p, slash != NULL ? (size_t) (slash - p) : strlen(p));
+
+        if (slash == NULL) break;
+
+        p = slash;
+        while (*p == '/') p++;
+    }
+
+    return n;
+}
+
+/**
+ * Compiles a path component into tokens
+ *
+ * @param arena Arena of the line
+ * @param component Component to fill
+ * @param text Start of the component
+ * @param length Length of the component
+ */
+static void compileComponent(tarena * arena, tcomponent * component, char * text, size_t length) {
+    char * p = text, * end = text + length;
+    ttoken * token;
+    int literal = 1;
+
+    component->text = (char *) arenaAlloc(arena, length + 1);
+    memcpy(component->text, text, length);
+    component->text[length] = '\0';
+
+    if (length == 2 && text[0] == '*' && text[1] == '*') {
+        component->type = COMPONENT_GLOBSTAR;
+        return;
+    }
+
+    component->tokens = (ttoken *) arenaAlloc(arena, sizeof(ttoken) * (length + 1));
+    component->ntokens = 0;
+
+    while (p < end) {
+        token = &component->tokens[component->ntokens++];
+        token->type = TOKEN_CHAR;
+        token->c = (unsigned char) *p;
+
+        if (*p == '*') {
+            token->type = TOKEN_STAR;
+
+            // Consecutive stars are one star
+            while (p < end && *p == '*') p++;
+            literal = 0;
+            continue;
+        }
+
+        if (*p == '?') token->type = TOKEN_ANY;
+        else if (*p == '[') {
+            p = parseClass(arena, p, end, token);
+            if (token->type == TOKEN_CLASS) {
+                literal = 0;
+                continue;
+            }
+        }
+
+        if (token->type != TOKEN_CHAR) literal = 0;
+        p++;
+    }
+
+    component->type = literal ? COMPONENT_LITERAL : COMPONENT_PATTERN;
+
+    // Leading literal characters narrow the search in the sorted listing,
+    // trailing ones reject most names before the tokens are matched
+    component->prefix = component->text;
+    for (component->prefixLength = 0; (int) component->prefixLength < component->ntokens; component->prefixLength++) {
+        if (component->tokens[component->prefixLength].type != TOKEN_CHAR) break;
+    }
+
+    component->suffixLength = 0;
+    if (literal) return;
+
+    while (component->tokens[component->ntokens - 1 - component->suffixLength].type == TOKEN_CHAR) component->suffixLength++;
+    component->suffix = component->text + length - component->suffixLength;
+}
+
+/**
+ * Parses a [...] class ([!...] or [^...] negated, a-z ranges, ] first is literal)
+ *
+ * @param arena Arena of the line
+ * @param p Opening bracket
+ * @param end End of the component
+ * @param token Token to fill (left as a '[' character if never closed)
+ * @return Position after the class
+ */
+static char * parseClass(tarena * arena, char * p, char * end, ttoken * token) {
+    unsigned char * set = (unsigned char *) arenaAlloc(arena, 32), c, last;
+    char * q = p + 1;
+    int negate = 0, i;
+
+    memset(set, 0, 32);
+
+    if (q < end && (*q == '!' || *q == '^')) {
+        negate = 1;
+        q++;
+    }
+
+    // A ] right after the bracket is part of the class
+    if (q < end && *q == ']') {
+        set[']' / 8] |= 1 << (']' % 8);
+        q++;
+    }
+
+    while (q < end && *q != ']') {
+        c = (unsigned char) *q;
+
+        if (q + 2 < end && q[1] == '-' && q[2] != ']') {
+            for (last = (unsigned char) q[2], i = c; i <= last; i++) set[i / 8] |= 1 << (i % 8);
+            q += 3;
+        } else {
+            set[c / 8] |= 1 << (c % 8);
+            q++;
+        }
+    }
+
+    if (q >= end) return p;
+
+    if (negate) {
+        for (i = 0; i < 32; i++) set[i] = ~set[i];
+    }
+
+    // Classes never match the separator
+    set['/' / 8] &= ~(1 << ('/' % 8));
+
+    token->type = TOKEN_CLASS;
+    token->set = set;
+
+    return q + 1;
+}
+
+/**
+ * Matches a name against tokens. Stars backtrack to the last star only,
+ * which is enough for patterns without nested groups.
+ *
+ * @param tokens Tokens of the pattern
+ * @param ntokens Number of tokens
+ * @param name Name to match
+ * @return 1 if the name matches, 0 otherwise
+ */
+static int matchTokens(ttoken * tokens, int ntokens, const char * name) {
+    const char * n = name, * starName = NULL;
+    int t = 0, starToken = -1, matched;
+    unsigned char c;
+
+    while (*n != '\0') {
+        c = (unsigned char) *n;
+
+        if (t < ntokens && tokens[t].type == TOKEN_STAR) {
+            starToken = t++;
+            starName = n;
+            continue;
+        }
+
+        if (t < ntokens) {
+            if (tokens[t].type == TOKEN_CHAR) matched = tokens[t].c == c;
+            else if (tokens[t].type == TOKEN_ANY) matched = 1;
+            else matched = (tokens[t].set[c / 8] >> (c % 8)) & 1;
+
+            if (matched) {
+                t++;
+                n++;
+                continue;
+            }
+        }
+
+        if (starToken == -1) return 0;
+
+        // Let the last star take one more character
+        t = starToken + 1;
+        n = ++starName;
+    }
+
+    while (t < ntokens && tokens[t].type == TOKEN_STAR) t++;
+
+    return t == ntokens;
+}
+
+/**
+ * Matches a directory entry against a component. Hidden entries only
+ * match patterns that start with a dot.
+ *
+ * @param component Compiled component
+ * @param name Entry name
+ * @return 1 if the entry matches, 0 otherwise
+ */
+static int matchComponent(tcomponent * component, const char * name) {
+    size_t length;
+
+    if (name[0] == '.' && component->text[0] != '.') return 0;
+
+    if (component->suffixLength > 0) {
+        length = strlen(name);
+
+        if (length < component->prefixLength + component->suffixLength) return 0;
+        if (memcmp(name + length - component->suffixLength, component->suffix, component->suffixLength) != 0) return 0;
+    }
+
+    return matchTokens(component->tokens + component->prefixLength, component->ntokens - component->prefixLength, name + component->prefixLength);
+}
+
+/**
+ * Expands the components from index on inside a directory
+ *
+ * @param arena Arena of the line
+ * @param dir Directory reached so far ("" for the current one)
+ * @param components Compiled components
+ * @param index Component to expand
+ * @param ncomponents Number of components
+ * @param list List the matches are appended to
+ */
+static void walk(tarena * arena, char * dir, tcomponent * components, int index, int ncomponents, twordlist * list) {
+    tcomponent * component = &components[index];
+    struct stat st;
+    tlisting * listing;
+    char * path, ** names;
+    unsigned char * types;
+    int i, low, high, count = 0, last = index == ncomponents - 1;
+
+    if (component->type == COMPONENT_LITERAL) {
+        path = joinPath(arena, dir, component->text);
+
+        if (!last) walk(arena, path, components, index + 1, ncomponents, list);
+        else if (lstat(path, &st) == 0) addWord(arena, list, path);
+
+        return;
+    }
+
+    listing = getListing(dir);
+    if (listing == NULL) return;
+
+    // Matches are copied out, walking deeper may evict the listing
+    names = (char **) arenaAlloc(arena, sizeof(char *) * (listing->count + 1));
+    types = (unsigned char *) arenaAlloc(arena, listing->count + 1);
+
+    if (component->type == COMPONENT_GLOBSTAR) {
+        for (i = 0; i < listing->count; i++) {
+            if (listing->names[i][0] == '.') continue;
+
+            names[count] = arenaStrdup(arena, listing->names[i]);
+            types[count++] = (unsigned char) listing->names[i][-1];
+        }
+
+        // ** matches no directory at all, then every directory below (links
+        // to directories are not followed)
+        if (last) {
+            for (i = 0; i < count; i++) addWord(arena, list, joinPath(arena, dir, names[i]));
+        } else {
+            walk(arena, dir, components, index + 1, ncomponents, list);
+        }
+
+        for (i = 0; i < count; i++) {
+            if (types[i] == DT_LNK || !isDirectory(dir, names[i], types[i])) continue;
+            walk(arena, joinPath(arena, dir, names[i]), components, index, ncomponents, list);
+        }
+
+        return;
+    }
+
+    // Only the names that start with the literal prefix can match
+    low = 0;
+    high = listing->count;
+
+    if (component->prefixLength > 0) {
+        while (low < high) {
+            i = (low + high) / 2;
+            if (strncmp(listing->names[i], component->prefix, component->prefixLength) < 0) low = i + 1;
+            else high = i;
+        }
+
+        for (high = low; high < listing->count && strncmp(listing->names[high], component->prefix, component->prefixLength) == 0; high++);
+    }
+
+    for (i = low; i < high; i++) {
+        if (!matchComponent(component, listing->names[i])) continue;
+
+        names[count] = arenaStrdup(arena, listing->names[i]);
+        types[count++] = (unsigned char) listing->names[i][-1];
+    }
+
+    for (i = 0; i < count; i++) {
+        path = joinPath(arena, dir, names[i]);
+
+        if (last) addWord(arena, list, path);
+        else if (isDirectory(dir, names[i], types[i])) walk(arena, path, components, index + 1, ncomponents, list);
+    }
+}
+
+/**
+ * Checks if a directory entry is a directory (or a link to one)
+ *
+ * @param dir Directory of the entry
+ * @param name Entry name
+ * @param type Type reported by getdents64
+ * @return 1 if it is a directory, 0 otherwise
+ */
+static int isDirectory(char * dir, char * name, unsigned char type) {
+    struct stat st;
+    char path[4096];
+
+    if (type == DT_DIR) return 1;
+    if (type != DT_UNKNOWN && type != DT_LNK) return 0;
+
+    snprintf(path, sizeof(path), "%s%s%s", dir, dir[0] != '\0' && strcmp(dir, "/") != 0 ? "/" : "", name);
+
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/**
+ * Returns the listing of a directory, from the cache if the directory did
+ * not change since it was read
+ *
+ * @param dir Directory ("" for the current one)
+ * @return Listing, NULL if the directory can not be read
+ */
+static tlisting * getListing(char * dir) {
+    tlisting * listing;
+    struct stat st;
+    int i, fd, oldest = 0;
+
+    if (stat(dir[0] != '\0' ? dir : ".", &st) == -1 || !S_ISDIR(st.st_mode)) return NULL;
+
+    lookupClock++;
+
+    for (i = 0; i < cached; i++) {
+        listing = &cache[i];
+        if (listing->dev != st.st_dev || listing->ino != st.st_ino) continue;
+
+        // Listings read in the second their directory changed are racy (as
+        // in git's index): a second change may have left the same times
+        if (listing->mtime.tv_sec == st.st_mtim.tv_sec && listing->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+            listing->ctime.tv_sec == st.st_ctim.tv_sec && listing->ctime.tv_nsec == st.st_ctim.tv_nsec &&
+            listing->mtime.tv_sec < listing->readTime && listing->ctime.tv_sec < listing->readTime) {
+            listing->lastUsed = lookupClock;
+            return listing;
+        }
+
+        // Changed since it was read
+        freeListing(listing);
+        break;
+    }
+
+    // Reuse the stale slot, a free one or the least recently used one
+    if (i == cached) {
+        if (cached < CACHE_LISTINGS) i = cached++;
+        else {
+            for (i = 1; i < CACHE_LISTINGS; i++) {
+                if (cache[i].lastUsed < cache[oldest].lastUsed) oldest = i;
+            }
+
+            i = oldest;
+            freeListing(&cache[i]);
+        }
+    }
+
+    listing = &cache[i];
+    listing->dev = st.st_dev;
+    listing->ino = st.st_ino;
+    listing->mtime = st.st_mtim;
+    listing->ctime = st.st_ctim;
+    listing->readTime = time(NULL);
+    listing->lastUsed = lookupClock;
+
+    fd = open(dir[0] != '\0' ? dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd == -1 || readListing(fd, listing) == -1) {
+        if (fd != -1) close(fd);
+
+        // Leave an empty listing that the next lookup reads again
+        listing->mtime.tv_sec = -1;
+        return NULL;
+    }
+
+    close(fd);
+
+    return listing;
+}
+
+/**
+ * Reads a directory with batched getdents64 calls and sorts its entries
+ *
+ * @param fd Open directory
+ * @param listing Listing to fill
+ * @return 0 if successful, -1 if the directory could not be read
+ */
+static int readListing(int fd, tlisting * listing) {
+    char * buffer = (char *) checkedRealloc(NULL, DIRENT_BUFFER);
+    size_t used = 0, size = DIRENT_BUFFER, length, * offsets = NULL;
+    int capacity = 0, i;
+    tdirent * entry;
+    long n, position;
+
+    listing->count = 0;
+    listing->data = (char *) checkedRealloc(NULL, size);
+
+    while ((n = syscall(SYS_getdents64, fd, buffer, DIRENT_BUFFER)) > 0) {
+        for (position = 0; position < n; position += entry->d_reclen) {
+            entry = (tdirent *) (buffer + position);
+
+            if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) continue;
+
+            length = strlen(entry->d_name) + 1;
+
+            if (listing->count == capacity) {
+                capacity = capacity == 0 ? INITIAL_ENTRIES : capacity * 2;
+                offsets = (size_t *) checkedRealloc(offsets, sizeof(size_t) * capacity);
+            }
+
+            if (used + length + 1 > size) {
+                size *= 2;
+                listing->data = (char *) checkedRealloc(listing->data, size);
+            }
+
+            // Type byte, then the name
+            listing->data[used] = (char) entry->d_type;
+            memcpy(listing->data + used + 1, entry->d_name, length);
+            offsets[listing->count++] = used + 1;
+            used += length + 1;
+        }
+    }
+
+    free(buffer);
+
+    // Names point into data once it stopped moving
+    listing->names = (char **) checkedRealloc(NULL, sizeof(char *) * (listing->count + 1));
+    for (i = 0; i < listing->count; i++) listing->names[i] = listing->data + offsets[i];
+    free(offsets);
+
+    if (n == -1) return -1;
+
+    qsort(listing->names, listing->count, sizeof(char *), compareNames);
+
+    return 0;
+}
+
+/**
+ * Joins a directory and a name into a path
+ *
+ * @param arena Arena of the line
+ * @param dir Directory ("" for the current one)
+ * @param name Name
+ * @return Path
+ */
+static char * joinPath(tarena * arena, char * dir, char * name) {
+    size_t dirLength = strlen(dir), nameLength = strlen(name);
+    int separator = dirLength > 0 && dir[dirLength - 1] != '/';
+    char * path;
+
+    if (dirLength == 0) return name;
+
+    path = (char *) arenaAlloc(arena, dirLength + separator + nameLength + 1);
+    memcpy(path, dir, dirLength);
+    if (separator) path[dirLength] = '/';
+    memcpy(path + dirLength + separator, name, nameLength + 1);
+
+    return path;
+}
+
+/**
+ * Compares two names for qsort (byte order, as the prefix search expects)
+ *
+ * @param a First name
+ * @param b Second name
+ * @return Negative, zero or positive
+ */
+static int compareNames(const void * a, const void * b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/**
+ * Frees the memory of a listing
+ *
+ * @param listing Listing to free
+ */
+static void freeListing(tlisting * listing) {
+    free(listing->names);
+    free(listing->data);
+
+    listing->names = NULL;
+    listing->data = NULL;
+    listing->count = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "arena.h"
+
+// ===========================[ Structures ]==========================
+
+/**
+ * Growable list of words in an arena (the argv a line is expanded into)
+ *
+ * @param words: NULL terminated array of words
+ * @param count: Number of words
+ * @param capacity: Allocated entries (including the terminator)
+ */
+typedef struct {
+    char ** words;
+    int count;
+    int capacity;
+} twordlist;
+
+/**
+ * Cached listing of a directory, sorted by name. Every name is stored
+ * right after its type byte, so sorting the names keeps the types.
+ *
+ * @param dev: Device of the directory
+ * @param ino: Inode of the directory
+ * @param mtime: Modification time when it was read
+ * @param ctime: Status change time when it was read
+ * @param readTime: Time (seconds) it was read, a directory changed in that
+ *                  second may change again with the same times
+ * @param names: Entry names (into data, the type is names[i][-1])
+ * @param count: Number of entries
+ * @param data: Memory of the names
+ * @param lastUsed: Lookup clock when it was last used (LRU eviction)
+ */
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    struct timespec ctime;
+    time_t readTime;
+    char ** names;
+    int count;
+    char * data;
+    unsigned long lastUsed;
+} tlisting;
+
+// ===========================[ Prototypes ]==========================
+
+void initWordList(tarena * arena, twordlist * list, int capacity);
+void addWord(tarena * arena, twordlist * list, char * word);
+int hasGlob(const char * word);
+int expandGlob(tarena * arena, char * pattern, twordlist * list);
+void clearGlobCache();
+
+#endif